@@ -0,0 +1,270 @@
+#include <string.h>
+#include "utils.h"
+#include "proc.h"
+#include "attrib.h"
+
+// Commands and sets live in chunks that never move, so their names can
+// be read without a lock while new ones are added
+#define ATTRIB_CHUNK         1024
+#define ATTRIB_MAX_COMMANDS  (64*ATTRIB_CHUNK)
+#define ATTRIB_MAX_SETS      (1024*ATTRIB_CHUNK)
+#define ATTRIB_MAX_MEMO      (1 << 20)
+
+typedef struct attrib_set {
+    char     *text;                    // "3,7,12", the interning key
+    uint32_t  n;
+    uint32_t  ids[];                   // sorted
+} attrib_set_t;
+
+KHASH_MAP_INIT_INT64(memo, uint32_t)
+
+static int             at_enabled = 0;
+static char          **at_roots = NULL;
+static int             at_n_roots = 0;
+static int             at_depth = 4;
+static uint64_t        at_ttl_ns = 0;
+static Hash           *at_cmd_ids = NULL;    // command -> number, under atlock
+static char          **at_cmds[ATTRIB_MAX_COMMANDS/ATTRIB_CHUNK];
+static uint32_t        at_n_cmds = 0;
+static size_t          at_cmd_bytes = 0;
+static pthread_rwlock_t atlock = PTHREAD_RWLOCK_INITIALIZER;
+// Sets: under the caller's lock
+static Hash           *at_set_ids = NULL;    // text -> number
+static khash_t(memo)  *at_memo = NULL;       // set << 32 | command -> set
+static attrib_set_t  **at_sets[ATTRIB_MAX_SETS/ATTRIB_CHUNK];
+static uint32_t        at_n_sets = 0;
+static size_t          at_set_bytes = 0;
+
+static attrib_set_t    empty_set = { "", 0 };
+
+static int is_root(const char *name) {
+    for (int i = 0; i < at_n_roots; i++) {
+        if (strcmp(name, at_roots[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Under atlock, held for writing
+static uint32_t intern_command(const char *chain) {
+    uint32_t cmd = (uint32_t)(uintptr_t)Hash_Find(at_cmd_ids, chain);
+    char *name;
+
+    if (cmd != 0) {
+        return cmd;
+    }
+    if (at_n_cmds == ATTRIB_MAX_COMMANDS) {
+        return ATTRIB_UNKNOWN;
+    }
+    cmd = at_n_cmds;
+    if (cmd % ATTRIB_CHUNK == 0) {
+        at_cmds[cmd/ATTRIB_CHUNK] = calloc(ATTRIB_CHUNK, sizeof(char *));
+        at_cmd_bytes += malloc_usable_size(at_cmds[cmd/ATTRIB_CHUNK]);
+    }
+    name = strdup(chain);
+    at_cmds[cmd/ATTRIB_CHUNK][cmd % ATTRIB_CHUNK] = name;
+    at_cmd_bytes += malloc_usable_size(name);
+    Hash_Add(at_cmd_ids, name, (void *)(uintptr_t)cmd);
+    __atomic_store_n(&at_n_cmds, cmd + 1, __ATOMIC_RELEASE);
+    return cmd;
+}
+
+// "name<parent<grandparent", at most at_depth names, stopping at a root
+static uint32_t resolve(pid_t pid, const proc_info_t *self) {
+    char chain[PROC_NAME*16];
+    proc_info_t pi = *self;
+    size_t len;
+    uint32_t cmd;
+
+    // The process, not the thread, which may have renamed itself
+    if (pi.tgid != pid && Proc_Status(pi.tgid, &pi) != 0) {
+        pi = *self;
+    }
+    len = snprintf(chain, sizeof(chain), "%s", pi.name);
+    for (int d = 1; d < at_depth && pi.ppid > 1; d++) {
+        if (Proc_Status(pi.ppid, &pi) != 0 || is_root(pi.name)) {
+            break;
+        }
+        len += snprintf(chain + len, sizeof(chain) - len, "<%s", pi.name);
+        if (len >= sizeof(chain)) {
+            break;
+        }
+    }
+
+    pthread_rwlock_wrlock(&atlock);
+    cmd = intern_command(chain);
+    pthread_rwlock_unlock(&atlock);
+    return cmd;
+}
+
+int Attrib_Init(char **roots, int n_roots, int depth, int ttl_ms) {
+    at_roots = roots;
+    at_n_roots = n_roots;
+    at_depth = depth < 1 ? 1 : (depth > 16 ? 16 : depth);
+    at_ttl_ns = ttl_ms > 0 ? (uint64_t)ttl_ms*1000000ULL : 0;
+    at_cmd_ids = Hash_New(32);
+    at_set_ids = Hash_New(32);
+    at_memo = kh_init(memo);
+
+    at_cmds[0] = calloc(ATTRIB_CHUNK, sizeof(char *));
+    at_cmds[0][ATTRIB_UNKNOWN] = strdup("?");
+    at_n_cmds = 1;
+    at_sets[0] = calloc(ATTRIB_CHUNK, sizeof(attrib_set_t *));
+    at_sets[0][ATTRIB_NONE] = &empty_set;
+    at_n_sets = 1;
+    at_cmd_bytes = malloc_usable_size(at_cmds[0]) + malloc_usable_size(at_cmds[0][0]);
+    at_set_bytes = malloc_usable_size(at_sets[0]);
+    at_enabled = 1;
+    return 0;
+}
+
+int Attrib_Enabled(void) {
+    return at_enabled;
+}
+
+static uint64_t derive_command(pid_t pid, const proc_info_t *pi, void *ctx) {
+    return pi != NULL ? resolve(pid, pi) : ATTRIB_UNKNOWN;   // exited before we could look
+}
+
+void Attrib_Query(proc_query_t *q) {
+    q->slot = PROC_SLOT_COMMAND;
+    q->ttl_ns = at_ttl_ns;
+    q->tag = 0;
+    q->stable = 1;
+    q->derive = derive_command;
+    q->ctx = NULL;
+    q->value = ATTRIB_UNKNOWN;
+}
+
+static inline attrib_set_t *set_at(uint32_t set) {
+    return at_sets[set/ATTRIB_CHUNK][set % ATTRIB_CHUNK];
+}
+
+static uint32_t intern_set(const uint32_t *ids, uint32_t n) {
+    attrib_set_t *s;
+    char *text, *p;
+    uint32_t set;
+
+    text = malloc(n*11 + 1);
+    p = text;
+    for (uint32_t i = 0; i < n; i++) {
+        p += sprintf(p, i > 0 ? ",%u" : "%u", ids[i]);
+    }
+    set = (uint32_t)(uintptr_t)Hash_Find(at_set_ids, text);
+    if (set != 0 || at_n_sets == ATTRIB_MAX_SETS) {
+        free(text);
+        return set;
+    }
+
+    set = at_n_sets;
+    if (set % ATTRIB_CHUNK == 0) {
+        at_sets[set/ATTRIB_CHUNK] = calloc(ATTRIB_CHUNK, sizeof(attrib_set_t *));
+        at_set_bytes += malloc_usable_size(at_sets[set/ATTRIB_CHUNK]);
+    }
+    s = malloc(sizeof(attrib_set_t) + n*sizeof(uint32_t));
+    s->text = realloc(text, p - text + 1);
+    s->n = n;
+    memcpy(s->ids, ids, n*sizeof(uint32_t));
+    at_sets[set/ATTRIB_CHUNK][set % ATTRIB_CHUNK] = s;
+    at_set_bytes += malloc_usable_size(s) + malloc_usable_size(s->text);
+    Hash_Add(at_set_ids, s->text, (void *)(uintptr_t)set);
+    at_n_sets = set + 1;
+    return set;
+}
+
+uint32_t Attrib_Set_Add(uint32_t set, uint32_t cmd) {
+    attrib_set_t *s = set_at(set);
+    uint64_t key = (uint64_t)set << 32 | cmd;
+    uint32_t stack[64], *ids, next, i;
+    khint_t k;
+    int absent;
+
+    // Most accesses come from a command the path has seen already
+    i = 0;
+    while (i < s->n && s->ids[i] < cmd) {
+        i++;
+    }
+    if (i < s->n && s->ids[i] == cmd) {
+        return set;
+    }
+    k = kh_get(memo, at_memo, key);
+    if (k != kh_end(at_memo)) {
+        return kh_value(at_memo, k);
+    }
+
+    ids = s->n < 64 ? stack : malloc((s->n + 1)*sizeof(uint32_t));
+    memcpy(ids, s->ids, i*sizeof(uint32_t));
+    ids[i] = cmd;
+    memcpy(ids + i + 1, s->ids + i, (s->n - i)*sizeof(uint32_t));
+    next = intern_set(ids, s->n + 1);
+    if (ids != stack) {
+        free(ids);
+    }
+    if (next == ATTRIB_NONE) {
+        return set;                    // out of sets: keep what it had
+    }
+
+    if (kh_size(at_memo) >= ATTRIB_MAX_MEMO) {
+        kh_clear(memo, at_memo);
+    }
+    k = kh_put(memo, at_memo, key, &absent);
+    kh_value(at_memo, k) = next;
+    return next;
+}
+
+const char *Attrib_Set_Text(uint32_t set) {
+    if (!at_enabled) {
+        return "";
+    }
+    return set_at(set)->text;
+}
+
+uint32_t Attrib_Commands(void) {
+    return at_enabled ? __atomic_load_n(&at_n_cmds, __ATOMIC_ACQUIRE) : 0;
+}
+
+const char *Attrib_Command_Name(uint32_t cmd) {
+    if (cmd >= Attrib_Commands()) {
+        return "?";
+    }
+    return at_cmds[cmd/ATTRIB_CHUNK][cmd % ATTRIB_CHUNK];
+}
+
+void Attrib_Free(void) {
+    if (!at_enabled) {
+        return;
+    }
+    at_enabled = 0;
+    for (uint32_t i = 0; i < at_n_cmds; i++) {
+        free(at_cmds[i/ATTRIB_CHUNK][i % ATTRIB_CHUNK]);
+    }
+    for (uint32_t i = 0; i < at_n_cmds; i += ATTRIB_CHUNK) {
+        free(at_cmds[i/ATTRIB_CHUNK]);
+    }
+    for (uint32_t i = 1; i < at_n_sets; i++) {
+        free(set_at(i)->text);
+        free(set_at(i));
+    }
+    for (uint32_t i = 0; i < at_n_sets; i += ATTRIB_CHUNK) {
+        free(at_sets[i/ATTRIB_CHUNK]);
+    }
+    kh_destroy(memo, at_memo);
+    Hash_Free(at_cmd_ids);
+    Hash_Free(at_set_ids);
+    at_n_cmds = at_n_sets = 0;
+}
+
+// Sets are counted under the caller's lock, like Attrib_Set_Add()
+size_t Attrib_Bytes(void) {
+    size_t bytes;
+
+    if (!at_enabled) {
+        return 0;
+    }
+    bytes = at_set_bytes + Hash_Bytes(at_set_ids) + HASH_ARRAY_BYTES(at_memo, sizeof(uint64_t) + sizeof(uint32_t));
+    pthread_rwlock_rdlock(&atlock);
+    bytes += at_cmd_bytes + Hash_Bytes(at_cmd_ids);
+    pthread_rwlock_unlock(&atlock);
+    return bytes;
+}
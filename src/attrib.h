@@ -0,0 +1,49 @@
+#ifndef attrib_h
+#define attrib_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-process attribution: which commands accessed each path. A caller is
+// identified by its command, the process name followed by those of its
+// ancestors up to, not including, a root such as "ninja" or "make":
+// "clang<sh<python3". Commands and sets of commands are interned and
+// numbered; each path keeps the number of its set, and paths used by the
+// same tools share a set.
+//
+// A pid's command is kept in the shared /proc cache (proc.h) and checked
+// again once older than the ttl, to notice an exec(); a process that
+// exec()s within the ttl of its last access is attributed to its former
+// name.
+
+#define ATTRIB_UNKNOWN  0              // command "?": the pid is gone or unreadable
+#define ATTRIB_NONE     0              // the empty set
+
+int         Attrib_Init(char **roots, int n_roots, int depth, int ttl_ms);
+int         Attrib_Enabled(void);
+// Sets up q for Proc_Query() on the calling pid (from fuse_get_context());
+// the command number is then q->value
+void        Attrib_Query(proc_query_t *q);
+// Set with cmd added to set. Not thread safe: the caller serializes it
+// with other updates (prmutex). Sets are never moved or freed, so
+// Attrib_Set_Text() may run concurrently.
+uint32_t    Attrib_Set_Add(uint32_t set, uint32_t cmd);
+// Command numbers of a set, "3,7,12"
+const char *Attrib_Set_Text(uint32_t set);
+// Number of commands so far and the name of each
+uint32_t    Attrib_Commands(void);
+const char *Attrib_Command_Name(uint32_t cmd);
+void        Attrib_Free(void);
+size_t      Attrib_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "binlog.h"
+
+#define ALIGN8(x)   (((x) + 7) & ~(uint64_t)7)
+
+static int cmp_entry(const void *a, const void *b) {
+    return strcmp(((const binlog_entry_t *)a)->path, ((const binlog_entry_t *)b)->path);
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// NULL when the varint runs past end
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    int shift = 0;
+    *v = 0;
+    while (p < end && (*p & 0x80) && shift < 64) {
+        *v |= (uint64_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    if (p >= end || shift >= 64) {
+        return NULL;
+    }
+    *v |= (uint64_t)(*p++) << shift;
+    return p;
+}
+
+static int write_padded(FILE *fp, const void *data, size_t size, uint64_t padded) {
+    static const char zeros[8];
+    if (size > 0 && fwrite(data, size, 1, fp) != 1) {
+        return -1;
+    }
+    if (padded > size && fwrite(zeros, padded - size, 1, fp) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+int Binlog_Write(const char *file, binlog_entry_t *entries, size_t n,
+                 const int *op_flags, const char *legend, int qn_ops) {
+    binlog_header_t hdr;
+    uint8_t *paths = NULL;
+    size_t paths_len = 0, paths_cap = 0;
+    uint64_t *index;
+    uint32_t *flags;
+    uint64_t *counts;
+    const char *prev = "";
+    FILE *fp;
+    int rc = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (strlen(entries[i].path) >= PATH_MAX) {
+            return -ENAMETOOLONG;
+        }
+    }
+    // callers often pass entries that are already sorted
+    for (size_t i = 1; i < n; i++) {
+        if (strcmp(entries[i - 1].path, entries[i].path) > 0) {
+            qsort(entries, n, sizeof(binlog_entry_t), cmp_entry);
+            break;
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BINLOG_MAGIC, sizeof(hdr.magic));
+    hdr.version = BINLOG_VERSION;
+    hdr.byte_order = BINLOG_BYTE_ORDER;
+    hdr.header_size = sizeof(binlog_header_t);
+    hdr.qn_ops = qn_ops;
+    for (int i = 0; i < qn_ops && i < BINLOG_MAX_OPS; i++) {
+        hdr.op_flags[i] = (uint8_t)op_flags[i];
+        hdr.legend[i] = legend[i];
+    }
+    hdr.entry_count = n;
+    hdr.block_size = BINLOG_BLOCK;
+    hdr.block_count = (n + BINLOG_BLOCK - 1)/BINLOG_BLOCK;
+
+    index = malloc((hdr.block_count + 1)*sizeof(uint64_t));
+    flags = malloc((n + 1)*sizeof(uint32_t));
+    counts = malloc((n + 1)*sizeof(uint64_t));
+
+    for (size_t i = 0; i < n; i++) {
+        const char *path = entries[i].path;
+        size_t len = strlen(path);
+        size_t shared = 0;
+
+        if (i % BINLOG_BLOCK == 0) {
+            index[i/BINLOG_BLOCK] = paths_len;
+        }
+        else {
+            while (prev[shared] != '\0' && prev[shared] == path[shared]) {
+                shared++;
+            }
+        }
+        if (paths_len + len + 20 > paths_cap) {
+            paths_cap = (paths_cap + len + 20)*2;
+            paths = realloc(paths, paths_cap);
+        }
+        paths_len += put_varint(paths + paths_len, shared);
+        paths_len += put_varint(paths + paths_len, len - shared);
+        memcpy(paths + paths_len, path + shared, len - shared);
+        paths_len += len - shared;
+
+        flags[i] = entries[i].flags;
+        counts[i] = entries[i].count;
+        hdr.total_ops += entries[i].count;
+        prev = path;
+    }
+
+    hdr.paths_off = ALIGN8(sizeof(binlog_header_t));
+    hdr.paths_size = paths_len;
+    hdr.index_off = ALIGN8(hdr.paths_off + paths_len);
+    hdr.flags_off = ALIGN8(hdr.index_off + hdr.block_count*sizeof(uint64_t));
+    hdr.counts_off = ALIGN8(hdr.flags_off + n*sizeof(uint32_t));
+    hdr.file_size = hdr.counts_off + n*sizeof(uint64_t);
+
+    fp = fopen(file, "w");
+    if (fp == NULL) {
+        rc = -errno;
+    }
+    else {
+        if (write_padded(fp, &hdr, sizeof(hdr), hdr.paths_off) == -1 ||
+            write_padded(fp, paths, paths_len, hdr.index_off - hdr.paths_off) == -1 ||
+            write_padded(fp, index, hdr.block_count*sizeof(uint64_t), hdr.flags_off - hdr.index_off) == -1 ||
+            write_padded(fp, flags, n*sizeof(uint32_t), hdr.counts_off - hdr.flags_off) == -1 ||
+            write_padded(fp, counts, n*sizeof(uint64_t), n*sizeof(uint64_t)) == -1) {
+            rc = -EIO;
+        }
+        if (fclose(fp) != 0 && rc == 0) {
+            rc = -errno;
+        }
+    }
+
+    free(paths);
+    free(index);
+    free(flags);
+    free(counts);
+    return rc;
+}
+
+// True when count items of size bytes at off, 8-byte aligned, lie inside
+// a file of size file_size
+static int section_fits(uint64_t off, uint64_t count, uint64_t size, uint64_t file_size) {
+    return off % 8 == 0 && off <= file_size && count <= (file_size - off)/size;
+}
+
+// Every offset and length of the header against the file, so that
+// lookups on a truncated or corrupt file never leave the mapping
+static int header_valid(const binlog_t *bl) {
+    const binlog_header_t *h = bl->hdr;
+    const uint64_t *index;
+
+    if (memcmp(h->magic, BINLOG_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != BINLOG_VERSION ||
+        h->byte_order != BINLOG_BYTE_ORDER ||
+        h->header_size < sizeof(binlog_header_t) ||
+        h->file_size > bl->size ||
+        h->block_size == 0 ||
+        h->block_count != (h->entry_count + h->block_size - 1)/h->block_size ||
+        !section_fits(h->paths_off, h->paths_size, 1, bl->size) ||
+        !section_fits(h->index_off, h->block_count, sizeof(uint64_t), bl->size) ||
+        !section_fits(h->flags_off, h->entry_count, sizeof(uint32_t), bl->size) ||
+        !section_fits(h->counts_off, h->entry_count, sizeof(uint64_t), bl->size)) {
+        return 0;
+    }
+    index = (const uint64_t *)((const char *)bl->map + h->index_off);
+    for (uint32_t i = 0; i < h->block_count; i++) {
+        if (index[i] >= h->paths_size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int Binlog_Open(binlog_t *bl, const char *file) {
+    struct stat st;
+    int fd;
+
+    memset(bl, 0, sizeof(binlog_t));
+    fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        return -errno;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(binlog_header_t)) {
+        close(fd);
+        return -EINVAL;
+    }
+    bl->size = st.st_size;
+    bl->map = mmap(NULL, bl->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (bl->map == MAP_FAILED) {
+        bl->map = NULL;
+        return -errno;
+    }
+
+    bl->hdr = bl->map;
+    if (!header_valid(bl)) {
+        Binlog_Close(bl);
+        return -EINVAL;
+    }
+    bl->paths = (const uint8_t *)bl->map + bl->hdr->paths_off;
+    bl->index = (const uint64_t *)((const char *)bl->map + bl->hdr->index_off);
+    bl->flags = (const uint32_t *)((const char *)bl->map + bl->hdr->flags_off);
+    bl->counts = (const uint64_t *)((const char *)bl->map + bl->hdr->counts_off);
+    return 0;
+}
+
+void Binlog_Close(binlog_t *bl) {
+    if (bl->map != NULL) {
+        munmap(bl->map, bl->size);
+    }
+    memset(bl, 0, sizeof(binlog_t));
+}
+
+static void iter_block(binlog_iter_t *it, uint32_t block) {
+    it->pos = (uint64_t)block*it->bl->hdr->block_size;
+    it->p = it->bl->paths + it->bl->index[block];
+    it->len = 0;
+    it->path[0] = '\0';
+}
+
+// Decodes the entry at it->pos into it->path; returns its index or -1.
+// An entry running past the paths section ends the iteration.
+int64_t Binlog_Next(binlog_iter_t *it) {
+    const uint8_t *end;
+    uint64_t shared, suffix, copy;
+
+    if (it->bl == NULL || it->pos >= it->bl->hdr->entry_count) {
+        return -1;
+    }
+    end = it->bl->paths + it->bl->hdr->paths_size;
+    it->p = get_varint(it->p, end, &shared);
+    it->p = it->p != NULL ? get_varint(it->p, end, &suffix) : NULL;
+    if (it->p == NULL || suffix > (uint64_t)(end - it->p)) {
+        it->pos = it->bl->hdr->entry_count;
+        return -1;
+    }
+    if (shared > it->len) {
+        shared = it->len;
+    }
+    // Binlog_Write() never encodes such a path; only the part that fits is
+    // kept, and the next entry starts after the whole suffix
+    copy = shared + suffix < sizeof(it->path) ? suffix : sizeof(it->path) - 1 - shared;
+    memcpy(it->path + shared, it->p, copy);
+    it->len = shared + copy;
+    it->path[it->len] = '\0';
+    it->p += suffix;
+    return it->pos++;
+}
+
+// Positions the iterator so that Binlog_Next() returns the first entry
+// whose path is >= key: binary search over block heads, then a scan of
+// at most one block.
+void Binlog_Seek(binlog_iter_t *it, const binlog_t *bl, const char *key) {
+    uint32_t lo = 0, hi, block = 0;
+    uint64_t start, found;
+    int64_t idx;
+
+    it->bl = bl;
+    it->pos = 0;
+    it->len = 0;
+    it->path[0] = '\0';
+    if (bl->hdr->entry_count == 0) {
+        return;
+    }
+
+    hi = bl->hdr->block_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        iter_block(it, mid);
+        Binlog_Next(it);
+        if (strcmp(it->path, key) <= 0) {
+            block = mid;
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    iter_block(it, block);
+    start = it->pos;
+    found = start + bl->hdr->block_size;
+    while ((idx = Binlog_Next(it)) >= 0 && (uint64_t)idx < start + bl->hdr->block_size) {
+        if (strcmp(it->path, key) >= 0) {
+            found = idx;
+            break;
+        }
+    }
+
+    // Replay up to the entry before the lower bound to rebuild the prefix
+    iter_block(it, block);
+    while (it->pos < found && it->pos < bl->hdr->entry_count) {
+        Binlog_Next(it);
+    }
+}
+
+int64_t Binlog_Find(const binlog_t *bl, const char *path) {
+    binlog_iter_t it;
+    int64_t idx;
+
+    Binlog_Seek(&it, bl, path);
+    idx = Binlog_Next(&it);
+    if (idx >= 0 && strcmp(it.path, path) == 0) {
+        return idx;
+    }
+    return -1;
+}
@@ -0,0 +1,89 @@
+#ifndef binlog_h
+#define binlog_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary log: a read-only, mmap-able image of the recording table.
+//
+//   binlog_header_t
+//   paths   - entries sorted by path, front coded in blocks of
+//             BINLOG_BLOCK entries: varint shared, varint suffix_len,
+//             suffix bytes. The first entry of a block has shared == 0.
+//   index   - u64 offset (into paths) of each block's first entry
+//   flags   - u32 per entry, operation mask (bit n == op n)
+//   counts  - u64 per entry, total number of recorded operations
+//
+// Sections start on 8-byte boundaries; numbers are in native byte order
+// (check byte_order == BINLOG_BYTE_ORDER).
+
+#define BINLOG_MAGIC       "DFSBIN01"
+#define BINLOG_VERSION     1
+#define BINLOG_BYTE_ORDER  0x01020304
+#define BINLOG_BLOCK       32
+#define BINLOG_MAX_OPS     32
+
+typedef struct binlog_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint32_t qn_ops;
+    uint8_t  op_flags[BINLOG_MAX_OPS];     // [filter] setting per op
+    char     legend[BINLOG_MAX_OPS];       // op symbols, "GArdKM..."
+    uint64_t entry_count;
+    uint64_t total_ops;
+    uint32_t block_size;
+    uint32_t block_count;
+    uint64_t paths_off;
+    uint64_t paths_size;
+    uint64_t index_off;
+    uint64_t flags_off;
+    uint64_t counts_off;
+    uint64_t file_size;
+} binlog_header_t;
+
+typedef struct binlog_entry {
+    const char *path;
+    uint64_t    count;
+    uint32_t    flags;
+} binlog_entry_t;
+
+typedef struct binlog {
+    void                  *map;
+    size_t                 size;
+    const binlog_header_t *hdr;
+    const uint8_t         *paths;
+    const uint64_t        *index;
+    const uint32_t        *flags;
+    const uint64_t        *counts;
+} binlog_t;
+
+typedef struct binlog_iter {
+    const binlog_t *bl;
+    uint64_t        pos;               // index of the next entry
+    const uint8_t  *p;                 // its encoded form
+    size_t          len;               // length of path
+    char            path[4097];
+} binlog_iter_t;
+
+// Sorts entries by path (unless they already are) and writes them to file;
+// -ENAMETOOLONG if a path has PATH_MAX bytes or more
+int      Binlog_Write(const char *file, binlog_entry_t *entries, size_t n,
+                      const int *op_flags, const char *legend, int qn_ops);
+
+int      Binlog_Open(binlog_t *bl, const char *file);
+void     Binlog_Close(binlog_t *bl);
+int64_t  Binlog_Find(const binlog_t *bl, const char *path);
+void     Binlog_Seek(binlog_iter_t *it, const binlog_t *bl, const char *prefix);
+int64_t  Binlog_Next(binlog_iter_t *it);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
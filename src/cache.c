@@ -0,0 +1,538 @@
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "utils.h"
+#include "cache.h"
+
+KHASH_SET_INIT_STR(nameset)
+
+typedef struct neg_dir {
+    dev_t             dev;
+    ino_t             ino;
+    struct timespec   mtime;
+    uint64_t          checked_ns;      // last time the identity was verified
+    khash_t(nameset) *names;           // leaf names known to be missing
+} neg_dir_t;
+
+static int      nc_enabled = 0;
+static uint64_t nc_ttl_ns = 0;
+static int      nc_max_names = 0;
+static int      nc_names = 0;
+static unsigned nc_gen = 0;            // bumped on every invalidation
+static Hash    *nc_dirs = NULL;
+static pthread_mutex_t ncmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// Split "/a/b/c" into parent key "/a/b" and leaf "c"
+static const char *split_path(const char *path, char *parent, size_t size) {
+    const char *slash = strrchr(path, '/');
+    size_t len;
+
+    if (slash == NULL || slash[1] == '\0') {
+        return NULL;
+    }
+    len = slash - path;
+    if (len == 0) {
+        len = 1;                       // parent is the mount root
+    }
+    if (len >= size) {
+        return NULL;
+    }
+    memcpy(parent, path, len);
+    parent[len] = '\0';
+    return slash + 1;
+}
+
+static int stat_parent(const char *parent, struct stat *st) {
+    const char *rel = (parent[1] == '\0') ? "." : parent + 1;
+    if (lstat(rel, st) == -1 || !S_ISDIR(st->st_mode)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int same_identity(const neg_dir_t *d, const struct stat *st) {
+    return d->dev == st->st_dev && d->ino == st->st_ino &&
+           d->mtime.tv_sec == st->st_mtim.tv_sec &&
+           d->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void clear_names(neg_dir_t *d) {
+    for (khiter_t k = 0; k < kh_end(d->names); ++k) {
+        if (kh_exist(d->names, k)) {
+            free((char *)kh_key(d->names, k));
+            nc_names--;
+        }
+    }
+    kh_clear(nameset, d->names);
+}
+
+static void drop_dir(khiter_t k) {
+    neg_dir_t *d = kh_value(nc_dirs, k);
+    clear_names(d);
+    kh_destroy(nameset, d->names);
+    free((char *)kh_key(nc_dirs, k));
+    free(d);
+    kh_del(text, nc_dirs, k);
+}
+
+static void drop_all(void) {
+    for (khiter_t k = 0; k < kh_end(nc_dirs); ++k) {
+        if (kh_exist(nc_dirs, k)) {
+            drop_dir(k);
+        }
+    }
+}
+
+void NegCache_Init(int enabled, int ttl_ms, int max_names) {
+    nc_enabled = enabled;
+    nc_ttl_ns = (uint64_t)ttl_ms*1000000ULL;
+    nc_max_names = max_names;
+    if (nc_dirs == NULL) {
+        nc_dirs = Hash_New(64);
+    }
+}
+
+// Returns 1 if path is known to be missing. *gen must be passed back to
+// NegCache_Insert() so that a mutation racing with the lookup wins.
+int NegCache_Lookup(const char *path, unsigned *gen) {
+    char parent[PATH_MAX];
+    const char *leaf;
+    neg_dir_t *d;
+    khiter_t k;
+    struct stat st;
+    uint64_t now;
+    int hit = 0;
+
+    if (nc_enabled == 0) {
+        return 0;
+    }
+
+    leaf = split_path(path, parent, sizeof(parent));
+
+    pthread_mutex_lock(&ncmutex);
+    *gen = nc_gen;
+    if (leaf == NULL || (k = kh_get(text, nc_dirs, parent)) == kh_end(nc_dirs)) {
+        pthread_mutex_unlock(&ncmutex);
+        return 0;
+    }
+    d = kh_value(nc_dirs, k);
+    if (kh_get(nameset, d->names, leaf) == kh_end(d->names)) {
+        pthread_mutex_unlock(&ncmutex);
+        return 0;
+    }
+    now = now_ns();
+    if (now - d->checked_ns <= nc_ttl_ns) {
+        pthread_mutex_unlock(&ncmutex);
+        return 1;
+    }
+    pthread_mutex_unlock(&ncmutex);
+
+    // Stale: re-check the parent's identity outside the lock
+    int valid = stat_parent(parent, &st) == 0;
+
+    pthread_mutex_lock(&ncmutex);
+    k = kh_get(text, nc_dirs, parent);
+    if (k != kh_end(nc_dirs)) {
+        d = kh_value(nc_dirs, k);
+        if (valid && same_identity(d, &st)) {
+            d->checked_ns = now;
+            hit = kh_get(nameset, d->names, leaf) != kh_end(d->names);
+        }
+        else {
+            drop_dir(k);
+        }
+    }
+    pthread_mutex_unlock(&ncmutex);
+    return hit;
+}
+
+void NegCache_Insert(const char *path, unsigned gen) {
+    char parent[PATH_MAX];
+    const char *leaf;
+    neg_dir_t *d = NULL;
+    khiter_t k;
+    struct stat st;
+    uint64_t now;
+    int ret;
+
+    if (nc_enabled == 0) {
+        return;
+    }
+    leaf = split_path(path, parent, sizeof(parent));
+    if (leaf == NULL) {
+        return;
+    }
+
+    now = now_ns();
+    pthread_mutex_lock(&ncmutex);
+    k = kh_get(text, nc_dirs, parent);
+    if (k != kh_end(nc_dirs)) {
+        d = kh_value(nc_dirs, k);
+        if (now - d->checked_ns > nc_ttl_ns) {
+            d = NULL;
+        }
+    }
+    if (d == NULL) {
+        pthread_mutex_unlock(&ncmutex);
+        if (stat_parent(parent, &st) == -1) {
+            return;
+        }
+        pthread_mutex_lock(&ncmutex);
+        if (gen != nc_gen) {
+            goto out;
+        }
+        k = kh_get(text, nc_dirs, parent);
+        if (k == kh_end(nc_dirs)) {
+            d = malloc(sizeof(neg_dir_t));
+            d->names = kh_init(nameset);
+            Hash_Add(nc_dirs, strdup(parent), d);
+        }
+        else {
+            d = kh_value(nc_dirs, k);
+            if (!same_identity(d, &st)) {
+                clear_names(d);
+            }
+        }
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+        d->mtime = st.st_mtim;
+        d->checked_ns = now;
+    }
+    else if (gen != nc_gen) {
+        goto out;
+    }
+
+    if (kh_get(nameset, d->names, leaf) == kh_end(d->names)) {
+        if (nc_names >= nc_max_names) {
+            // Over budget: start over rather than track usage per entry
+            clear_names(d);
+            for (k = 0; k < kh_end(nc_dirs); ++k) {
+                if (kh_exist(nc_dirs, k) && kh_value(nc_dirs, k) != d) {
+                    drop_dir(k);
+                }
+            }
+        }
+        kh_put(nameset, d->names, strdup(leaf), &ret);
+        nc_names++;
+    }
+out:
+    pthread_mutex_unlock(&ncmutex);
+}
+
+// Called after path was created (or became a rename target) via the mount
+void NegCache_Invalidate(const char *path) {
+    char parent[PATH_MAX];
+    const char *leaf;
+    khiter_t k;
+
+    if (nc_enabled == 0) {
+        return;
+    }
+    leaf = split_path(path, parent, sizeof(parent));
+
+    pthread_mutex_lock(&ncmutex);
+    nc_gen++;
+    if (leaf != NULL && (k = kh_get(text, nc_dirs, parent)) != kh_end(nc_dirs)) {
+        neg_dir_t *d = kh_value(nc_dirs, k);
+        khiter_t n = kh_get(nameset, d->names, leaf);
+        if (n != kh_end(d->names)) {
+            free((char *)kh_key(d->names, n));
+            kh_del(nameset, d->names, n);
+            nc_names--;
+        }
+    }
+    // path itself may be a (re)created directory with stale entries
+    if ((k = kh_get(text, nc_dirs, path)) != kh_end(nc_dirs)) {
+        drop_dir(k);
+    }
+    pthread_mutex_unlock(&ncmutex);
+}
+
+void NegCache_InvalidateAll(void) {
+    if (nc_enabled == 0) {
+        return;
+    }
+    pthread_mutex_lock(&ncmutex);
+    nc_gen++;
+    drop_all();
+    pthread_mutex_unlock(&ncmutex);
+}
+
+void NegCache_Free(void) {
+    if (nc_dirs != NULL) {
+        drop_all();
+        Hash_Free(nc_dirs);
+        nc_dirs = NULL;
+    }
+}
+
+// Walks the cache; it holds at most negative_max_names names
+size_t NegCache_Bytes(void) {
+    size_t bytes = 0;
+
+    if (nc_dirs == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&ncmutex);
+    bytes = Hash_Bytes(nc_dirs);
+    for (khiter_t k = 0; k < kh_end(nc_dirs); ++k) {
+        if (kh_exist(nc_dirs, k)) {
+            neg_dir_t *d = kh_value(nc_dirs, k);
+            bytes += malloc_usable_size((char *)kh_key(nc_dirs, k)) + malloc_usable_size(d);
+            bytes += sizeof(*d->names) + HASH_ARRAY_BYTES(d->names, sizeof(kh_cstr_t));
+            for (khiter_t n = 0; n < kh_end(d->names); ++n) {
+                if (kh_exist(d->names, n)) {
+                    bytes += malloc_usable_size((char *)kh_key(d->names, n));
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&ncmutex);
+    return bytes;
+}
+
+struct dir_builder {
+    char          *key;
+    struct stat    st;
+    int            count;
+    int            cap;
+    uint64_t      *inos;
+    uint32_t      *name_off;
+    unsigned char *types;
+    char          *names;
+    size_t         names_len;
+    size_t         names_cap;
+};
+
+static int      dc_enabled = 0;
+static size_t   dc_max_bytes = 0;
+static size_t   dc_bytes = 0;
+static Hash    *dc_dirs = NULL;
+static pthread_mutex_t dcmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void unref_listing(dir_listing_t *dl) {
+    if (--dl->refs == 0) {
+        free(dl);
+    }
+}
+
+static void drop_listing(khiter_t k) {
+    dir_listing_t *dl = kh_value(dc_dirs, k);
+    dc_bytes -= dl->bytes;
+    free((char *)kh_key(dc_dirs, k));
+    kh_del(text, dc_dirs, k);
+    unref_listing(dl);
+}
+
+static void drop_all_listings(void) {
+    for (khiter_t k = 0; k < kh_end(dc_dirs); ++k) {
+        if (kh_exist(dc_dirs, k)) {
+            drop_listing(k);
+        }
+    }
+}
+
+void DirCache_Init(int enabled, int max_mb) {
+    dc_enabled = enabled;
+    dc_max_bytes = (size_t)max_mb*1024*1024;
+    if (dc_dirs == NULL) {
+        dc_dirs = Hash_New(64);
+    }
+}
+
+// Stats path and returns a referenced listing if the cached one is still
+// current. On a miss st holds the directory's attributes (st_ino == 0 if
+// it could not be stat'ed) for a following DirCache_Begin().
+dir_listing_t *DirCache_Get(const char *key, const char *path, struct stat *st) {
+    dir_listing_t *dl = NULL;
+    khiter_t k;
+
+    memset(st, 0, sizeof(struct stat));
+    if (dc_enabled == 0) {
+        return NULL;
+    }
+    if (stat(path, st) == -1) {
+        st->st_ino = 0;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&dcmutex);
+    k = kh_get(text, dc_dirs, key);
+    if (k != kh_end(dc_dirs)) {
+        dl = kh_value(dc_dirs, k);
+        if (dl->dev == st->st_dev && dl->ino == st->st_ino &&
+            dl->mtime.tv_sec == st->st_mtim.tv_sec && dl->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+            dl->ctime.tv_sec == st->st_ctim.tv_sec && dl->ctime.tv_nsec == st->st_ctim.tv_nsec) {
+            dl->refs++;
+        }
+        else {
+            drop_listing(k);
+            dl = NULL;
+        }
+    }
+    pthread_mutex_unlock(&dcmutex);
+    return dl;
+}
+
+void DirCache_Release(dir_listing_t *dl) {
+    pthread_mutex_lock(&dcmutex);
+    unref_listing(dl);
+    pthread_mutex_unlock(&dcmutex);
+}
+
+dir_builder_t *DirCache_Begin(const char *key, const struct stat *st) {
+    dir_builder_t *b;
+
+    if (dc_enabled == 0 || st->st_ino == 0) {
+        return NULL;
+    }
+    // Racy directory: a change within the same timestamp tick would go
+    // unnoticed, so only cache directories that have been quiet a while.
+    if (st->st_ctim.tv_sec >= time(NULL) - 1) {
+        return NULL;
+    }
+    b = calloc(1, sizeof(dir_builder_t));
+    b->key = strdup(key);
+    b->st = *st;
+    return b;
+}
+
+void DirCache_Add(dir_builder_t *b, uint64_t ino, unsigned char type, const char *name) {
+    size_t len = strlen(name) + 1;
+
+    if (b == NULL) {
+        return;
+    }
+    if (b->count == b->cap) {
+        b->cap = b->cap ? b->cap*2 : 64;
+        b->inos = realloc(b->inos, b->cap*sizeof(uint64_t));
+        b->name_off = realloc(b->name_off, b->cap*sizeof(uint32_t));
+        b->types = realloc(b->types, b->cap);
+    }
+    if (b->names_len + len > b->names_cap) {
+        while (b->names_len + len > b->names_cap) {
+            b->names_cap = b->names_cap ? b->names_cap*2 : 1024;
+        }
+        b->names = realloc(b->names, b->names_cap);
+    }
+    b->inos[b->count] = ino;
+    b->types[b->count] = type;
+    b->name_off[b->count] = (uint32_t)b->names_len;
+    memcpy(b->names + b->names_len, name, len);
+    b->names_len += len;
+    b->count++;
+}
+
+static void free_builder(dir_builder_t *b) {
+    free(b->key);
+    free(b->inos);
+    free(b->name_off);
+    free(b->types);
+    free(b->names);
+    free(b);
+}
+
+// Packs the builder into a single allocation and publishes it
+void DirCache_Commit(dir_builder_t *b) {
+    dir_listing_t *dl;
+    size_t bytes;
+    char *p;
+    khiter_t k;
+    int ret;
+
+    if (b == NULL) {
+        return;
+    }
+    bytes = sizeof(dir_listing_t) + b->count*(sizeof(uint64_t) + sizeof(uint32_t) + 1) + b->names_len;
+    if (bytes > dc_max_bytes) {
+        free_builder(b);
+        return;
+    }
+
+    dl = malloc(bytes);
+    dl->refs = 1;
+    dl->dev = b->st.st_dev;
+    dl->ino = b->st.st_ino;
+    dl->mtime = b->st.st_mtim;
+    dl->ctime = b->st.st_ctim;
+    dl->count = b->count;
+    dl->bytes = bytes;
+    p = (char *)(dl + 1);
+    dl->inos = (uint64_t *)p;
+    p += b->count*sizeof(uint64_t);
+    dl->name_off = (uint32_t *)p;
+    p += b->count*sizeof(uint32_t);
+    dl->types = (unsigned char *)p;
+    p += b->count;
+    dl->names = p;
+    memcpy(dl->inos, b->inos, b->count*sizeof(uint64_t));
+    memcpy(dl->name_off, b->name_off, b->count*sizeof(uint32_t));
+    memcpy(dl->types, b->types, b->count);
+    memcpy(dl->names, b->names, b->names_len);
+
+    pthread_mutex_lock(&dcmutex);
+    k = kh_get(text, dc_dirs, b->key);
+    if (k != kh_end(dc_dirs)) {
+        drop_listing(k);
+    }
+    if (dc_bytes + bytes > dc_max_bytes) {
+        drop_all_listings();
+    }
+    k = kh_put(text, dc_dirs, b->key, &ret);
+    kh_value(dc_dirs, k) = dl;
+    dc_bytes += bytes;
+    b->key = NULL;                     // now owned by dc_dirs
+    pthread_mutex_unlock(&dcmutex);
+    free_builder(b);
+}
+
+void DirCache_Abort(dir_builder_t *b) {
+    if (b != NULL) {
+        free_builder(b);
+    }
+}
+
+// Called when path was created, removed or renamed via the mount
+void DirCache_Invalidate(const char *path) {
+    char parent[PATH_MAX];
+    khiter_t k;
+
+    if (dc_enabled == 0) {
+        return;
+    }
+    pthread_mutex_lock(&dcmutex);
+    if (split_path(path, parent, sizeof(parent)) != NULL &&
+        (k = kh_get(text, dc_dirs, parent)) != kh_end(dc_dirs)) {
+        drop_listing(k);
+    }
+    if ((k = kh_get(text, dc_dirs, path)) != kh_end(dc_dirs)) {
+        drop_listing(k);
+    }
+    pthread_mutex_unlock(&dcmutex);
+}
+
+void DirCache_Free(void) {
+    if (dc_dirs != NULL) {
+        drop_all_listings();
+        Hash_Free(dc_dirs);
+        dc_dirs = NULL;
+    }
+}
+
+size_t DirCache_Bytes(void) {
+    size_t bytes;
+
+    if (dc_dirs == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&dcmutex);
+    bytes = Hash_Bytes(dc_dirs) + dc_bytes;
+    pthread_mutex_unlock(&dcmutex);
+    return bytes;
+}
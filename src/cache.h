@@ -0,0 +1,57 @@
+#ifndef cache_h
+#define cache_h
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Negative lookup cache: remembers ENOENT results per parent directory.
+// Entries are keyed by the parent path and validated against the parent's
+// dev/ino/mtime at most once per ttl; any create/rename/link/symlink made
+// through the mount invalidates the affected names.
+void     NegCache_Init(int enabled, int ttl_ms, int max_names);
+int      NegCache_Lookup(const char *path, unsigned *gen);
+void     NegCache_Insert(const char *path, unsigned gen);
+void     NegCache_Invalidate(const char *path);
+void     NegCache_InvalidateAll(void);
+void     NegCache_Free(void);
+size_t   NegCache_Bytes(void);
+
+// Directory listing cache: packed name/ino/type columns of a directory,
+// served as long as the directory's dev/ino/mtime/ctime are unchanged.
+typedef struct dir_listing {
+    int             refs;
+    dev_t           dev;
+    ino_t           ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    int             count;
+    size_t          bytes;
+    uint64_t       *inos;
+    uint32_t       *name_off;          // offsets into names
+    unsigned char  *types;             // d_type values
+    char           *names;             // NUL-separated entry names
+} dir_listing_t;
+
+typedef struct dir_builder dir_builder_t;
+
+void           DirCache_Init(int enabled, int max_mb);
+dir_listing_t *DirCache_Get(const char *key, const char *path, struct stat *st);
+void           DirCache_Release(dir_listing_t *dl);
+dir_builder_t *DirCache_Begin(const char *key, const struct stat *st);
+void           DirCache_Add(dir_builder_t *b, uint64_t ino, unsigned char type, const char *name);
+void           DirCache_Commit(dir_builder_t *b);
+void           DirCache_Abort(dir_builder_t *b);
+void           DirCache_Invalidate(const char *path);
+void           DirCache_Free(void);
+size_t         DirCache_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
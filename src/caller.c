@@ -0,0 +1,231 @@
+#include <string.h>
+#include <pwd.h>
+#include <grp.h>
+#include "utils.h"
+#include "proc.h"
+#include "caller.h"
+
+#define CALLER_MAX_DEPTH  64           // ancestors checked for a pid tree
+
+typedef struct caller_list {
+    int       n;
+    uint32_t *ids;                     // uids, gids, pids
+    char    **names;                   // commands, cgroups
+} caller_list_t;
+
+struct caller_filter {
+    caller_list_t       list[CALLER_KINDS][2];     // [kind][exclude]
+    int                 proc_rules;                // any command, pid or cgroup list
+    uint64_t            ttl_ns;
+    uint64_t            gen;                       // tags its verdicts in the /proc cache
+    size_t              bytes;                     // rules
+};
+
+static uint64_t caller_gen = 0;
+
+caller_filter_t *Caller_New(int ttl_ms) {
+    caller_filter_t *cf = calloc(1, sizeof(caller_filter_t));
+
+    cf->ttl_ns = ttl_ms > 0 ? (uint64_t)ttl_ms*1000000ULL : 0;
+    cf->gen = __atomic_add_fetch(&caller_gen, 1, __ATOMIC_RELAXED);
+    cf->bytes = malloc_usable_size(cf);
+    return cf;
+}
+
+static int parse_id(int kind, const char *value, uint32_t *id) {
+    char *end;
+    unsigned long v = strtoul(value, &end, 10);
+
+    if (*value != '\0' && *end == '\0') {
+        *id = (uint32_t)v;
+        return 0;
+    }
+    if (kind == CALLER_UID) {
+        struct passwd *pw = getpwnam(value);
+        if (pw != NULL) {
+            *id = pw->pw_uid;
+            return 0;
+        }
+    }
+    else if (kind == CALLER_GID) {
+        struct group *gr = getgrnam(value);
+        if (gr != NULL) {
+            *id = gr->gr_gid;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int Caller_Add(caller_filter_t *cf, int kind, int exclude, const char *value) {
+    caller_list_t *l;
+    uint32_t id = 0;
+
+    if (kind < 0 || kind >= CALLER_KINDS) {
+        return -1;
+    }
+    l = &cf->list[kind][exclude ? 1 : 0];
+    if (kind == CALLER_COMMAND || kind == CALLER_CGROUP) {
+        cf->bytes -= l->names != NULL ? malloc_usable_size(l->names) : 0;
+        l->names = realloc(l->names, (l->n + 1)*sizeof(char *));
+        l->names[l->n] = strdup(value);
+        cf->bytes += malloc_usable_size(l->names) + malloc_usable_size(l->names[l->n]);
+    }
+    else {
+        if (parse_id(kind, value, &id) != 0) {
+            return -1;
+        }
+        cf->bytes -= l->ids != NULL ? malloc_usable_size(l->ids) : 0;
+        l->ids = realloc(l->ids, (l->n + 1)*sizeof(uint32_t));
+        l->ids[l->n] = id;
+        cf->bytes += malloc_usable_size(l->ids);
+    }
+    l->n++;
+    if (kind != CALLER_UID && kind != CALLER_GID) {
+        cf->proc_rules = 1;
+    }
+    return 0;
+}
+
+static int has_id(const caller_list_t *l, uint32_t id) {
+    for (int i = 0; i < l->n; i++) {
+        if (l->ids[i] == id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Passes the include and exclude list of kind
+static int id_allowed(const caller_filter_t *cf, int kind, uint32_t id) {
+    const caller_list_t *inc = &cf->list[kind][0], *exc = &cf->list[kind][1];
+    return (inc->n == 0 || has_id(inc, id)) && !has_id(exc, id);
+}
+
+static int has_name(const caller_list_t *l, const char *name) {
+    for (int i = 0; i < l->n; i++) {
+        if (strcmp(l->names[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int has_cgroup(const caller_list_t *l, const char *cgroups) {
+    for (int i = 0; i < l->n; i++) {
+        if (Proc_Cgroup_Match(cgroups, l->names[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Command, pid tree and cgroup rules, from /proc
+static uint64_t judge(pid_t pid, const proc_info_t *self, void *ctx) {
+    const caller_filter_t *cf = ctx;
+    const caller_list_t *l;
+    proc_info_t pi;
+    char cgroups[4096];
+
+    if (self == NULL) {
+        // gone: recorded unless only listed callers are
+        for (int kind = CALLER_COMMAND; kind < CALLER_KINDS; kind++) {
+            if (cf->list[kind][0].n > 0) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    pi = *self;
+    if (pi.tgid != pid) {
+        Proc_Status(pi.tgid, &pi);     // the process's name, not the thread's
+    }
+
+    l = cf->list[CALLER_COMMAND];
+    if ((l[0].n > 0 && !has_name(&l[0], pi.name)) || has_name(&l[1], pi.name)) {
+        return 0;
+    }
+
+    l = cf->list[CALLER_PID];
+    if (l[0].n > 0 || l[1].n > 0) {
+        int inside = 0;
+        pid_t p = pi.tgid;
+        proc_info_t anc = pi;
+        for (int d = 0; d < CALLER_MAX_DEPTH && p > 0; d++) {
+            if (has_id(&l[1], p)) {
+                return 0;
+            }
+            inside |= has_id(&l[0], p);
+            if (p == 1 || (d > 0 && Proc_Status(p, &anc) != 0)) {
+                break;
+            }
+            p = anc.ppid;
+        }
+        if (l[0].n > 0 && !inside) {
+            return 0;
+        }
+    }
+
+    l = cf->list[CALLER_CGROUP];
+    if (l[0].n > 0 || l[1].n > 0) {
+        if (Proc_Cgroups(pi.tgid, cgroups, sizeof(cgroups)) != 0) {
+            return l[0].n == 0;
+        }
+        if ((l[0].n > 0 && !has_cgroup(&l[0], cgroups)) || has_cgroup(&l[1], cgroups)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int Caller_Ids_Allowed(caller_filter_t *cf, uid_t uid, gid_t gid) {
+    return id_allowed(cf, CALLER_UID, uid) && id_allowed(cf, CALLER_GID, gid);
+}
+
+int Caller_Query(caller_filter_t *cf, proc_query_t *q) {
+    if (!cf->proc_rules) {
+        return 0;
+    }
+    q->slot = PROC_SLOT_CALLER;
+    q->ttl_ns = cf->ttl_ns;
+    q->tag = cf->gen;
+    q->stable = 0;                     // cgroups change without an exec()
+    q->derive = judge;
+    q->ctx = cf;
+    q->value = 1;
+    return 1;
+}
+
+int Caller_Allowed(caller_filter_t *cf, pid_t pid, uid_t uid, gid_t gid) {
+    proc_query_t q;
+
+    if (!Caller_Ids_Allowed(cf, uid, gid)) {
+        return 0;
+    }
+    if (!Caller_Query(cf, &q)) {
+        return 1;
+    }
+    Proc_Query(pid, &q, 1);
+    return (int)q.value;
+}
+
+void Caller_Free(caller_filter_t *cf) {
+    if (cf == NULL) {
+        return;
+    }
+    for (int kind = 0; kind < CALLER_KINDS; kind++) {
+        for (int x = 0; x < 2; x++) {
+            caller_list_t *l = &cf->list[kind][x];
+            for (int i = 0; l->names != NULL && i < l->n; i++) {
+                free(l->names[i]);
+            }
+            free(l->names);
+            free(l->ids);
+        }
+    }
+    free(cf);
+}
+
+size_t Caller_Bytes(caller_filter_t *cf) {
+    return cf != NULL ? cf->bytes : 0;
+}
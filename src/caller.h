@@ -0,0 +1,45 @@
+#ifndef caller_h
+#define caller_h
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Caller filters: whose accesses are recorded, by uid, gid, command name,
+// process tree or cgroup. Each kind has an include list, which the caller
+// must match when it is not empty, and an exclude list, which it must not
+// match. uid and gid come with every request; the other kinds need /proc,
+// so the verdict is kept in the shared /proc cache (proc.h) and worked out
+// again after the ttl.
+
+#define CALLER_UID      0
+#define CALLER_GID      1
+#define CALLER_COMMAND  2              // process name
+#define CALLER_PID      3              // the process and its descendants
+#define CALLER_CGROUP   4              // cgroup path prefix, "/system.slice"
+#define CALLER_KINDS    5
+
+typedef struct caller_filter caller_filter_t;
+
+caller_filter_t *Caller_New(int ttl_ms);
+// User and group names are looked up; -1 if the value is not valid for kind
+int    Caller_Add(caller_filter_t *cf, int kind, int exclude, const char *value);
+// True when accesses of the caller are recorded
+int    Caller_Allowed(caller_filter_t *cf, pid_t pid, uid_t uid, gid_t gid);
+// The same in two steps, so the /proc lookup can be shared: the uid and
+// gid rules, then, when it returns 1, q set up for Proc_Query() and the
+// verdict in q->value
+int    Caller_Ids_Allowed(caller_filter_t *cf, uid_t uid, gid_t gid);
+int    Caller_Query(caller_filter_t *cf, proc_query_t *q);
+void   Caller_Free(caller_filter_t *cf);
+size_t Caller_Bytes(caller_filter_t *cf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
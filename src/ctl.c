@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "ctl.h"
+
+#define CTL_QUERY  CTL_DIR "/query"
+
+enum { CTL_NONE, CTL_ROOT, CTL_STATS, CTL_CTL, CTL_QUERY_DIR, CTL_QUERY_FILE };
+
+typedef struct ctl_file {
+    int        kind;
+    ctl_buf_t  data;                   // what read() returns
+    ctl_buf_t  in;                     // partial command line
+} ctl_file_t;
+
+int ctl_enabled = 0;
+static ctl_ops_t ctl_ops;
+static time_t ctl_start;
+
+void Ctl_Append(ctl_buf_t *b, const char *data, size_t len) {
+    if (b->len + len + 1 > b->cap) {
+        b->cap = (b->len + len + 1)*2;
+        if (b->cap < 4096) {
+            b->cap = 4096;
+        }
+        b->data = realloc(b->data, b->cap);
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+void Ctl_Printf(ctl_buf_t *b, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return;
+    }
+    if (b->len + len + 1 > b->cap) {
+        b->cap = (b->len + len + 1)*2;
+        b->data = realloc(b->data, b->cap);
+    }
+    va_start(ap, fmt);
+    vsnprintf(b->data + b->len, len + 1, fmt, ap);
+    va_end(ap);
+    b->len += len;
+}
+
+void Ctl_Init(int enabled, const ctl_ops_t *ops) {
+    ctl_enabled = enabled;
+    ctl_ops = *ops;
+    ctl_start = time(NULL);
+}
+
+static int classify(const char *path) {
+    const char *rest = path + sizeof(CTL_DIR) - 1;
+    size_t len;
+
+    if (*rest == '\0') {
+        return CTL_ROOT;
+    }
+    if (strcmp(rest, "/stats") == 0) {
+        return CTL_STATS;
+    }
+    if (strcmp(rest, "/ctl") == 0) {
+        return CTL_CTL;
+    }
+    if (strncmp(rest, "/query", 6) != 0 || (rest[6] != '\0' && rest[6] != '/')) {
+        return CTL_NONE;
+    }
+    len = strlen(rest);
+    if (len >= sizeof(CTL_ENTRIES) && strcmp(rest + len - (sizeof(CTL_ENTRIES) - 1), CTL_ENTRIES) == 0 &&
+        rest[len - sizeof(CTL_ENTRIES)] == '/') {
+        return CTL_QUERY_FILE;
+    }
+    return CTL_QUERY_DIR;
+}
+
+int Ctl_Getattr(const char *path, struct stat *st) {
+    int kind = classify(path);
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_atime = st->st_mtime = st->st_ctime = ctl_start;
+    switch (kind) {
+    case CTL_ROOT:
+    case CTL_QUERY_DIR:
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+        return 0;
+    case CTL_STATS:
+    case CTL_QUERY_FILE:
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+        return 0;
+    case CTL_CTL:
+        st->st_mode = S_IFREG | 0644;
+        st->st_nlink = 1;
+        return 0;
+    default:
+        return -ENOENT;
+    }
+}
+
+int Ctl_Access(const char *path, int mask) {
+    int kind = classify(path);
+
+    if (kind == CTL_NONE) {
+        return -ENOENT;
+    }
+    if ((mask & W_OK) && kind != CTL_CTL) {
+        return -EACCES;
+    }
+    return 0;
+}
+
+int Ctl_Readdir(const char *path, void *buf, fuse_fill_dir_t filler) {
+    int kind = classify(path);
+
+    if (kind != CTL_ROOT && kind != CTL_QUERY_DIR) {
+        return kind == CTL_NONE ? -ENOENT : -ENOTDIR;
+    }
+    filler(buf, ".", NULL, 0);
+    filler(buf, "..", NULL, 0);
+    if (kind == CTL_ROOT) {
+        filler(buf, "stats", NULL, 0);
+        filler(buf, "ctl", NULL, 0);
+        filler(buf, "query", NULL, 0);
+    }
+    else {
+        filler(buf, CTL_ENTRIES, NULL, 0);
+    }
+    return 0;
+}
+
+int Ctl_Open(const char *path, struct fuse_file_info *fi) {
+    int kind = classify(path);
+    int wr = (fi->flags & O_ACCMODE) != O_RDONLY;
+    ctl_file_t *f;
+
+    switch (kind) {
+    case CTL_NONE:
+        return -ENOENT;
+    case CTL_ROOT:
+    case CTL_QUERY_DIR:
+        return -EISDIR;
+    case CTL_STATS:
+    case CTL_QUERY_FILE:
+        if (wr) {
+            return -EACCES;
+        }
+        break;
+    }
+
+    f = calloc(1, sizeof(ctl_file_t));
+    f->kind = kind;
+    if (kind == CTL_STATS) {
+        ctl_ops.stats(&f->data);
+    }
+    else if (kind == CTL_QUERY_FILE) {
+        // "/.distiller/query/usr/lib/.entries" -> "/usr/lib"
+        const char *start = path + sizeof(CTL_QUERY) - 1;
+        size_t len = strlen(start) - sizeof(CTL_ENTRIES);
+        char *prefix = strndup(start, len);
+        ctl_ops.query(len == 0 ? "/" : prefix, &f->data);
+        free(prefix);
+    }
+    else if (!wr) {
+        ctl_ops.command("help", &f->data);
+    }
+    // Content is generated per open, so the size in getattr means nothing
+    fi->direct_io = 1;
+    fi->fh = (uint64_t)(uintptr_t)f;
+    return 0;
+}
+
+int Ctl_Read(char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    ctl_file_t *f = (ctl_file_t *)(uintptr_t)fi->fh;
+
+    if (offset >= (off_t)f->data.len) {
+        return 0;
+    }
+    if (size > f->data.len - offset) {
+        size = f->data.len - offset;
+    }
+    memcpy(buf, f->data.data + offset, size);
+    return size;
+}
+
+static int run_line(ctl_file_t *f, char *line) {
+    char *end;
+
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    end = line + strlen(line);
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+        *--end = '\0';
+    }
+    if (*line == '\0') {
+        return 0;
+    }
+    return ctl_ops.command(line, &f->data);
+}
+
+// Runs every complete line; the first failing command fails the write
+int Ctl_Write(const char *buf, size_t size, struct fuse_file_info *fi) {
+    ctl_file_t *f = (ctl_file_t *)(uintptr_t)fi->fh;
+    char *line, *nl;
+    int rc = 0;
+
+    if (f->kind != CTL_CTL) {
+        return -EACCES;
+    }
+    Ctl_Append(&f->in, buf, size);
+    line = f->in.data;
+    while ((nl = memchr(line, '\n', f->in.len - (line - f->in.data))) != NULL) {
+        *nl = '\0';
+        if (rc == 0) {
+            rc = run_line(f, line);
+        }
+        line = nl + 1;
+    }
+    f->in.len -= line - f->in.data;
+    memmove(f->in.data, line, f->in.len + 1);
+    return rc != 0 ? rc : (int)size;
+}
+
+int Ctl_Truncate(const char *path) {
+    int kind = classify(path);
+
+    if (kind == CTL_CTL) {
+        return 0;
+    }
+    return kind == CTL_NONE ? -ENOENT : -EACCES;
+}
+
+int Ctl_Release(struct fuse_file_info *fi) {
+    ctl_file_t *f = (ctl_file_t *)(uintptr_t)fi->fh;
+
+    // "printf reset > ctl" has no trailing newline
+    if (f->in.len > 0) {
+        run_line(f, f->in.data);
+    }
+    free(f->data.data);
+    free(f->in.data);
+    free(f);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef ctl_h
+#define ctl_h
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Control interface: a hidden directory served by the daemon itself.
+//
+//   /.distiller/stats                 live counters (read)
+//   /.distiller/ctl                   commands, one per line (write);
+//                                     reading it lists the commands
+//   /.distiller/query/<prefix>/.entries
+//                                     recorded entries under <prefix>
+//
+// Lookups resolve one component at a time, so a prefix can't name a
+// file itself: every path below query/ is a directory and the entries
+// are read from its ".entries" file.
+// Nothing below CTL_DIR reaches the backing tree or the recording table.
+
+#define CTL_DIR      "/.distiller"
+#define CTL_ENTRIES  ".entries"
+
+typedef struct ctl_buf {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+} ctl_buf_t;
+
+void Ctl_Append(ctl_buf_t *b, const char *data, size_t len);
+void Ctl_Printf(ctl_buf_t *b, const char *fmt, ...)
+         __attribute__((format(printf, 2, 3)));
+
+// Content providers, implemented by the daemon. command() returns 0 or
+// -errno and may leave a reply in out.
+typedef struct ctl_ops {
+    void (*stats)(ctl_buf_t *out);
+    void (*query)(const char *prefix, ctl_buf_t *out);
+    int  (*command)(const char *cmd, ctl_buf_t *out);
+} ctl_ops_t;
+
+extern int ctl_enabled;
+
+void Ctl_Init(int enabled, const ctl_ops_t *ops);
+
+static inline int Ctl_Is_Path(const char *path) {
+    return ctl_enabled && path[1] == '.' &&
+           strncmp(path, CTL_DIR, sizeof(CTL_DIR) - 1) == 0 &&
+           (path[sizeof(CTL_DIR) - 1] == '\0' || path[sizeof(CTL_DIR) - 1] == '/');
+}
+
+int  Ctl_Getattr(const char *path, struct stat *st);
+int  Ctl_Access(const char *path, int mask);
+int  Ctl_Readdir(const char *path, void *buf, fuse_fill_dir_t filler);
+int  Ctl_Open(const char *path, struct fuse_file_info *fi);
+int  Ctl_Read(char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+int  Ctl_Write(const char *buf, size_t size, struct fuse_file_info *fi);
+int  Ctl_Truncate(const char *path);
+int  Ctl_Release(struct fuse_file_info *fi);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+// distillerfs-stat - live statistics of a running DistillerFS mount, read
+// from the shared memory segment enabled by [shm] in the configuration.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+#include "shmstat.h"
+
+typedef struct op_row {
+    int    op;
+    double ok_rate;
+    double fail_rate;
+} op_row_t;
+
+static int cmp_row(const void *a, const void *b) {
+    const op_row_t *x = a, *y = b;
+    double rx = x->ok_rate + x->fail_rate, ry = y->ok_rate + y->fail_rate;
+    if (rx != ry) {
+        return rx < ry ? 1 : -1;
+    }
+    return x->op - y->op;
+}
+
+static void print_bytes(const char *name, uint64_t bytes) {
+    if (bytes >= 10*1048576ULL) {
+        printf(" %s %.0fM", name, bytes/1048576.0);
+    }
+    else {
+        printf(" %s %.0fK", name, bytes/1024.0);
+    }
+}
+
+// One screen; prev is the previous sample (NULL on the first one)
+static void show(const shmstat_t *cur, const shmstat_t *prev, int clear) {
+    op_row_t rows[SHMSTAT_OPS];
+    double uptime = (cur->update_realtime_ns - cur->start_realtime_ns)/1e9;
+    double dt = prev != NULL ? (cur->update_realtime_ns - prev->update_realtime_ns)/1e9 : uptime;
+    uint64_t mem_total = 0;
+    int n = 0;
+
+    if (clear) {
+        printf("\033[H\033[2J");
+    }
+    printf("distillerfs %s  pid %d  up %.0fs  %s\n", cur->mount, cur->pid, uptime,
+           cur->recording ? "recording" : "paused");
+    printf("entries %" PRIu64 "  paths seen %" PRIu64 "  buckets %" PRIu64 " (load %.2f, %" PRIu64 " resizes)\n",
+           cur->entries, cur->paths_seen, cur->hash_buckets,
+           cur->hash_buckets ? (double)cur->entries/cur->hash_buckets : 0.0, cur->hash_resizes);
+    printf("lock %" PRIu64 " acquired, %" PRIu64 " contended (%.2f%%), %.1f ms waited\n",
+           cur->lock_acquired, cur->lock_contended,
+           cur->lock_acquired ? 100.0*cur->lock_contended/cur->lock_acquired : 0.0, cur->lock_wait_ns/1e6);
+    printf("mem");
+    for (uint32_t i = 0; i < cur->n_mem && i < SHMSTAT_MEM; i++) {
+        print_bytes(cur->mem_names[i], cur->mem[i]);
+        mem_total += cur->mem[i];
+    }
+    print_bytes("total", mem_total);
+    if (cur->mem_limit > 0) {
+        print_bytes("limit", cur->mem_limit);
+    }
+    printf("\n\n");
+
+    if (dt <= 0) {
+        dt = 1;
+    }
+    for (uint32_t i = 0; i < cur->qn_ops && i < SHMSTAT_OPS; i++) {
+        uint64_t ok = cur->ok[i] - (prev != NULL ? prev->ok[i] : 0);
+        uint64_t fail = cur->fail[i] - (prev != NULL ? prev->fail[i] : 0);
+        if (cur->ok[i] + cur->fail[i] == 0) {
+            continue;
+        }
+        rows[n].op = i;
+        rows[n].ok_rate = ok/dt;
+        rows[n].fail_rate = fail/dt;
+        n++;
+    }
+    qsort(rows, n, sizeof(op_row_t), cmp_row);
+
+    printf("%-11s %10s %10s %12s %10s", "OP", "OK/s", "FAIL/s", "OK", "FAIL");
+    if (cur->latency) {
+        printf(" %9s %9s %9s %9s", "p50us", "p99us", "p999us", "MAXus");
+    }
+    printf("\n");
+    for (int r = 0; r < n; r++) {
+        int i = rows[r].op;
+        printf("%-11.11s %10.1f %10.1f %12" PRIu64 " %10" PRIu64, cur->op_names[i],
+               rows[r].ok_rate, rows[r].fail_rate, cur->ok[i], cur->fail[i]);
+        if (cur->latency) {
+            const shmstat_lat_t *lat = &cur->lat[i][0];
+            printf(" %9.1f %9.1f %9.1f %9.1f", lat->p50/1e3, lat->p99/1e3, lat->p999/1e3, lat->max/1e3);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-1] [-d seconds] <mount-point> | -n <shm-name>\n", name);
+    fprintf(stderr, "  -1          print one sample and exit\n");
+    fprintf(stderr, "  -d seconds  refresh interval (default 1)\n");
+    fprintf(stderr, "  -n name     segment name, e.g. /distillerfs_mnt_data\n");
+}
+
+int main(int argc, char *argv[]) {
+    const shmstat_t *seg;
+    shmstat_t cur, prev;
+    char name[NAME_MAX];
+    const char *shm = NULL;
+    double delay = 1.0;
+    int once = 0, have_prev = 0, opt, rc;
+
+    while ((opt = getopt(argc, argv, "1d:n:h")) != -1) {
+        switch (opt) {
+        case '1': once = 1; break;
+        case 'd': delay = atof(optarg); break;
+        case 'n': shm = optarg; break;
+        default:  usage(argv[0]); return 1;
+        }
+    }
+    if (shm == NULL) {
+        char mount[PATH_MAX];
+        if (optind >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        // The daemon names the segment after its absolute mount point
+        if (realpath(argv[optind], mount) == NULL) {
+            snprintf(mount, sizeof(mount), "%s", argv[optind]);
+        }
+        Shmstat_Name(mount, name, sizeof(name));
+        shm = name;
+    }
+    if (delay < 0.1) {
+        delay = 0.1;
+    }
+
+    rc = Shmstat_Map(shm, &seg);
+    if (rc != 0) {
+        fprintf(stderr, "Can't open %s: %s\n", shm,
+                rc == -EINVAL ? "not a DistillerFS statistics segment of this version" : strerror(-rc));
+        if (rc == -ENOENT) {
+            fprintf(stderr, "Is the mount running with [shm] enabled = true?\n");
+        }
+        return 2;
+    }
+
+    for (;;) {
+        struct timespec ts;
+
+        if (Shmstat_Read(seg, &cur) != 0) {
+            fprintf(stderr, "Segment stays busy, giving up\n");
+            return 3;
+        }
+        if (!have_prev || cur.update_realtime_ns != prev.update_realtime_ns) {
+            show(&cur, have_prev ? &prev : NULL, !once);
+            prev = cur;
+            have_prev = 1;
+        }
+        if (once) {
+            break;
+        }
+        if (kill(cur.pid, 0) == -1 && errno == ESRCH) {
+            fprintf(stderr, "distillerfs (pid %d) is gone\n", cur.pid);
+            return 0;
+        }
+        ts.tv_sec = (time_t)delay;
+        ts.tv_nsec = (long)((delay - ts.tv_sec)*1e9);
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
@@ -44,70 +44,30 @@
 #include <sys/time.h>
 #include <pwd.h>
 #include <grp.h>
+#include <limits.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <time.h>
+#include <inttypes.h>
 
 #include "utils.h"
 #include "toml.h"
-
-#define QN_FLAGS                26     //  Symbols:   GArdKMSuDNLmoTnsORWteFXxlv
-
-#define LOG_SUCCESS   1
-#define LOG_UNSUCCESS 2
-
-enum FUSE_OPS {
-    OP_GETATTR,
-    OP_ACCESS,
-    OP_READLINK,
-    OP_READDIR,
-    OP_MKNOD,
-    OP_MKDIR,
-    OP_SYMLINK,
-    OP_UNLINK,
-    OP_RMDIR,
-    OP_RENAME,
-    OP_LINK,
-    OP_CHMOD,
-    OP_CHOWN,
-    OP_TRUNCATE,
-    OP_UTIME,
-    OP_UTIMENS,
-    OP_OPEN,
-    OP_READ,
-    OP_WRITE,
-    OP_STATFS,
-    OP_RELEASE,
-    OP_FSYNC,
-    OP_SETXATTR,
-    OP_GETXATTR,
-    OP_LISTXATTR,
-    OP_REMOVEXATTR
-};
-
-#define FLAG_GETATTR        (1<<OP_GETATTR)     //  G
-#define FLAG_ACCESS         (1<<OP_ACCESS)      //  A
-#define FLAG_READLINK       (1<<OP_READLINK)    //  r
-#define FLAG_READDIR        (1<<OP_READDIR)     //  d
-#define FLAG_MKNOD          (1<<OP_MKNOD)       //  K
-#define FLAG_MKDIR          (1<<OP_MKDIR)       //  M
-#define FLAG_SYMLINK        (1<<OP_SYMLINK)     //  S
-#define FLAG_UNLINK         (1<<OP_UNLINK)      //  u
-#define FLAG_RMDIR          (1<<OP_RMDIR)       //  D
-#define FLAG_RENAME         (1<<OP_RENAME)      //  N
-#define FLAG_LINK           (1<<OP_LINK)        //  L
-#define FLAG_CHMOD          (1<<OP_CHMOD)       //  m
-#define FLAG_CHOWN          (1<<OP_CHOWN)       //  o
-#define FLAG_TRUNCATE       (1<<OP_TRUNCATE)    //  T
-#define FLAG_UTIME          (1<<OP_UTIME)       //  n
-#define FLAG_UTIMENS        (1<<OP_UTIMENS)     //  s
-#define FLAG_OPEN           (1<<OP_OPEN)        //  O
-#define FLAG_READ           (1<<OP_READ)        //  R
-#define FLAG_WRITE          (1<<OP_WRITE)       //  W
-#define FLAG_STATFS         (1<<OP_STATFS)      //  t
-#define FLAG_RELEASE        (1<<OP_RELEASE)     //  e
-#define FLAG_FSYNC          (1<<OP_FSYNC)       //  F
-#define FLAG_SETXATTR       (1<<OP_SETXATTR)    //  X
-#define FLAG_GETXATTR       (1<<OP_GETXATTR)    //  x
-#define FLAG_LISTXATTR      (1<<OP_LISTXATTR)   //  l
-#define FLAG_REMOVEXATTR    (1<<OP_REMOVEXATTR) //  v
+#include "cache.h"
+#include "gsync.h"
+#include "journal.h"
+#include "binlog.h"
+#include "dump.h"
+#include "sink.h"
+#include "stats.h"
+#include "ctl.h"
+#include "slowlog.h"
+#include "trace.h"
+#include "shmstat.h"
+#include "extent.h"
+#include "attrib.h"
+#include "caller.h"
+#include "session.h"
+#include "distillerfs.h"
 
 const char *op_names[] = {
     "getattr",   "access",   "readlink", "readdir",
@@ -137,11 +97,58 @@ int op_flags[QN_FLAGS];
 static int savefd;
 static const char *loggerId = "default";
 
-FILE *hash_log;
-static Hash *h;
-static pthread_mutex_t prmutex = PTHREAD_MUTEX_INITIALIZER;
+sink_t *hash_log;
+// Table entry. Each op recorded for the path has a 16-bit counter, one
+// per bit of flags in bit order: up to LFS_INLINE_OPS are kept in the
+// entry, more in an array on the heap. A counter that reaches
+// LFS_OP_SPILL stays there and the op is counted on in op_spill, keyed
+// by path id and op, so the common entry stays 24 bytes. Path ids are
+// handed out in first-access order. Only what is asked for follows the
+// fixed part: access times, first and last, the set of commands that
+// accessed the path, a bit per recording session that did and a bit per
+// phase it was accessed in.
+#define LFS_INLINE_OPS  4
+#define LFS_OP_SPILL    UINT16_MAX
+
+typedef struct lfs_entry {
+    char     *path;
+    uint32_t  flags;
+    uint32_t  id;                      // journal path id
+    union {
+        uint16_t  small[LFS_INLINE_OPS];
+        uint16_t *heap;
+    } ops;
+    uint64_t  extra[];                 // [0] first, [1] last access, ns since mount;
+                                       // then [procs_at], [sessions_at], [phases_at]
+} lfs_entry_t;
+
+KHASH_MAP_INIT_INT64(spill, uint64_t)
 
-const char symbols[26]={'G','A','r','d','K','M','S','u','D','N','L','m','o','T','n','s','O','R','W','t','e','F','X','x','l','v'};
+static Hash *h;
+static khash_t(spill) *op_spill;       // under prmutex
+static stats_mutex_t prmutex = STATS_MUTEX_INITIALIZER;
+static uint64_t hash_resizes = 0;      // under prmutex
+static uint64_t hash_resize_ns = 0;
+static size_t entry_bytes = 0;         // under prmutex, malloc'ed sizes
+static size_t path_bytes = 0;
+// Held shared by everything that uses entries outside prmutex (dumps,
+// queries) and exclusively by reset before it frees them
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+// The one thing handlers look at while recording is off: set by pause,
+// and while phases are on but none is active. See Update_Recording().
+static int recording_paused = 0;
+static int user_paused = 0;            // under gate_lock
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t next_path_id = 0;
+
+static char *snapshot_base = NULL;
+static int snapshot_seq = 0;
+static sem_t service_sem;
+static pthread_t service_thread;
+static int service_running = 0;
+static int service_stop = 0;
+
+const char symbols[QN_FLAGS]=OP_SYMBOLS;
 
 #define MaxFuseArgs 32
 
@@ -149,31 +156,1313 @@ typedef struct LoggedFS_Args {
     char *mountPoint; // where the users read files
     char *configFilename;
     char *logFilename;
+    char *journalFilename;
+    char *binlogFilename;
     int isDaemon; // true == spawn in background, log to syslog except if log file parameter is set
     int logToSyslog;
     const char *fuseArgv[MaxFuseArgs];
     int fuseArgc;
 } LoggedFS_Args;
 
-typedef struct lfs_count {
-    char *path;
-    int   count;
-    int   flags;
-} lfs_count_t;
+typedef struct filter_desc {
+    char **exclude_path;
+    int    exclude_path_count;
+    char **include_path;
+    int    include_path_count;
+    caller_filter_t *callers;          // NULL: every caller is recorded
+    size_t bytes;                      // allocated by parse_filters()
+} filter_desc_t;
+
+static LoggedFS_Args *loggedfsArgs;
+static filter_desc_t *g_filter;
+static int journal_ring_kb = 1024;
+static int dump_threads = 0;           // 0: online CPUs, at most 8
+static int sort_output = -1;           // [output] sort, DUMP_SORT_*; -1: hash order
+static int entry_times = 0;            // first/last access kept per entry
+static int entry_attrib = 0;           // command set kept per entry
+static int extra_words = 0;            // trailing words of an entry, see Entry_Layout()
+static int procs_at = -1;
+static int sessions_at = -1;
+static int sessions_enabled = 0;       // [sessions]
+static int sessions_ttl_ms = 1000;
+static int phases_at = -1;
+static int phases_enabled = 0;         // [phases]
+static char *initial_phase = NULL;
+static char **attrib_roots = NULL;     // [attribution]
+static int attrib_n_roots = 0;
+static int attrib_depth = 4;
+static int attrib_ttl_ms = 10;
+static dump_columns_t *output_columns = NULL;  // [output] columns, NULL: "[mask]:count:path"
+static int compression_level = 0;      // 0: library default
+static int control_enabled = 1;        // [control] enabled
+static int latency_enabled = 1;        // [stats] latency
+static int timing_enabled = 1;         // handlers wrapped: latency, slow log or trace
+static char *slowlog_file = NULL;      // [slowlog]
+static int slowlog_threshold_ms = 1000;
+static int slowlog_max_kb = 10240;
+static int timeline_ms = 0;            // [timeline] interval_ms, 0: off
+static char *timeline_file = NULL;
+static FILE *timeline_fp = NULL;
+static uint64_t timeline_next = 0;     // first bucket not written yet
+static char *trace_file = NULL;        // [trace]
+static int trace_every = 1000;
+static int trace_slow_ms = 0;
+static size_t memory_limit = 0;        // [limits] memory_mb, 0: none
+static int memory_warned = 0;
+static size_t retired_filter_bytes = 0;
+static int shm_enabled = 0;            // [shm]
+static int shm_interval_ms = 1000;
+static char shm_name[NAME_MAX];
+static shmstat_t *shm_stats = NULL;
+static char *prom_file = NULL;         // [prometheus]
+static int prom_interval_ms = 15000;
+static int extents_enabled = 0;        // [extents]
+static int extents_granularity = 4096;
+static struct timespec start_time;
+
+static int is_Absolute_Path(const char *fileName)
+{
+    if (fileName && fileName[0] != '\0' && fileName[0] == '/') {
+        return 1;
+    }
+    else {
+        return 0;
+    }
+}
+
+static int is_excluded(const char *path, char **exc_path, int qn_exc_path) {
+    for (int i=0;i<qn_exc_path;i++) {
+        if (strncmp(path, exc_path[i], strlen(exc_path[i]))==0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_included(const char *path, char **inc_path, int qn_inc_path) {
+    if (qn_inc_path==0) {
+        // Empty include path equal "all included"
+        return 1;
+    }
+    for (int i=0;i<qn_inc_path;i++) {
+        if (strncmp(path, inc_path[i], strlen(inc_path[i]))==0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+enum { MEM_BUCKETS, MEM_ENTRIES, MEM_PATHS, MEM_FILTERS, MEM_CACHES, MEM_JOURNAL, MEM_STATS, MEM_EXTENTS, MEM_KINDS };
+
+static const char *mem_names[MEM_KINDS] = {
+    "buckets", "entries", "paths", "filters", "caches", "journal", "stats", "extents"
+};
+
+// Bytes per category; returns the total
+static size_t Memory_Usage(size_t mem[MEM_KINDS]) {
+
+    filter_desc_t *filter = __atomic_load_n(&g_filter, __ATOMIC_ACQUIRE);
+    size_t total = 0;
+
+    Stats_Lock(&prmutex);
+    mem[MEM_BUCKETS] = Hash_Bytes(h);
+    mem[MEM_ENTRIES] = entry_bytes + HASH_ARRAY_BYTES(op_spill, sizeof(uint64_t)*2);
+    mem[MEM_PATHS] = path_bytes;
+    mem[MEM_CACHES] = Attrib_Bytes();  // its sets change under prmutex
+    Stats_Unlock(&prmutex);
+    mem[MEM_FILTERS] = (filter!=NULL ? filter->bytes + Caller_Bytes(filter->callers) : 0) +
+                       __atomic_load_n(&retired_filter_bytes, __ATOMIC_RELAXED);
+    mem[MEM_CACHES] += NegCache_Bytes() + DirCache_Bytes() + Session_Bytes() + Proc_Bytes();
+    mem[MEM_JOURNAL] = Journal_Bytes() + Slowlog_Bytes() + Trace_Bytes();
+    mem[MEM_STATS] = Stats_Bytes() + (shm_stats!=NULL ? sizeof(shmstat_t) : 0);
+    mem[MEM_EXTENTS] = Extent_Bytes();
+    for (int i=0;i<MEM_KINDS;i++) {
+        total += mem[i];
+    }
+    return total;
+}
+
+// Warns once each time usage crosses [limits] memory_mb
+static void Check_Memory_Limit(void) {
+
+    size_t mem[MEM_KINDS];
+    size_t total = Memory_Usage(mem);
+
+    if (total > memory_limit) {
+        if (!__atomic_exchange_n(&memory_warned, 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "Warning: recording state uses %.1f MB, over the %.1f MB soft limit "
+                    "(buckets %.1f, entries %.1f, paths %.1f MB)\n", total/1048576.0, memory_limit/1048576.0,
+                    mem[MEM_BUCKETS]/1048576.0, mem[MEM_ENTRIES]/1048576.0, mem[MEM_PATHS]/1048576.0);
+        }
+    }
+    else {
+        __atomic_store_n(&memory_warned, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static inline uint16_t *entry_ops(lfs_entry_t *e) {
+    return __builtin_popcount(e->flags) > LFS_INLINE_OPS ? e->ops.heap : e->ops.small;
+}
+
+// Heap arrays grow 4 counters at a time
+static inline int heap_ops_cap(int n) {
+    return (n + 3) & ~3;
+}
+
+static inline uint64_t spill_key(const lfs_entry_t *e, int op) {
+    return (uint64_t)e->id << 5 | op;
+}
+
+// Value of counter idx (of op); under prmutex
+static uint64_t entry_op_count(const lfs_entry_t *e, int op, int idx) {
+    const uint16_t *ops = entry_ops((lfs_entry_t *)e);
+    khint_t k;
+
+    if (ops[idx] != LFS_OP_SPILL) {
+        return ops[idx];
+    }
+    k = kh_get(spill, op_spill, spill_key(e, op));
+    return k != kh_end(op_spill) ? kh_value(op_spill, k) : LFS_OP_SPILL;
+}
+
+static void entry_op_bump(lfs_entry_t *e, int op, int idx) {
+    uint16_t *ops = entry_ops(e);
+    khint_t k;
+    int absent;
+
+    if (ops[idx] < LFS_OP_SPILL - 1) {
+        ops[idx]++;
+        return;
+    }
+    k = kh_put(spill, op_spill, spill_key(e, op), &absent);
+    if (absent) {
+        ops[idx] = LFS_OP_SPILL;
+        kh_value(op_spill, k) = LFS_OP_SPILL;
+    }
+    else {
+        kh_value(op_spill, k)++;
+    }
+}
+
+// Adds a counter of 1 for a new op at position idx
+static void entry_op_insert(lfs_entry_t *e, int idx) {
+    int n = __builtin_popcount(e->flags);
+    uint16_t *ops;
+
+    if (n < LFS_INLINE_OPS) {
+        ops = e->ops.small;
+    }
+    else if (n == LFS_INLINE_OPS) {
+        ops = malloc(heap_ops_cap(n + 1)*sizeof(uint16_t));
+        memcpy(ops, e->ops.small, n*sizeof(uint16_t));
+        e->ops.heap = ops;
+        entry_bytes += malloc_usable_size(ops);
+    }
+    else {
+        ops = e->ops.heap;
+        if (n == heap_ops_cap(n)) {
+            entry_bytes -= malloc_usable_size(ops);
+            ops = realloc(ops, heap_ops_cap(n + 1)*sizeof(uint16_t));
+            e->ops.heap = ops;
+            entry_bytes += malloc_usable_size(ops);
+        }
+    }
+    memmove(ops + idx + 1, ops + idx, (n - idx)*sizeof(uint16_t));
+    ops[idx] = 1;
+}
+
+// Once the configuration is read, before the first entry
+static void Entry_Layout(void) {
+    extra_words = entry_times ? 2 : 0;
+    if (entry_attrib) {
+        procs_at = extra_words++;
+    }
+    if (sessions_enabled) {
+        sessions_at = extra_words++;
+    }
+    if (phases_enabled) {
+        phases_at = extra_words++;
+    }
+}
+
+// Recording is off while paused, or while phases are on and none is
+// active, so handlers never get past the load of recording_paused
+static void Update_Recording(void) {
+    pthread_mutex_lock(&gate_lock);
+    __atomic_store_n(&recording_paused, user_paused || (phases_enabled && Phase_Active()==0),
+                     __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&gate_lock);
+}
+
+static void entry_free(lfs_entry_t *e) {
+    if (__builtin_popcount(e->flags) > LFS_INLINE_OPS) {
+        free(e->ops.heap);
+    }
+    free(e->path);
+    free(e);
+}
+
+// Access times only need to order a build's phases; the coarse clock is
+// a plain vDSO read
+static inline uint64_t access_time(void) {
+    struct timespec ts;
+    int64_t ns;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    // it may lag start_time, which is read from the precise clock
+    ns = (int64_t)(ts.tv_sec - start_time.tv_sec)*1000000000LL + ts.tv_nsec - start_time.tv_nsec;
+    return ns > 0 ? (uint64_t)ns : 0;
+}
+
+static int Record_Path(Hash *log_hash, filter_desc_t *filter, const char *path, int flag, int state) {
+
+    lfs_entry_t *item;
+    proc_query_t q[PROC_SLOTS];
+    int nq = 0, q_caller = -1, q_cmd = -1, q_sessions = -1;
+    uint32_t id, cmd;
+    uint64_t now, sessions, phases = 0;
+    int rc = 0;
+    int is_new = 0;
+
+    // A phase may have stopped since the handler checked recording_paused
+    if (phases_at>=0 && (phases = Phase_Active())==0) {
+        return 0;
+    }
+
+    // Caller rules, command and sessions share one lookup in the /proc
+    // cache; /proc is read, when it is, outside the table lock
+    if (filter->callers!=NULL) {
+        struct fuse_context *ctx = fuse_get_context();
+        if (!Caller_Ids_Allowed(filter->callers, ctx->uid, ctx->gid)) {
+            return 0;
+        }
+        if (Caller_Query(filter->callers, &q[nq])) {
+            q_caller = nq++;
+        }
+    }
+    if (entry_attrib) {
+        Attrib_Query(&q[nq]);
+        q_cmd = nq++;
+    }
+    if (sessions_at>=0 && Session_Query(&q[nq])) {
+        q_sessions = nq++;
+    }
+    Proc_Query(fuse_get_context()->pid, q, nq);
+    if (q_caller>=0 && !q[q_caller].value) {
+        return 0;
+    }
+
+    if (is_included(path, filter->include_path, filter->include_path_count)!=1) {
+        return 0;
+    }
+
+    if (is_excluded(path, filter->exclude_path, filter->exclude_path_count)==1) {
+        return 0;
+    }
+
+    now = entry_times ? access_time() : 0;
+    cmd = q_cmd>=0 ? (uint32_t)q[q_cmd].value : ATTRIB_UNKNOWN;
+    sessions = q_sessions>=0 ? q[q_sessions].value : 0;
+    Stats_Lock(&prmutex);                // Hash function is not reentrant
+
+    item = Hash_Find(log_hash, path);
+    if (item==NULL) {
+        // khash rehashes inside this put; only then is it worth a clock read
+        int grows = log_hash->n_occupied >= log_hash->upper_bound;
+        uint64_t t0 = grows ? Stats_Clock() : 0;
+
+        item = malloc(sizeof(lfs_entry_t) + extra_words*sizeof(uint64_t));
+        item->path = strdup(path);
+        item->flags = flag;
+        item->id = next_path_id++;
+        item->ops.small[0] = 1;
+        if (entry_times) {
+            item->extra[0] = item->extra[1] = now;
+        }
+        if (procs_at>=0) {
+            item->extra[procs_at] = Attrib_Set_Add(ATTRIB_NONE, cmd);
+        }
+        if (sessions_at>=0) {
+            item->extra[sessions_at] = sessions;
+        }
+        if (phases_at>=0) {
+            item->extra[phases_at] = phases;
+        }
+        Hash_Add(log_hash, item->path, item);
+        is_new = 1;
+        entry_bytes += malloc_usable_size(item);
+        path_bytes += malloc_usable_size(item->path);
+        if (grows) {
+            hash_resizes++;
+            hash_resize_ns += Stats_Clock() - t0;
+        }
+    }
+    else {
+        int op = __builtin_ctz(flag);
+        int idx = __builtin_popcount(item->flags & (flag - 1));
+        if (item->flags & flag) {
+            entry_op_bump(item, op, idx);
+        }
+        else {
+            entry_op_insert(item, idx);
+            item->flags |= flag;
+        }
+        if (entry_times) {
+            item->extra[1] = now;
+        }
+        if (procs_at>=0) {
+            item->extra[procs_at] = Attrib_Set_Add((uint32_t)item->extra[procs_at], cmd);
+        }
+        if (sessions_at>=0) {
+            item->extra[sessions_at] |= sessions;
+        }
+        if (phases_at>=0) {
+            item->extra[phases_at] |= phases;
+        }
+    }
+    rc = 1;
+    id = item->id;
+    Stats_Unlock(&prmutex);
+
+    // item may be freed by a reset from here on
+    if (Journal_Enabled()) {
+        if (is_new) {
+            Journal_Path(id, path);
+        }
+        Journal_Event(id, __builtin_ctz(flag), state);
+    }
+    if (is_new && memory_limit > 0 && (id & 1023)==0) {
+        Check_Memory_Limit();
+    }
+
+    return rc;
+}
+
+// Recording time, filters included, is charged to the current operation
+// so that the timing wrappers can tell it apart from the backing calls
+int Store_In_Hash(Hash *log_hash, filter_desc_t *filter, const char *path, int flag, int state) {
+
+    uint64_t t0;
+    int rc, saved_errno;
+
+    if (__atomic_load_n(&recording_paused, __ATOMIC_RELAXED) || path==NULL) {
+        return 0;
+    }
+    // Recording reads /proc; handlers may still look at errno afterwards
+    saved_errno = errno;
+    if (!timing_enabled) {
+        rc = Record_Path(log_hash, filter, path, flag, state);
+    }
+    else {
+        t0 = Stats_Clock();
+        rc = Record_Path(log_hash, filter, path, flag, state);
+        Stats_Record(Stats_Clock() - t0);
+    }
+    errno = saved_errno;
+    return rc;
+}
+
+// Byte ranges of a read or write, under the same pause, caller and path
+// filters as the table
+static void Store_Extent(const char *path, int kind, off_t offset, size_t len) {
+
+    filter_desc_t *filter;
+
+    if (__atomic_load_n(&recording_paused, __ATOMIC_RELAXED) || !Extent_Enabled()) {
+        return;
+    }
+    filter = __atomic_load_n(&g_filter, __ATOMIC_ACQUIRE);
+    if (filter->callers!=NULL) {
+        struct fuse_context *ctx = fuse_get_context();
+        if (!Caller_Allowed(filter->callers, ctx->pid, ctx->uid, ctx->gid)) {
+            return;
+        }
+    }
+    if (is_included(path, filter->include_path, filter->include_path_count)!=1 ||
+        is_excluded(path, filter->exclude_path, filter->exclude_path_count)==1) {
+        return;
+    }
+    Extent_Add(path, kind, (uint64_t)offset, len);
+}
+
+void Free_Hash(Hash *h) {
+
+    int i=0;
+    for (int k = 0; k < kh_end(h); ++k) {
+        if (kh_exist(h, k)) {
+            lfs_entry_t *item =(lfs_entry_t *) kh_value(h, k);
+            if (item!=NULL && item->path!=NULL) {
+                entry_free(item);
+            }
+            i++;
+        }
+    }
+    Hash_Free(h);
+    kh_destroy(spill, op_spill);
+    op_spill = NULL;
+}
+
+// Copies all entries while holding prmutex, so FUSE threads are blocked
+// only for the copy and not for formatting or I/O. Paths are shared with
+// the table; callers hold table_lock shared until they are done with them.
+// With op_counts, the per-op counts are copied too (see lfs_count_t);
+// the caller frees them.
+lfs_count_t *Snapshot_Hash(Hash *h, size_t *n, uint64_t **op_counts) {
+
+    lfs_count_t *items;
+    lfs_entry_t *v;
+    uint64_t *counts = NULL;
+    size_t i = 0, used = 0, cap = 0;
+
+    Stats_Lock(&prmutex);
+    items = malloc((kh_size(h) + 1)*sizeof(lfs_count_t));
+    if (op_counts!=NULL) {
+        cap = kh_size(h)*LFS_INLINE_OPS + QN_FLAGS;
+        counts = malloc(cap*sizeof(uint64_t));
+    }
+    kh_foreach_value(h, v, {
+        int ops = __builtin_popcount(v->flags);
+        uint64_t total = 0;
+        if (counts!=NULL && used + ops > cap) {
+            cap *= 2;
+            counts = realloc(counts, cap*sizeof(uint64_t));
+        }
+        for (int k = 0, rest = v->flags; rest != 0; k++, rest &= rest - 1) {
+            uint64_t c = entry_op_count(v, __builtin_ctz(rest), k);
+            if (counts!=NULL) {
+                counts[used + k] = c;
+            }
+            total += c;
+        }
+        items[i].path = v->path;
+        items[i].count = total;
+        items[i].flags = v->flags;
+        items[i].ops = (uint32_t)used;
+        items[i].seq = v->id;
+        items[i].first_ns = entry_times ? v->extra[0] : 0;
+        items[i].last_ns = entry_times ? v->extra[1] : 0;
+        items[i].procs = procs_at>=0 ? Attrib_Set_Text((uint32_t)v->extra[procs_at]) : NULL;
+        items[i].sessions = sessions_at>=0 ? v->extra[sessions_at] : 0;
+        items[i].phases = phases_at>=0 ? v->extra[phases_at] : 0;
+        if (counts!=NULL) {
+            used += ops;
+        }
+        i++;
+    });
+    Stats_Unlock(&prmutex);
+
+    if (op_counts!=NULL) {
+        *op_counts = counts;
+    }
+    *n = i;
+    return items;
+}
+
+typedef struct table_stats {
+    uint64_t      acquired;            // prmutex
+    uint64_t      contended;
+    uint64_t      wait_ns;
+    size_t        entries;
+    uint32_t      ids;                 // paths ever seen
+    uint32_t      buckets;
+    uint64_t      resizes;
+    uint64_t      resize_ns;
+    hash_probes_t probes;
+} table_stats_t;
+
+// Probe lengths are sampled so that FUSE threads are not held up for long
+#define PROBE_SAMPLE  65536
+
+static void Table_Stats(table_stats_t *ts, int probes) {
+
+    Stats_Lock(&prmutex);
+    ts->acquired = prmutex.acquired;
+    ts->contended = prmutex.contended;
+    ts->wait_ns = prmutex.wait_ns;
+    ts->entries = kh_size(h);
+    ts->ids = next_path_id;
+    ts->buckets = kh_n_buckets(h);
+    ts->resizes = hash_resizes;
+    ts->resize_ns = hash_resize_ns;
+    if (probes) {
+        Hash_Probes(h, PROBE_SAMPLE, &ts->probes);
+    }
+    else {
+        memset(&ts->probes, 0, sizeof(ts->probes));
+    }
+    Stats_Unlock(&prmutex);
+}
+
+static void Print_Table_Stats(sink_t *dest) {
+
+    table_stats_t ts;
+
+    Table_Stats(&ts, 1);
+    Sink_Printf(dest, "#### Recording lock: %" PRIu64 " acquired, %" PRIu64 " contended, %.1f ms waited ####\n",
+                ts.acquired, ts.contended, ts.wait_ns/1e6);
+    Sink_Printf(dest, "#### Hash table: %u buckets, load %.2f, %" PRIu64 " resizes in %.1f ms, probes %.2f avg %u max ####\n",
+                ts.buckets, ts.buckets ? (double)ts.entries/ts.buckets : 0.0, ts.resizes, ts.resize_ns/1e6,
+                ts.probes.mean, ts.probes.max);
+}
+
+static void Print_Memory(sink_t *dest) {
+
+    size_t mem[MEM_KINDS];
+    size_t total = Memory_Usage(mem);
+
+    Sink_Printf(dest, "#### Memory (KB):");
+    for (int i=0;i<MEM_KINDS;i++) {
+        Sink_Printf(dest, " %s %zu,", mem_names[i], mem[i]/1024);
+    }
+    Sink_Printf(dest, " total %zu ####\n", total/1024);
+    if (memory_limit > 0 && total > memory_limit) {
+        Sink_Printf(dest, "#### WARNING: over the %zu KB memory soft limit ####\n", memory_limit/1024);
+    }
+}
+
+static void print_percentiles(sink_t *dest, const char *name, const stats_lat_t *lat) {
+    Sink_Printf(dest, " %s %.1f/%.1f/%.1f/%.1f", name,
+                lat->p50/1e3, lat->p99/1e3, lat->p999/1e3, lat->max/1e3);
+}
+
+// "#" lines, skipped by the log readers
+static void Print_Latency(sink_t *dest) {
+
+    stats_lat_t lat[STATS_KINDS];
+
+    Sink_Printf(dest, "#### Latency (us, p50/p99/p999/max):\n");
+    for (int i=0;i<QN_FLAGS;i++) {
+        Stats_Latency(i, lat);
+        if (lat[STATS_TOTAL].count==0) {
+            continue;
+        }
+        Sink_Printf(dest, "# %-11s %10" PRIu64, op_names[i], lat[STATS_TOTAL].count);
+        print_percentiles(dest, "total", &lat[STATS_TOTAL]);
+        print_percentiles(dest, "backing", &lat[STATS_BACKING]);
+        print_percentiles(dest, "record", &lat[STATS_RECORD]);
+        Sink_Printf(dest, "\n");
+    }
+}
+
+void Print_Header(sink_t *dest, size_t size) {
+
+    char legend[QN_FLAGS+1];
+
+    for (int i=0;i<QN_FLAGS;i++) {
+        if (op_flags[i]==(LOG_SUCCESS | LOG_UNSUCCESS)) {
+            legend[i]='a';
+        }
+        else if (op_flags[i] == LOG_SUCCESS) {
+            legend[i]='s';
+        }
+        else if (op_flags[i] == LOG_UNSUCCESS) {
+            legend[i]='u';
+        }
+        else {
+            legend[i]='.';
+        }
+    }
+    legend[QN_FLAGS]=0;
+
+    Sink_Printf(dest, "#### Hash size: [%zu] ####\n", size);
+    Sink_Printf(dest, "#### Log mask/legend:\n#%s####\n", legend);
+    Sink_Printf(dest, "#GArdKMSuDNLmoTnsORWteFXxlv\n");
+    if (output_columns!=NULL) {
+        Sink_Printf(dest, "#### Columns: ");
+        for (int i=0;i<output_columns->n;i++) {
+            Sink_Printf(dest, "%s:", Dump_Column_Name(output_columns->col[i]));
+        }
+        Sink_Printf(dest, "path ####\n");
+        if (entry_times) {
+            char stamp[32];
+            struct tm tm;
+            time_t mounted = time(NULL) - access_time()/1000000000ULL;
+            localtime_r(&mounted, &tm);
+            strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+            Sink_Printf(dest, "#### Access times in seconds since the mount, %s ####\n", stamp);
+        }
+        if (entry_attrib) {
+            uint32_t n = Attrib_Commands();
+            Sink_Printf(dest, "#### Commands (C:number:command<parent...) ####\n");
+            for (uint32_t i = 0; i < n; i++) {
+                Sink_Printf(dest, "#C:%u:%s\n", i, Attrib_Command_Name(i));
+            }
+        }
+    }
+    Print_Table_Stats(dest);
+    Print_Memory(dest);
+    if (latency_enabled) {
+        Print_Latency(dest);
+    }
+}
+
+// Formats in parallel and hands large buffers to the sink, which writes
+// them with writev() or streams them through the compressor.
+void Print_Entries(sink_t *dest, const lfs_count_t *items, size_t n, const uint64_t *op_counts) {
+
+    struct timespec t0, t1;
+    double ms;
+    int rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc = Dump_Entries(dest, items, n, op_counts, output_columns, dump_threads);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (rc!=0) {
+        fprintf(stderr, "Can't write log entries: %s\n", strerror(-rc));
+        return;
+    }
+    ms = (t1.tv_sec - t0.tv_sec)*1000.0 + (t1.tv_nsec - t0.tv_nsec)/1e6;
+    if (n > 0) {
+        fprintf(stderr, "Dumped %zu entries in %.1f ms (%.0f entries/s)\n", n, ms, ms > 0 ? n*1000.0/ms : 0.0);
+    }
+}
+
+// Extent lines are gathered in a large buffer and written in batches, a
+// heavily read file has thousands of ranges
+#define EXTENT_OUT_BUF  (1 << 20)
+
+typedef struct extent_out {
+    sink_t *dest;
+    char   *buf;
+    size_t  len;
+} extent_out_t;
+
+// Room for need more bytes; need is at most a path and a separator
+static char *extent_out_room(extent_out_t *o, size_t need) {
+    if (o->len + need > EXTENT_OUT_BUF) {
+        Sink_Write(o->dest, o->buf, o->len);
+        o->len = 0;
+    }
+    return o->buf + o->len;
+}
+
+static void print_extent(void *ctx, const char *path, int kind,
+                         const extent_t *ranges, size_t n, uint64_t bytes) {
+
+    extent_out_t *o = ctx;
+    struct stat st;
+    uint64_t size = UINT64_MAX;
+    size_t path_len = strlen(path);
+
+    // relative to the backing directory, the daemon's working directory;
+    // ranges widened to the granularity are cut at the end of the file
+    if (fstatat(AT_FDCWD, path[1] ? path + 1 : ".", &st, 0)==0) {
+        size = st.st_size;
+        bytes = 0;
+        for (size_t i = 0; i < n && ranges[i].start < size; i++) {
+            bytes += (ranges[i].end < size ? ranges[i].end : size) - ranges[i].start;
+        }
+    }
+    if (size!=UINT64_MAX) {
+        o->len += sprintf(extent_out_room(o, 64), "#%c:%" PRIu64 ":%" PRIu64 ":",
+                          kind==EXT_READ ? 'R' : 'W', bytes, size);
+    }
+    else {
+        o->len += sprintf(extent_out_room(o, 64), "#%c:%" PRIu64 ":-:", kind==EXT_READ ? 'R' : 'W', bytes);
+    }
+    for (size_t i = 0; i < n && ranges[i].start < size; i++) {
+        o->len += sprintf(extent_out_room(o, 48), "%s%" PRIu64 "-%" PRIu64, i==0 ? "" : ",",
+                          ranges[i].start, ranges[i].end < size ? ranges[i].end : size);
+    }
+    o->len += sprintf(extent_out_room(o, path_len + 3), ":%s\n", path);
+}
+
+// "#" lines after the entries, so log readers skip them
+static void Print_Extents(sink_t *dest) {
+
+    extent_out_t o = { dest, malloc(EXTENT_OUT_BUF), 0 };
+
+    Sink_Printf(dest, "#### Extents (R|W:bytes:file size:start-end,...:path), granularity %d ####\n",
+                extents_granularity);
+    Extent_Foreach(print_extent, &o);
+    if (o.len > 0) {
+        Sink_Write(dest, o.buf, o.len);
+    }
+    free(o.buf);
+}
+
+void Print_Hash(sink_t *dest, Hash *h) {
+
+    lfs_count_t *items;
+    uint64_t *op_counts = NULL;
+    size_t n;
+
+    if (h==NULL) {
+        Sink_Printf(dest, "!!! Empty hash!!!\n");
+        return;
+    }
+
+    pthread_rwlock_rdlock(&table_lock);
+    items = Snapshot_Hash(h, &n, Dump_Needs_Ops(output_columns) ? &op_counts : NULL);
+    if (sort_output>=0) {
+        Dump_Sort(items, n, sort_output, dump_threads);
+    }
+    Print_Header(dest, n);
+    Print_Entries(dest, items, n, op_counts);
+    free(items);
+    free(op_counts);
+    if (Extent_Enabled()) {
+        Print_Extents(dest);
+    }
+    pthread_rwlock_unlock(&table_lock);
+}
+
+int Write_Binlog(const char *file, Hash *h) {
+
+    binlog_entry_t *entries;
+    lfs_count_t *items;
+    size_t n;
+    int rc;
+
+    pthread_rwlock_rdlock(&table_lock);
+    items = Snapshot_Hash(h, &n, NULL);
+    Dump_Sort(items, n, DUMP_SORT_PATH, dump_threads);
+    entries = malloc((n + 1)*sizeof(binlog_entry_t));
+    for (size_t i = 0; i < n; i++) {
+        entries[i].path = items[i].path;
+        entries[i].count = items[i].count;
+        entries[i].flags = items[i].flags;
+    }
+    free(items);
+    rc = Binlog_Write(file, entries, n, op_flags, symbols, QN_FLAGS);
+    free(entries);
+    pthread_rwlock_unlock(&table_lock);
+    return rc;
+}
+
+// Subsets of the table written on their own
+#define SUBSET_ALL      0
+#define SUBSET_SESSION  1              // the entries a session's processes accessed
+#define SUBSET_PHASE    2              // the entries accessed while a phase was active
+
+// The entries of a session or phase, in log format. Masks and counts are
+// those of the whole mount.
+static void Print_Subset(sink_t *dest, int subset, int slot) {
+
+    lfs_count_t *items;
+    uint64_t *op_counts = NULL;
+    char desc[SESSION_NAME_MAX + PATH_MAX];
+    size_t n, m = 0;
+
+    pthread_rwlock_rdlock(&table_lock);
+    items = Snapshot_Hash(h, &n, Dump_Needs_Ops(output_columns) ? &op_counts : NULL);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bits = subset==SUBSET_SESSION ? items[i].sessions : items[i].phases;
+        if (bits & (1ULL << slot)) {
+            items[m++] = items[i];
+        }
+    }
+    if (sort_output>=0) {
+        Dump_Sort(items, m, sort_output, dump_threads);
+    }
+    if (subset==SUBSET_SESSION) {
+        Session_Describe(slot, desc, sizeof(desc));
+        Sink_Printf(dest, "#### Session: %s ####\n", desc);
+    }
+    else {
+        Sink_Printf(dest, "#### Phase: %s ####\n", Phase_Name(slot));
+    }
+    Print_Header(dest, m);
+    Print_Entries(dest, items, m, op_counts);
+    free(items);
+    free(op_counts);
+    pthread_rwlock_unlock(&table_lock);
+}
+
+// The whole table or a subset, written to name via a temporary file so
+// readers never see a partial log
+static int Write_Log_File(const char *name, int kind, int subset, int slot) {
+
+    char tmp[PATH_MAX + 8];
+    sink_t *out;
+    int rc;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    out = Sink_Open(tmp, kind, compression_level, dump_threads);
+    if (out==NULL) {
+        return -errno;
+    }
+    if (subset==SUBSET_ALL) {
+        Print_Hash(out, h);
+    }
+    else {
+        Print_Subset(out, subset, slot);
+    }
+    rc = Sink_Close(out, 0);
+    if (rc==0 && rename(tmp, name)!=0) {
+        rc = -errno;
+    }
+    if (rc!=0) {
+        unlink(tmp);
+    }
+    return rc;
+}
+
+// Writes a session's entries to "<snapshot_base>.session.<name>" and a
+// phase's to "<snapshot_base>.phase.<name>", with the compression
+// suffix last like snapshots. The prefix keeps them apart from each other
+// and from snapshots ("<base>.1") and the timeline ("<base>.timeline").
+static int Write_Subset(int subset, int slot, char *name, size_t size) {
+
+    int kind = Sink_Kind(snapshot_base);
+    const char *suffix = Sink_Suffix(kind);
+    const char *label = subset==SUBSET_SESSION ? Session_Name(slot) : Phase_Name(slot);
+    int stem;
+    int rc;
+
+    if (snapshot_base==NULL) {
+        snprintf(name, size, "%s", label);
+        return -EINVAL;
+    }
+    stem = (int)(strlen(snapshot_base) - strlen(suffix));
+    snprintf(name, size, "%.*s.%s%s%s", stem, snapshot_base,
+             subset==SUBSET_PHASE ? "phase." : "session.", label, suffix);
+    rc = Write_Log_File(name, kind, subset, slot);
+    if (rc==0) {
+        fprintf(stderr, "%s log written to %s\n", subset==SUBSET_SESSION ? "Session" : "Phase", name);
+    }
+    return rc;
+}
+
+// Drops the slot's bit from every entry, before a new session takes it
+static void Clear_Session(int slot) {
+
+    lfs_entry_t *v;
+
+    Stats_Lock(&prmutex);
+    kh_foreach_value(h, v, {
+        v->extra[sessions_at] &= ~(1ULL << slot);
+    });
+    Stats_Unlock(&prmutex);
+}
+
+// Writes the current table to "<snapshot_base>.<seq>" via a temporary
+// file, so readers never see a partial snapshot. A compression suffix of
+// the base name is kept last: "access.log.gz" gives "access.log.1.gz".
+static int Write_Snapshot(char *name, size_t size) {
+
+    int kind = Sink_Kind(snapshot_base);
+    const char *suffix = Sink_Suffix(kind);
+    int stem;
+    int rc;
+
+    if (snapshot_base==NULL) {
+        return -EINVAL;
+    }
+    stem = (int)(strlen(snapshot_base) - strlen(suffix));
+    snprintf(name, size, "%.*s.%d%s", stem, snapshot_base,
+             __atomic_add_fetch(&snapshot_seq, 1, __ATOMIC_RELAXED), suffix);
+    rc = Write_Log_File(name, kind, SUBSET_ALL, 0);
+    if (rc!=0) {
+        return rc;
+    }
+    fprintf(stderr, "Snapshot written to %s\n", name);
+    return 0;
+}
+
+// Appends every finished time bucket (all of them when final) to the
+// timeline file: seconds since the mount, then one count per operation
+static void Write_Timeline(int final) {
+
+    uint64_t counts[QN_FLAGS];
+    uint64_t now = Stats_Timeline_Now() + (final ? 1 : 0);
+
+    if (timeline_fp==NULL) {
+        return;
+    }
+    if (now - timeline_next > STATS_TL_SLOTS) {
+        fprintf(timeline_fp, "# %" PRIu64 " intervals lost\n", now - STATS_TL_SLOTS - timeline_next);
+        timeline_next = now - STATS_TL_SLOTS;
+    }
+    for (; timeline_next < now; timeline_next++) {
+        if (Stats_Timeline_Sum(timeline_next, counts, QN_FLAGS)!=0) {
+            fprintf(timeline_fp, "# interval %" PRIu64 " incomplete\n", timeline_next);
+        }
+        fprintf(timeline_fp, "%.3f", timeline_next*timeline_ms/1000.0);
+        for (int i=0;i<QN_FLAGS;i++) {
+            fprintf(timeline_fp, " %" PRIu64, counts[i]);
+        }
+        fprintf(timeline_fp, "\n");
+    }
+    fflush(timeline_fp);
+}
+
+static void Start_Timeline(void) {
+
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    if (timeline_fp==NULL) {
+        return;
+    }
+    localtime_r(&now, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(timeline_fp, "# DistillerFS timeline, interval_ms=%d, started %s\n#t_s", timeline_ms, stamp);
+    for (int i=0;i<QN_FLAGS;i++) {
+        fprintf(timeline_fp, " %s", op_names[i]);
+    }
+    fprintf(timeline_fp, "\n");
+    Stats_Timeline_Init(timeline_ms);
+}
+
+// Rewrites the shared memory segment read by distillerfs-stat; hash
+// probes are left out, they would hold the recording lock too long
+static void Publish_Stats(int final) {
+
+    shmstat_t *s = shm_stats;
+    table_stats_t ts;
+    size_t mem[MEM_KINDS];
+    uint64_t ok[QN_FLAGS], fail[QN_FLAGS];
+    struct timespec now;
+
+    if (s==NULL || final) {
+        return;
+    }
+    Stats_Sum(ok, fail, QN_FLAGS);
+    Table_Stats(&ts, 0);
+    Memory_Usage(mem);
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    Shmstat_Write_Begin(s);
+    s->update_realtime_ns = (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+    s->recording = !__atomic_load_n(&recording_paused, __ATOMIC_RELAXED);
+    s->entries = ts.entries;
+    s->paths_seen = ts.ids;
+    for (int i=0;i<QN_FLAGS && i<SHMSTAT_OPS;i++) {
+        s->ok[i] = ok[i];
+        s->fail[i] = fail[i];
+    }
+    s->lock_acquired = ts.acquired;
+    s->lock_contended = ts.contended;
+    s->lock_wait_ns = ts.wait_ns;
+    s->hash_buckets = ts.buckets;
+    s->hash_resizes = ts.resizes;
+    s->hash_resize_ns = ts.resize_ns;
+    for (int i=0;i<MEM_KINDS && i<SHMSTAT_MEM;i++) {
+        s->mem[i] = mem[i];
+    }
+    s->mem_limit = memory_limit;
+    s->latency = latency_enabled;
+    if (latency_enabled) {
+        for (int i=0;i<QN_FLAGS && i<SHMSTAT_OPS;i++) {
+            uint64_t hist[STATS_BUCKETS];
+            for (int k=0;k<STATS_KINDS;k++) {
+                stats_lat_t lat;
+                uint64_t max = Stats_Histogram(i, k, hist);
+                Stats_Percentiles(hist, max, &lat);
+                s->lat[i][k].count = lat.count;
+                s->lat[i][k].p50 = lat.p50;
+                s->lat[i][k].p99 = lat.p99;
+                s->lat[i][k].p999 = lat.p999;
+                s->lat[i][k].max = lat.max;
+                if (k==STATS_TOTAL) {
+                    memcpy(s->hist[i], hist, sizeof(s->hist[i]));
+                }
+            }
+        }
+    }
+    Shmstat_Write_End(s);
+}
+
+// Label values may hold any byte; the exposition format escapes \\, " and newline
+static void prom_label(FILE *fp, const char *value) {
+    for (; *value; value++) {
+        if (*value=='\\' || *value=='"') {
+            fputc('\\', fp);
+            fputc(*value, fp);
+        }
+        else if (*value=='\n') {
+            fputs("\\n", fp);
+        }
+        else {
+            fputc(*value, fp);
+        }
+    }
+}
+
+static void prom_metric(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Starts a sample: name{mount="..."; the caller adds labels and the value
+static void prom_sample(FILE *fp, const char *name) {
+    fprintf(fp, "%s{mount=\"", name);
+    prom_label(fp, loggedfsArgs->mountPoint);
+    fputc('"', fp);
+}
+
+// Histogram buckets every 4th power of two, 1.024 us to 17.2 s
+#define PROM_FIRST_POW  10
+#define PROM_LAST_POW   34
+
+static void prom_histogram(FILE *fp, int op, int kind, const char *kind_name) {
+
+    uint64_t hist[STATS_BUCKETS];
+    uint64_t seen = 0;
+    int next_pow = PROM_FIRST_POW;
+
+    Stats_Histogram(op, kind, hist);
+    for (int i=0;i<STATS_BUCKETS;i++) {
+        // hist[0..i-1] counts everything below the floor of bucket i
+        uint64_t floor = Stats_Bucket_Floor(i);
+        if (next_pow<=PROM_LAST_POW && floor==(1ULL << next_pow)) {
+            prom_sample(fp, "distillerfs_operation_duration_seconds_bucket");
+            fprintf(fp, ",op=\"%s\",time=\"%s\",le=\"%.9g\"} %" PRIu64 "\n",
+                    op_names[op], kind_name, floor/1e9, seen);
+            next_pow += 2;
+        }
+        seen += hist[i];
+    }
+    prom_sample(fp, "distillerfs_operation_duration_seconds_bucket");
+    fprintf(fp, ",op=\"%s\",time=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", op_names[op], kind_name, seen);
+    prom_sample(fp, "distillerfs_operation_duration_seconds_sum");
+    fprintf(fp, ",op=\"%s\",time=\"%s\"} %.9f\n", op_names[op], kind_name, Stats_Time_Sum(op, kind)/1e9);
+    prom_sample(fp, "distillerfs_operation_duration_seconds_count");
+    fprintf(fp, ",op=\"%s\",time=\"%s\"} %" PRIu64 "\n", op_names[op], kind_name, seen);
+}
+
+// Writes counters and latency histograms in the Prometheus text format
+// for the node_exporter textfile collector. The file is replaced with
+// rename(), so a scrape never sees a partial file.
+static void Write_Prometheus(int final) {
+
+    static const char *kinds[STATS_KINDS] = { "total", "backing", "record" };
+    char tmp[PATH_MAX + 8];
+    uint64_t ok[QN_FLAGS], fail[QN_FLAGS];
+    table_stats_t ts;
+    size_t mem[MEM_KINDS];
+    struct timespec now;
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", prom_file);
+    fp = fopen(tmp, "w");
+    if (fp==NULL) {
+        fprintf(stderr, "Can't create %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    Stats_Sum(ok, fail, QN_FLAGS);
+    Table_Stats(&ts, 0);
+    Memory_Usage(mem);
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    prom_metric(fp, "distillerfs_mounted", "gauge", "1 while the filesystem is mounted, 0 once it was unmounted.");
+    prom_sample(fp, "distillerfs_mounted");
+    fprintf(fp, "} %d\n", final ? 0 : 1);
+    prom_metric(fp, "distillerfs_recording", "gauge", "1 while recording, 0 while paused.");
+    prom_sample(fp, "distillerfs_recording");
+    fprintf(fp, "} %d\n", !__atomic_load_n(&recording_paused, __ATOMIC_RELAXED));
+    prom_metric(fp, "distillerfs_last_update_seconds", "gauge", "Time this file was written, seconds since the epoch.");
+    prom_sample(fp, "distillerfs_last_update_seconds");
+    fprintf(fp, "} %.3f\n", now.tv_sec + now.tv_nsec/1e9);
+
+    prom_metric(fp, "distillerfs_operations_total", "counter", "Completed FUSE operations.");
+    for (int i=0;i<QN_FLAGS;i++) {
+        prom_sample(fp, "distillerfs_operations_total");
+        fprintf(fp, ",op=\"%s\",result=\"ok\"} %" PRIu64 "\n", op_names[i], ok[i]);
+        prom_sample(fp, "distillerfs_operations_total");
+        fprintf(fp, ",op=\"%s\",result=\"failed\"} %" PRIu64 "\n", op_names[i], fail[i]);
+    }
+
+    prom_metric(fp, "distillerfs_entries", "gauge", "Paths in the recording table.");
+    prom_sample(fp, "distillerfs_entries");
+    fprintf(fp, "} %zu\n", ts.entries);
+    prom_metric(fp, "distillerfs_paths_seen_total", "counter", "Paths recorded since mount, resets included.");
+    prom_sample(fp, "distillerfs_paths_seen_total");
+    fprintf(fp, "} %u\n", ts.ids);
+    prom_metric(fp, "distillerfs_snapshots_total", "counter", "Snapshots written.");
+    prom_sample(fp, "distillerfs_snapshots_total");
+    fprintf(fp, "} %d\n", __atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED));
+
+    prom_metric(fp, "distillerfs_lock_acquisitions_total", "counter", "Acquisitions of the recording lock.");
+    prom_sample(fp, "distillerfs_lock_acquisitions_total");
+    fprintf(fp, "} %" PRIu64 "\n", ts.acquired);
+    prom_metric(fp, "distillerfs_lock_contentions_total", "counter", "Acquisitions of the recording lock that had to wait.");
+    prom_sample(fp, "distillerfs_lock_contentions_total");
+    fprintf(fp, "} %" PRIu64 "\n", ts.contended);
+    prom_metric(fp, "distillerfs_lock_wait_seconds_total", "counter", "Time spent waiting for the recording lock.");
+    prom_sample(fp, "distillerfs_lock_wait_seconds_total");
+    fprintf(fp, "} %.9f\n", ts.wait_ns/1e9);
+
+    prom_metric(fp, "distillerfs_hash_buckets", "gauge", "Buckets of the recording hash table.");
+    prom_sample(fp, "distillerfs_hash_buckets");
+    fprintf(fp, "} %u\n", ts.buckets);
+    prom_metric(fp, "distillerfs_hash_resizes_total", "counter", "Resizes of the recording hash table.");
+    prom_sample(fp, "distillerfs_hash_resizes_total");
+    fprintf(fp, "} %" PRIu64 "\n", ts.resizes);
+    prom_metric(fp, "distillerfs_hash_resize_seconds_total", "counter", "Time spent resizing the recording hash table.");
+    prom_sample(fp, "distillerfs_hash_resize_seconds_total");
+    fprintf(fp, "} %.9f\n", ts.resize_ns/1e9);
+
+    prom_metric(fp, "distillerfs_memory_bytes", "gauge", "Memory used by the recording state.");
+    for (int i=0;i<MEM_KINDS;i++) {
+        prom_sample(fp, "distillerfs_memory_bytes");
+        fprintf(fp, ",kind=\"%s\"} %zu\n", mem_names[i], mem[i]);
+    }
+    prom_metric(fp, "distillerfs_memory_limit_bytes", "gauge", "Soft memory limit, 0 if none.");
+    prom_sample(fp, "distillerfs_memory_limit_bytes");
+    fprintf(fp, "} %zu\n", memory_limit);
+
+    if (latency_enabled) {
+        prom_metric(fp, "distillerfs_operation_duration_seconds", "histogram",
+                    "Operation latency: total, backing filesystem, and recording.");
+        for (int i=0;i<QN_FLAGS;i++) {
+            if (ok[i] + fail[i]==0) {
+                continue;
+            }
+            for (int k=0;k<STATS_KINDS;k++) {
+                prom_histogram(fp, i, k, kinds[k]);
+            }
+        }
+    }
+
+    if (fclose(fp)!=0 || rename(tmp, prom_file)!=0) {
+        fprintf(stderr, "Can't write %s: %s\n", prom_file, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+static void Start_Shm(void) {
+
+    struct timespec now;
+
+    if (shm_stats==NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    shm_stats->pid = getpid();         // the daemon, not the process that created it
+    shm_stats->start_realtime_ns = (uint64_t)now.tv_sec*1000000000ULL + now.tv_nsec;
+    Publish_Stats(0);
+}
+
+// Work the service thread does at a fixed interval; interval_ms 0 is off
+typedef struct periodic {
+    int       interval_ms;
+    uint64_t  due_ns;                  // CLOCK_MONOTONIC
+    void    (*run)(int final);
+} periodic_t;
+
+static periodic_t periodic[] = {
+    { 0, 0, Write_Timeline },
+    { 0, 0, Publish_Stats },
+    { 0, 0, Write_Prometheus },
+};
+
+#define QN_PERIODIC  (int)(sizeof(periodic)/sizeof(periodic[0]))
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void on_snapshot_signal(int sig) {
+    sem_post(&service_sem);            // async-signal-safe
+}
+
+// Background service thread: runs requests that must not block FUSE
+// workers, such as snapshots triggered by SIGUSR1, and the periodic
+// tasks (timeline, shared memory statistics, Prometheus file) when they
+// are due.
+static void *service_loop(void *arg) {
+
+    for (;;) {
+        uint64_t next = UINT64_MAX, now = monotonic_ns();
+        int rc;
+
+        for (int i=0;i<QN_PERIODIC;i++) {
+            if (periodic[i].interval_ms>0 && periodic[i].due_ns<next) {
+                next = periodic[i].due_ns;
+            }
+        }
+        if (next!=UINT64_MAX) {
+            // sem_timedwait() only takes CLOCK_REALTIME
+            struct timespec deadline;
+            uint64_t wait = next > now ? next - now : 0;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += wait%1000000000ULL;
+            deadline.tv_sec += wait/1000000000ULL + deadline.tv_nsec/1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            while ((rc = sem_timedwait(&service_sem, &deadline))==-1 && errno==EINTR) {
+            }
+        }
+        else {
+            while ((rc = sem_wait(&service_sem))==-1 && errno==EINTR) {
+            }
+        }
+        if (__atomic_load_n(&service_stop, __ATOMIC_ACQUIRE)) {
+            for (int i=0;i<QN_PERIODIC;i++) {
+                if (periodic[i].interval_ms>0) {
+                    periodic[i].run(1);
+                }
+            }
+            break;
+        }
+        now = monotonic_ns();
+        for (int i=0;i<QN_PERIODIC;i++) {
+            if (periodic[i].interval_ms>0 && periodic[i].due_ns<=now) {
+                periodic[i].run(0);
+                periodic[i].due_ns = now + periodic[i].interval_ms*1000000ULL;
+            }
+        }
+        if (rc!=0) {
+            continue;                  // timed out: only periodic work was due
+        }
+        char name[PATH_MAX];
+        rc = Write_Snapshot(name, sizeof(name));
+        if (rc!=0) {
+            fprintf(stderr, "Snapshot failed: %s\n", strerror(-rc));
+        }
+    }
+    return NULL;
+}
+
+static void Start_Service(void) {
+
+    struct sigaction sa;
+
+    sem_init(&service_sem, 0, 0);
+    if (timeline_fp!=NULL) {
+        periodic[0].interval_ms = timeline_ms;
+    }
+    if (shm_stats!=NULL) {
+        periodic[1].interval_ms = shm_interval_ms;
+    }
+    if (prom_file!=NULL) {
+        periodic[2].interval_ms = prom_interval_ms;
+    }
+    for (int i=0;i<QN_PERIODIC;i++) {
+        periodic[i].due_ns = monotonic_ns() + periodic[i].interval_ms*1000000ULL;
+    }
+    if (pthread_create(&service_thread, NULL, service_loop, NULL)!=0) {
+        fprintf(stderr, "Can't start service thread\n");
+        return;
+    }
+    service_running = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_snapshot_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+}
 
-typedef struct filter_desc {
-    char **exclude_path;
-    int    exclude_path_count;
-    char **include_path;
-    int    include_path_count;
-} filter_desc_t;
+static void Stop_Service(void) {
 
-static LoggedFS_Args *loggedfsArgs;
-static filter_desc_t *g_filter;
+    if (service_running) {
+        signal(SIGUSR1, SIG_IGN);
+        __atomic_store_n(&service_stop, 1, __ATOMIC_RELEASE);
+        sem_post(&service_sem);
+        pthread_join(service_thread, NULL);
+        service_running = 0;
+    }
+}
 
-static int is_Absolute_Path(const char *fileName)
-{
-    if (fileName && fileName[0] != '\0' && fileName[0] == '/') {
+// Every handler asks once per completed operation, so this is also where
+// operations are counted
+int should_log(int fuse_op, int state) {
+    Stats_Op(fuse_op, state==LOG_SUCCESS);
+    if ((op_flags[fuse_op] & state)!=0) {
         return 1;
     }
     else {
@@ -181,151 +1470,358 @@ static int is_Absolute_Path(const char *fileName)
     }
 }
 
-static int is_excluded(const char *path, char **exc_path, int qn_exc_path) {
-    for (int i=0;i<qn_exc_path;i++) {
-        if (strncmp(path, exc_path[i], strlen(exc_path[i]))==0) {
-            return 1;
-        }
+// Prefixes a relative name with the current directory
+static char *absolute_path(char *name) {
+    char cwd[PATH_MAX];
+    char *abs_name;
+
+    if (name[0]=='/' || getcwd(cwd, sizeof(cwd))==NULL) {
+        return name;
     }
-    return 0;
+    abs_name = malloc(2*PATH_MAX + 2);
+    snprintf(abs_name, 2*PATH_MAX + 2, "%s/%s", cwd, name);
+    return abs_name;
 }
 
-static int is_included(const char *path, char **inc_path, int qn_inc_path) {
-    if (qn_inc_path==0) {
-        // Empty include path equal "all included"
-        return 1;
-    }
-    for (int i=0;i<qn_inc_path;i++) {
-        if (strncmp(path, inc_path[i], strlen(inc_path[i]))==0) {
-            return 1;
+static char *getRelativePath(const char *path) {
+    if (path[0] == '/') {
+        if (strlen(path) == 1) {
+            return strdup(".");
         }
+        const char *substr = &path[1];
+        return strdup(substr);
     }
-    return 0;
+    return strdup(path);
 }
 
+// Drops all entries. They are unlinked under prmutex and freed once no
+// dump or query started before the reset still uses them. Path ids keep
+// counting, so a journal stays consistent across resets.
+static void Reset_Hash(void) {
 
-int Store_In_Hash(Hash *log_hash, filter_desc_t *filter, const char *path, int flag) {
-
-    lfs_count_t *item;
-    int rc = 0;
-
-    if (path==NULL) {
-        return 0;
-    }
+    lfs_entry_t **old, *v;
+    size_t n = 0;
 
-    if (is_included(path, filter->include_path, filter->include_path_count)!=1) {
-        return 0;
-    }
+    Stats_Lock(&prmutex);
+    old = malloc((kh_size(h) + 1)*sizeof(lfs_entry_t *));
+    kh_foreach_value(h, v, {
+        old[n++] = v;
+    });
+    kh_clear(text, h);
+    kh_clear(spill, op_spill);
+    Extent_Reset();
+    entry_bytes = 0;
+    path_bytes = 0;
+    Stats_Unlock(&prmutex);
+
+    pthread_rwlock_wrlock(&table_lock);
+    for (size_t i = 0; i < n; i++) {
+        entry_free(old[i]);
+    }
+    pthread_rwlock_unlock(&table_lock);
+    free(old);
+}
 
-    if (is_excluded(path, filter->exclude_path, filter->exclude_path_count)==1) {
-        return 0;
-    }
+static void Ctl_Stats(ctl_buf_t *out) {
 
-    pthread_mutex_lock(&prmutex);                // Hash function is not reentrant
+    uint64_t ok[QN_FLAGS], fail[QN_FLAGS];
+    uint64_t total_ok = 0, total_fail = 0;
+    struct timespec now;
+    table_stats_t ts;
+    size_t mem[MEM_KINDS], total_mem;
 
-    item = Hash_Find(log_hash, path);
-    if (item==NULL) {
-        item = malloc(sizeof(lfs_count_t));
-        item->count = 1;
-        item->path = strdup(path);
-        item->flags = flag;
-        Hash_Add(log_hash, item->path, item);
+    Stats_Sum(ok, fail, QN_FLAGS);
+    for (int i=0;i<QN_FLAGS;i++) {
+        total_ok += ok[i];
+        total_fail += fail[i];
+    }
+    Table_Stats(&ts, 1);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    Ctl_Printf(out, "state %s\n", __atomic_load_n(&recording_paused, __ATOMIC_RELAXED) ? "paused" : "recording");
+    Ctl_Printf(out, "uptime_s %.3f\n", (now.tv_sec - start_time.tv_sec) + (now.tv_nsec - start_time.tv_nsec)/1e9);
+    Ctl_Printf(out, "entries %zu\n", ts.entries);
+    Ctl_Printf(out, "paths_seen %u\n", ts.ids);
+    Ctl_Printf(out, "snapshots %d\n", __atomic_load_n(&snapshot_seq, __ATOMIC_RELAXED));
+    Ctl_Printf(out, "journal.error %d\n", -Journal_Error());
+    Ctl_Printf(out, "sessions %d\n", __builtin_popcountll(Session_Running()));
+    Ctl_Printf(out, "phases %d\n", __builtin_popcountll(Phase_Active()));
+    Ctl_Printf(out, "ops_ok %" PRIu64 "\n", total_ok);
+    Ctl_Printf(out, "ops_failed %" PRIu64 "\n", total_fail);
+    Ctl_Printf(out, "lock.acquired %" PRIu64 "\n", ts.acquired);
+    Ctl_Printf(out, "lock.contended %" PRIu64 "\n", ts.contended);
+    Ctl_Printf(out, "lock.wait_ms %.3f\n", ts.wait_ns/1e6);
+    Ctl_Printf(out, "hash.buckets %u\n", ts.buckets);
+    Ctl_Printf(out, "hash.load %.3f\n", ts.buckets ? (double)ts.entries/ts.buckets : 0.0);
+    Ctl_Printf(out, "hash.resizes %" PRIu64 "\n", ts.resizes);
+    Ctl_Printf(out, "hash.resize_ms %.3f\n", ts.resize_ns/1e6);
+    Ctl_Printf(out, "hash.probe_mean %.3f\n", ts.probes.mean);
+    Ctl_Printf(out, "hash.probe_max %u\n", ts.probes.max);
+    total_mem = Memory_Usage(mem);
+    for (int i=0;i<MEM_KINDS;i++) {
+        Ctl_Printf(out, "mem.%s_bytes %zu\n", mem_names[i], mem[i]);
+    }
+    Ctl_Printf(out, "mem.total_bytes %zu\n", total_mem);
+    Ctl_Printf(out, "mem.limit_bytes %zu\n", memory_limit);
+    for (int i=0;i<QN_FLAGS;i++) {
+        Ctl_Printf(out, "op.%s.ok %" PRIu64 "\n", op_names[i], ok[i]);
+        Ctl_Printf(out, "op.%s.failed %" PRIu64 "\n", op_names[i], fail[i]);
     }
-    else {
-        item->count++;
-        item->flags = item->flags|flag;
+    if (!latency_enabled) {
+        return;
     }
-    rc = item->count;
-    pthread_mutex_unlock(&prmutex);
+    for (int i=0;i<QN_FLAGS;i++) {
+        static const char *kinds[STATS_KINDS] = { "total", "backing", "record" };
+        stats_lat_t lat[STATS_KINDS];
 
-    return rc;
+        Stats_Latency(i, lat);
+        if (lat[STATS_TOTAL].count==0) {
+            continue;
+        }
+        for (int k=0;k<STATS_KINDS;k++) {
+            Ctl_Printf(out, "lat.%s.%s_us %.1f %.1f %.1f %.1f\n", op_names[i], kinds[k],
+                       lat[k].p50/1e3, lat[k].p99/1e3, lat[k].p999/1e3, lat[k].max/1e3);
+        }
+    }
 }
 
-void Free_Hash(Hash *h) {
+// Entries whose path starts with prefix, sorted by path, in log format
+static void Ctl_Query(const char *prefix, ctl_buf_t *out) {
 
-    int i=0;
-    for (int k = 0; k < kh_end(h); ++k) {
-        if (kh_exist(h, k)) {
-            lfs_count_t *item =(lfs_count_t *) kh_value(h, k);
-            if (item!=NULL && item->path!=NULL) {
-                free(item->path);
-                free(item);
-            }
-            i++;
+    lfs_count_t *items;
+    size_t n, m = 0;
+    size_t prefix_len = strlen(prefix);
+    char mask[QN_FLAGS+1];
+
+    pthread_rwlock_rdlock(&table_lock);
+    items = Snapshot_Hash(h, &n, NULL);
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp(items[i].path, prefix, prefix_len)==0) {
+            items[m++] = items[i];
         }
     }
-    Hash_Free(h);
+    Dump_Sort(items, m, DUMP_SORT_PATH, 1);
+    for (size_t k = 0; k < m; k++) {
+        for (int i=0;i<QN_FLAGS;i++) {
+            mask[i] = (items[k].flags & (1 << i)) ? symbols[i] : '.';
+        }
+        mask[QN_FLAGS] = 0;
+        Ctl_Printf(out, "[%s]:%010" PRIu64 ":%s\n", mask, items[k].count, items[k].path);
+    }
+    free(items);
+    pthread_rwlock_unlock(&table_lock);
 }
 
-void Print_Hash(FILE *dest, Hash *h) {
+static int Reload_Config(ctl_buf_t *out);
 
-    const char* k;
-    lfs_count_t *v;
-    char mask[27];
+// "phase start|stop|switch NAME", "phase list"
+static int Ctl_Phase(const char *args, ctl_buf_t *out) {
 
-    if (h==NULL) {
-        fprintf(dest, "!!! Empty hash!!!\n");
-        return;
-    }
+    char verb[16], name[SESSION_NAME_MAX + 1];
+    int n = sscanf(args, "%15s %64s", verb, name);
+    int id = -EINVAL;
 
-    kh_foreach(h, k, v, {
-        for (int i=0;i<QN_FLAGS;i++) {
-            int cur_flag=1<<i;
-            if ((v->flags&cur_flag)!=0) {
-                mask[i]=symbols[i];
-            }
-            else {
-                mask[i]='.';
-            }
+    if (n==1 && strcmp(verb, "list")==0) {
+        uint64_t active = Phase_Active();
+        for (int i=0;i<Phase_Count();i++) {
+            Ctl_Printf(out, "%s %s\n", Phase_Name(i), active & (1ULL << i) ? "active" : "stopped");
         }
-        mask[26]=0;
-
-        fprintf(dest, "[%s]:%010d:%s\n", mask, v->count, k);
-    });
-    return;
+        return 0;
+    }
+    if (n==2 && strcmp(verb, "start")==0) {
+        id = Phase_Start(name);
+    }
+    else if (n==2 && strcmp(verb, "stop")==0) {
+        id = Phase_Stop(name);
+    }
+    else if (n==2 && strcmp(verb, "switch")==0) {
+        id = Phase_Switch(name);
+    }
+    else {
+        Ctl_Printf(out, "Usage: phase start|stop|switch NAME, phase list\n");
+        return -EINVAL;
+    }
+    Update_Recording();
+    if (id<0) {
+        Ctl_Printf(out, "Can't %s phase %s: %s\n", verb, name, strerror(-id));
+        return id;
+    }
+    return 0;
 }
 
-int should_log(int fuse_op, int state) {
-    if ((op_flags[fuse_op] & state)!=0) {
-        return 1;
+// "session start|end|list ..."; commands run in the writer's FUSE
+// request, so its pid is the caller's
+static int Ctl_Session(const char *args, ctl_buf_t *out) {
+
+    char verb[16], name[SESSION_NAME_MAX + 1], kind[16], value[PATH_MAX];
+    char file[PATH_MAX];
+    int n = sscanf(args, "%15s %64s %15s %4095s", verb, name, kind, value);
+    int slot, rc;
+
+    if (n>=1 && strcmp(verb, "list")==0) {
+        uint64_t running = Session_Running();
+        for (int i=0;i<SESSION_MAX;i++) {
+            if (running & (1ULL << i)) {
+                Session_Describe(i, file, sizeof(file));
+                Ctl_Printf(out, "%s\n", file);
+            }
+        }
+        return 0;
     }
-    else {
+    if (n>=2 && strcmp(verb, "start")==0) {
+        if (n==2) {
+            slot = Session_Start(name, fuse_get_context()->pid, NULL);
+        }
+        else if (n==4 && strcmp(kind, "pid")==0) {
+            slot = Session_Start(name, atoi(value), NULL);
+        }
+        else if (n==4 && strcmp(kind, "cgroup")==0) {
+            slot = Session_Start(name, 0, value);
+        }
+        else {
+            slot = -EINVAL;
+        }
+        if (slot<0) {
+            Ctl_Printf(out, "Can't start session %s: %s\n", name, strerror(-slot));
+            return slot;
+        }
+        Session_Describe(slot, file, sizeof(file));
+        fprintf(stderr, "Session started: %s\n", file);
+        return 0;
+    }
+    if (n==2 && strcmp(verb, "end")==0) {
+        slot = Session_End(name);
+        if (slot<0) {
+            Ctl_Printf(out, "No session %s\n", name);
+            return slot;
+        }
+        rc = Write_Subset(SUBSET_SESSION, slot, file, sizeof(file));
+        if (rc!=0) {
+            Ctl_Printf(out, "Can't write %s: %s\n", file, strerror(-rc));
+            return rc;
+        }
+        Ctl_Printf(out, "%s\n", file);
         return 0;
     }
+    Ctl_Printf(out, "Usage: session start NAME [pid PID | cgroup PATH], session end NAME, session list\n");
+    return -EINVAL;
 }
 
-static char *getRelativePath(const char *path) {
-    if (path[0] == '/') {
-        if (strlen(path) == 1) {
-            return strdup(".");
+static int Ctl_Command(const char *cmd, ctl_buf_t *out) {
+
+    if (strcmp(cmd, "help")==0) {
+        Ctl_Printf(out, "Commands (write one per line):\n"
+                        "  snapshot   write a snapshot of the table now\n"
+                        "  pause      stop recording operations\n"
+                        "  resume     record operations again\n"
+                        "  reset      drop all recorded entries\n"
+                        "  reload     re-read [filter], [exclude] and [include_only]\n");
+        if (sessions_enabled) {
+            Ctl_Printf(out, "  session start NAME [pid PID | cgroup PATH]\n"
+                            "             record the paths used by PID's process tree (default:\n"
+                            "             the writer's) or by a cgroup separately as well\n"
+                            "  session end NAME\n"
+                            "             write the session's paths to <log>.session.NAME\n"
+                            "  session list\n");
         }
-        const char *substr = &path[1];
-        return strdup(substr);
+        if (phases_enabled) {
+            Ctl_Printf(out, "  phase start NAME, phase stop NAME\n"
+                            "             tag accesses with NAME while it is active; with no\n"
+                            "             phase active nothing is recorded\n"
+                            "  phase switch NAME\n"
+                            "             stop every other phase and start NAME\n"
+                            "  phase list\n");
+        }
+        Ctl_Printf(out, "State: %s\n", __atomic_load_n(&recording_paused, __ATOMIC_RELAXED) ? "paused" : "recording");
+        return 0;
     }
-    return strdup(path);
+    fprintf(stderr, "Control: %s\n", cmd);
+    if (strcmp(cmd, "snapshot")==0) {
+        char name[PATH_MAX];
+        int rc = Write_Snapshot(name, sizeof(name));
+        if (rc!=0) {
+            fprintf(stderr, "Snapshot failed: %s\n", strerror(-rc));
+            return rc;
+        }
+        Ctl_Printf(out, "%s\n", name);
+        return 0;
+    }
+    if (strcmp(cmd, "pause")==0 || strcmp(cmd, "resume")==0) {
+        pthread_mutex_lock(&gate_lock);
+        user_paused = cmd[0]=='p';
+        pthread_mutex_unlock(&gate_lock);
+        Update_Recording();
+        return 0;
+    }
+    if (strcmp(cmd, "reset")==0) {
+        Reset_Hash();
+        return 0;
+    }
+    if (strcmp(cmd, "reload")==0) {
+        return Reload_Config(out);
+    }
+    if (strncmp(cmd, "session ", 8)==0 && sessions_enabled) {
+        return Ctl_Session(cmd + 8, out);
+    }
+    if (strncmp(cmd, "phase ", 6)==0 && phases_enabled) {
+        return Ctl_Phase(cmd + 6, out);
+    }
+    Ctl_Printf(out, "Unknown command: %s\n", cmd);
+    return -EINVAL;
 }
 
 static void *loggedFS_init(struct fuse_conn_info *info) {
     fchdir(savefd);
     close(savefd);
+    // Background threads don't survive the daemon fork, start them here
+    if (Journal_Start()!=0) {
+        fprintf(stderr, "Can't start journal writer\n");
+    }
+    if (Slowlog_Start()!=0) {
+        fprintf(stderr, "Can't start slow operation log writer\n");
+    }
+    if (Trace_Start()!=0) {
+        fprintf(stderr, "Can't start trace writer\n");
+    }
+    Start_Timeline();
+    Start_Shm();
+    Start_Service();
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
     return NULL;
 }
 
 static int loggedFS_getattr(const char *orig_path, struct stat *stbuf) {
     int res;
+    unsigned gen = 0;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Getattr(orig_path, stbuf);
+    }
+
+    // Include path probing: answer known misses without touching the disk
+    if (NegCache_Lookup(orig_path, &gen) == 1) {
+        if (should_log(OP_GETATTR, LOG_UNSUCCESS) == 1) {
+            Store_In_Hash(h, g_filter, orig_path, FLAG_GETATTR, LOG_UNSUCCESS);
+        }
+        return -ENOENT;
+    }
 
     char *path = getRelativePath(orig_path);
     res = lstat(path, stbuf);
     free(path);
     if (res == -1) {
+        res = -errno;
+        if (res == -ENOENT) {
+            NegCache_Insert(orig_path, gen);
+        }
         if (should_log(OP_GETATTR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_GETATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_GETATTR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_GETATTR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_GETATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_GETATTR, LOG_SUCCESS);
         }
     }
 
@@ -335,18 +1831,23 @@ static int loggedFS_getattr(const char *orig_path, struct stat *stbuf) {
 static int loggedFS_access(const char *orig_path, int mask) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Access(orig_path, mask);
+    }
+
     char *path = getRelativePath(orig_path);
     res = access(path, mask);
     free(path);
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_ACCESS, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_ACCESS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_ACCESS, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_ACCESS, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_ACCESS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_ACCESS, LOG_SUCCESS);
         }
     }
 
@@ -356,19 +1857,24 @@ static int loggedFS_access(const char *orig_path, int mask) {
 static int loggedFS_readlink(const char *orig_path, char *buf, size_t size) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return -EINVAL;
+    }
+
     char *path = getRelativePath(orig_path);
     res = readlink(path, buf, size - 1);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_READLINK, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_READLINK);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READLINK, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_READLINK, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_READLINK);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READLINK, LOG_SUCCESS);
         }
     }
     buf[res] = '\0';
@@ -380,36 +1886,68 @@ static int loggedFS_readdir(const char *orig_path, void *buf, fuse_fill_dir_t fi
                             off_t offset, struct fuse_file_info *fi) {
     DIR *dp;
     struct dirent *de;
+    struct stat st;
+    dir_listing_t *dl;
+    dir_builder_t *builder;
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Readdir(orig_path, buf, filler);
+    }
+
     (void)offset;
     (void)fi;
 
     char *path = getRelativePath(orig_path);
+
+    // Unchanged directory: fill straight from the packed listing
+    dl = DirCache_Get(orig_path, path, &st);
+    if (dl != NULL) {
+        free(path);
+        memset(&st, 0, sizeof(st));
+        for (int i = 0; i < dl->count; i++) {
+            st.st_ino = dl->inos[i];
+            st.st_mode = dl->types[i] << 12;
+            if (filler(buf, dl->names + dl->name_off[i], &st, 0)) {
+                break;
+            }
+        }
+        DirCache_Release(dl);
+        if (should_log(OP_READDIR, LOG_SUCCESS) == 1) {
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READDIR, LOG_SUCCESS);
+        }
+        return 0;
+    }
+
     dp = opendir(path);
     if (dp == NULL) {
         res = -errno;
         free(path);
         if (should_log(OP_READDIR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_READDIR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READDIR, LOG_UNSUCCESS);
         }
         return res;
     }
 
+    builder = DirCache_Begin(orig_path, &st);
     while ((de = readdir(dp)) != NULL) {
-        struct stat st;
         memset(&st, 0, sizeof(st));
         st.st_ino = de->d_ino;
         st.st_mode = de->d_type << 12;
+        DirCache_Add(builder, de->d_ino, de->d_type, de->d_name);
         if (filler(buf, de->d_name, &st, 0)) {
+            // Incomplete listing must not be cached
+            DirCache_Abort(builder);
+            builder = NULL;
             break;
         }
     }
     closedir(dp);
     free(path);
+    DirCache_Commit(builder);
 
     if (should_log(OP_READDIR, LOG_SUCCESS) == 1) {
-        Store_In_Hash(h, g_filter, orig_path, FLAG_READDIR);
+        Store_In_Hash(h, g_filter, orig_path, FLAG_READDIR, LOG_SUCCESS);
     }
 
     return 0;
@@ -417,6 +1955,11 @@ static int loggedFS_readdir(const char *orig_path, void *buf, fuse_fill_dir_t fi
 
 static int loggedFS_mknod(const char *orig_path, mode_t mode, dev_t rdev) {
     int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
 
     if (S_ISREG(mode)) {
@@ -433,19 +1976,22 @@ static int loggedFS_mknod(const char *orig_path, mode_t mode, dev_t rdev) {
     }
 
     if (res == -1) {
+        res = -errno;
         free(path);
         if (should_log(OP_MKNOD, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_MKNOD);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_MKNOD, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         lchown(path, fuse_get_context()->uid, fuse_get_context()->gid);
+        NegCache_Invalidate(orig_path);
+        DirCache_Invalidate(orig_path);
     }
     free(path);
 
     if (should_log(OP_MKNOD, LOG_SUCCESS) == 1) {
-        Store_In_Hash(h, g_filter, orig_path, FLAG_MKNOD);
+        Store_In_Hash(h, g_filter, orig_path, FLAG_MKNOD, LOG_SUCCESS);
     }
 
     return 0;
@@ -453,22 +1999,30 @@ static int loggedFS_mknod(const char *orig_path, mode_t mode, dev_t rdev) {
 
 static int loggedFS_mkdir(const char *orig_path, mode_t mode) {
     int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = mkdir(path, mode);
     if (res == -1) {
+        res = -errno;
         free(path);
         if (should_log(OP_MKDIR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_MKDIR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_MKDIR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         lchown(path, fuse_get_context()->uid, fuse_get_context()->gid);
+        NegCache_Invalidate(orig_path);
+        DirCache_Invalidate(orig_path);
     }
     free(path);
 
     if (should_log(OP_MKDIR, LOG_SUCCESS) == 1) {
-        Store_In_Hash(h, g_filter, orig_path, FLAG_MKDIR);
+        Store_In_Hash(h, g_filter, orig_path, FLAG_MKDIR, LOG_SUCCESS);
     }
 
     return 0;
@@ -477,19 +2031,27 @@ static int loggedFS_mkdir(const char *orig_path, mode_t mode) {
 static int loggedFS_unlink(const char *orig_path) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = unlink(path);
     free(path);
+    if (res == 0) {
+        DirCache_Invalidate(orig_path);
+    }
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_UNLINK, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UNLINK);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UNLINK, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_UNLINK, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UNLINK);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UNLINK, LOG_SUCCESS);
         }
     }
 
@@ -499,19 +2061,28 @@ static int loggedFS_unlink(const char *orig_path) {
 static int loggedFS_rmdir(const char *orig_path)
 {
     int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = rmdir(path);
     free(path);
+    if (res == 0) {
+        DirCache_Invalidate(orig_path);
+    }
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_RMDIR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_RMDIR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_RMDIR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_RMDIR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_RMDIR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_RMDIR, LOG_SUCCESS);
         }
     }
     return 0;
@@ -520,22 +2091,29 @@ static int loggedFS_rmdir(const char *orig_path)
 static int loggedFS_symlink(const char *from, const char *orig_to) {
     int res;
 
+    if (Ctl_Is_Path(orig_to)) {
+        return -EPERM;
+    }
+
     char *to = getRelativePath(orig_to);
     res = symlink(from, to);
 
     if (res == -1) {
+        res = -errno;
         free(to);
         if (should_log(OP_SYMLINK, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_to, FLAG_SYMLINK);
-            Store_In_Hash(h, g_filter, from, FLAG_SYMLINK);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_SYMLINK, LOG_UNSUCCESS);
+            Store_In_Hash(h, g_filter, from, FLAG_SYMLINK, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         lchown(to, fuse_get_context()->uid, fuse_get_context()->gid);
+        NegCache_Invalidate(orig_to);
+        DirCache_Invalidate(orig_to);
         if (should_log(OP_SYMLINK, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_to, FLAG_SYMLINK);
-            Store_In_Hash(h, g_filter, from, FLAG_SYMLINK);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_SYMLINK, LOG_SUCCESS);
+            Store_In_Hash(h, g_filter, from, FLAG_SYMLINK, LOG_SUCCESS);
         }
     }
 
@@ -546,24 +2124,43 @@ static int loggedFS_symlink(const char *from, const char *orig_to) {
 static int loggedFS_rename(const char *orig_from, const char *orig_to) {
     int res;
 
+    if (Ctl_Is_Path(orig_from) || Ctl_Is_Path(orig_to)) {
+        return -EPERM;
+    }
+
     char *from = getRelativePath(orig_from);
     char *to = getRelativePath(orig_to);
+    struct stat st;
     res = rename(from, to);
+    if (res == 0) {
+        DirCache_Invalidate(orig_from);
+        DirCache_Invalidate(orig_to);
+        // A moved directory carries its whole subtree to a new prefix
+        if (lstat(to, &st) == 0 && S_ISDIR(st.st_mode)) {
+            NegCache_InvalidateAll();
+        }
+        else {
+            NegCache_Invalidate(orig_to);
+        }
+    }
+    else {
+        res = -errno;
+    }
 
     free(from);
     free(to);
 
-    if (res == -1) {
+    if (res != 0) {
         if (should_log(OP_RENAME, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_from, FLAG_RENAME);
-            Store_In_Hash(h, g_filter, orig_to, FLAG_RENAME);
+            Store_In_Hash(h, g_filter, orig_from, FLAG_RENAME, LOG_UNSUCCESS);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_RENAME, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_RENAME, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_from, FLAG_RENAME);
-            Store_In_Hash(h, g_filter, orig_to, FLAG_RENAME);
+            Store_In_Hash(h, g_filter, orig_from, FLAG_RENAME, LOG_SUCCESS);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_RENAME, LOG_SUCCESS);
         }
     }
 
@@ -573,6 +2170,10 @@ static int loggedFS_rename(const char *orig_from, const char *orig_to) {
 static int loggedFS_link(const char *orig_from, const char *orig_to) {
     int res;
 
+    if (Ctl_Is_Path(orig_from) || Ctl_Is_Path(orig_to)) {
+        return -EPERM;
+    }
+
     char *from = getRelativePath(orig_from);
     char *to = getRelativePath(orig_to);
 
@@ -580,18 +2181,21 @@ static int loggedFS_link(const char *orig_from, const char *orig_to) {
     free(from);
 
     if (res == -1) {
+        res = -errno;
         free(to);
         if (should_log(OP_LINK, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_from, FLAG_LINK);
-            Store_In_Hash(h, g_filter, orig_to, FLAG_LINK);
+            Store_In_Hash(h, g_filter, orig_from, FLAG_LINK, LOG_UNSUCCESS);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_LINK, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         lchown(to, fuse_get_context()->uid, fuse_get_context()->gid);
+        NegCache_Invalidate(orig_to);
+        DirCache_Invalidate(orig_to);
         if (should_log(OP_LINK, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_from, FLAG_LINK);
-            Store_In_Hash(h, g_filter, orig_to, FLAG_LINK);
+            Store_In_Hash(h, g_filter, orig_from, FLAG_LINK, LOG_SUCCESS);
+            Store_In_Hash(h, g_filter, orig_to, FLAG_LINK, LOG_SUCCESS);
         }
     }
 
@@ -603,19 +2207,24 @@ static int loggedFS_link(const char *orig_from, const char *orig_to) {
 static int loggedFS_chmod(const char *orig_path, mode_t mode) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = chmod(path, mode);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_CHMOD, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_CHMOD);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_CHMOD, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_CHMOD, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_CHMOD);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_CHMOD, LOG_SUCCESS);
         }
     }
 
@@ -625,19 +2234,24 @@ static int loggedFS_chmod(const char *orig_path, mode_t mode) {
 static int loggedFS_chown(const char *orig_path, uid_t uid, gid_t gid) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = lchown(path, uid, gid);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_CHOWN, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_CHOWN);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_CHOWN, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_CHOWN, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_CHOWN);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_CHOWN, LOG_SUCCESS);
         }
     }
 
@@ -647,19 +2261,24 @@ static int loggedFS_chown(const char *orig_path, uid_t uid, gid_t gid) {
 static int loggedFS_truncate(const char *orig_path, off_t size) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Truncate(orig_path);
+    }
+
     char *path = getRelativePath(orig_path);
     res = truncate(path, size);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_TRUNCATE, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_TRUNCATE);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_TRUNCATE, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_TRUNCATE, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_TRUNCATE);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_TRUNCATE, LOG_SUCCESS);
         }
     }
 
@@ -669,19 +2288,25 @@ static int loggedFS_truncate(const char *orig_path, off_t size) {
 #if (FUSE_USE_VERSION == 25)
 static int loggedFS_utime(const char *orig_path, struct utimbuf *buf) {
     int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = utime(path, buf);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_UTIME, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIME);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIME, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_UTIME, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIME);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIME, LOG_SUCCESS);
         }
     }
 
@@ -693,19 +2318,24 @@ static int loggedFS_utime(const char *orig_path, struct utimbuf *buf) {
 static int loggedFS_utimens(const char *orig_path, const struct timespec ts[2]) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return -EPERM;
+    }
+
     char *path = getRelativePath(orig_path);
     res = utimensat(AT_FDCWD, path, ts, AT_SYMLINK_NOFOLLOW);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_UTIMENS, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIMENS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIMENS, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_UTIMENS, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIMENS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_UTIMENS, LOG_SUCCESS);
         }
     }
     return 0;
@@ -715,19 +2345,25 @@ static int loggedFS_utimens(const char *orig_path, const struct timespec ts[2])
 
 static int loggedFS_open(const char *orig_path, struct fuse_file_info *fi) {
     int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Open(orig_path, fi);
+    }
+
     char *path = getRelativePath(orig_path);
     res = open(path, fi->flags);
     free(path);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_OPEN, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_OPEN);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_OPEN, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_OPEN, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_OPEN);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_OPEN, LOG_SUCCESS);
         }
     }
 
@@ -737,18 +2373,23 @@ static int loggedFS_open(const char *orig_path, struct fuse_file_info *fi) {
 
 static int loggedFS_read(const char *orig_path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Read(buf, size, offset, fi);
+    }
+
     int res;
     res = pread(fi->fh, buf, size, offset);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_READ, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_READ);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READ, LOG_UNSUCCESS);
         }
-        res = -errno;
     }
     else {
         if (should_log(OP_READ, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_READ);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_READ, LOG_SUCCESS);
+            Store_Extent(orig_path, EXT_READ, offset, res);
         }
     }
 
@@ -760,15 +2401,20 @@ static int loggedFS_write(const char *orig_path, const char *buf, size_t size,
     int fd;
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Write(buf, size, fi);
+    }
+
     char *path = getRelativePath(orig_path);
     (void)fi;
 
     fd = open(path, O_WRONLY);
     if (fd == -1) {
+        res = -errno;
+        free(path);
         if (should_log(OP_WRITE, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE, LOG_UNSUCCESS);
         }
-        res = -errno;
         return res;
     }
 
@@ -776,12 +2422,13 @@ static int loggedFS_write(const char *orig_path, const char *buf, size_t size,
     if (res == -1) {
         res = -errno;
         if (should_log(OP_WRITE, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE, LOG_UNSUCCESS);
         }
     }
     else {
         if (should_log(OP_WRITE, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_WRITE, LOG_SUCCESS);
+            Store_Extent(orig_path, EXT_WRITE, offset, res);
         }
     }
 
@@ -794,18 +2441,23 @@ static int loggedFS_write(const char *orig_path, const char *buf, size_t size,
 static int loggedFS_statfs(const char *orig_path, struct statvfs *stbuf) {
     int res;
 
+    if (Ctl_Is_Path(orig_path)) {
+        return statvfs(".", stbuf) == -1 ? -errno : 0;
+    }
+
     char *path = getRelativePath(orig_path);
     res = statvfs(path, stbuf);
     free(path);
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_STATFS, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_STATFS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_STATFS, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_STATFS, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_STATFS);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_STATFS, LOG_SUCCESS);
         }
     }
 
@@ -814,19 +2466,37 @@ static int loggedFS_statfs(const char *orig_path, struct statvfs *stbuf) {
 
 static int loggedFS_release(const char *orig_path, struct fuse_file_info *fi) {
 
+    if (Ctl_Is_Path(orig_path)) {
+        return Ctl_Release(fi);
+    }
+
     (void)orig_path;
-    Store_In_Hash(h, g_filter, orig_path, FLAG_RELEASE);
+    Stats_Op(OP_RELEASE, 1);
+    Store_In_Hash(h, g_filter, orig_path, FLAG_RELEASE, LOG_SUCCESS);
     close(fi->fh);
     return 0;
 }
 
 static int loggedFS_fsync(const char *orig_path, int isdatasync,
                           struct fuse_file_info *fi) {
-    (void)orig_path;
-    (void)isdatasync;
-    (void)fi;
+    int res;
+
+    if (Ctl_Is_Path(orig_path)) {
+        return 0;
+    }
 
-    Store_In_Hash(h, g_filter, orig_path, FLAG_FSYNC);
+    res = GroupSync_Fsync(fi->fh, isdatasync);
+    if (res != 0) {
+        if (should_log(OP_FSYNC, LOG_UNSUCCESS) == 1) {
+            Store_In_Hash(h, g_filter, orig_path, FLAG_FSYNC, LOG_UNSUCCESS);
+        }
+        return res;
+    }
+    else {
+        if (should_log(OP_FSYNC, LOG_SUCCESS) == 1) {
+            Store_In_Hash(h, g_filter, orig_path, FLAG_FSYNC, LOG_SUCCESS);
+        }
+    }
 
     return 0;
 }
@@ -835,17 +2505,23 @@ static int loggedFS_fsync(const char *orig_path, int isdatasync,
 /* xattr operations are optional and can safely be left unimplemented */
 static int loggedFS_setxattr(const char *orig_path, const char *name, const char *value,
                              size_t size, int flags) {
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -ENOTSUP;
+    }
+
     int res = lsetxattr(orig_path, name, value, size, flags);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_SETXATTR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_SETXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_SETXATTR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_SETXATTR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_SETXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_SETXATTR, LOG_SUCCESS);
         }
     }
     return 0;
@@ -853,50 +2529,68 @@ static int loggedFS_setxattr(const char *orig_path, const char *name, const char
 
 static int loggedFS_getxattr(const char *orig_path, const char *name, char *value,
                              size_t size) {
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -ENOTSUP;
+    }
+
     int res = lgetxattr(orig_path, name, value, size);
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_GETXATTR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_GETXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_GETXATTR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_GETXATTR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_GETXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_GETXATTR, LOG_SUCCESS);
         }
     }
     return res;
 }
 
 static int loggedFS_listxattr(const char *orig_path, char *list, size_t size) {
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -ENOTSUP;
+    }
+
     int res = llistxattr(orig_path, list, size);
 
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_LISTXATTR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_LISTXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_LISTXATTR, LOG_UNSUCCESS);
         }
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_LISTXATTR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_LISTXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_LISTXATTR, LOG_SUCCESS);
         }
     }
     return res;
 }
 
 static int loggedFS_removexattr(const char *orig_path, const char *name) {
+
+    if (Ctl_Is_Path(orig_path)) {
+        return -ENOTSUP;
+    }
+
     int res = lremovexattr(orig_path, name);
     if (res == -1) {
+        res = -errno;
         if (should_log(OP_REMOVEXATTR, LOG_UNSUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_REMOVEXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_REMOVEXATTR, LOG_UNSUCCESS);
         }
 
-        return -errno;
+        return res;
     }
     else {
         if (should_log(OP_REMOVEXATTR, LOG_SUCCESS) == 1) {
-            Store_In_Hash(h, g_filter, orig_path, FLAG_REMOVEXATTR);
+            Store_In_Hash(h, g_filter, orig_path, FLAG_REMOVEXATTR, LOG_SUCCESS);
         }
     }
     return 0;
@@ -906,7 +2600,7 @@ static int loggedFS_removexattr(const char *orig_path, const char *name) {
 static void usage(char *name)
 {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "%s [-h] | [-l log-file] [-c config-file] [-f] [-p] [-e] /directory-mountpoint\n", name);
+    fprintf(stderr, "%s [-h] | [-l log-file] [-b binlog-file] [-j journal-file] [-c config-file] [-f] [-p] [-e] /directory-mountpoint\n", name);
     fprintf(stderr, "Type 'man loggedfs' for more details\n");
     return;
 }
@@ -919,6 +2613,9 @@ static int processArgs(int argc, char *argv[], LoggedFS_Args *out)
 
     out->fuseArgc = 0;
     out->configFilename = NULL;
+    out->logFilename = NULL;
+    out->journalFilename = NULL;
+    out->binlogFilename = NULL;
 
     // pass executable name through
     out->fuseArgv[0] = argv[0];
@@ -934,7 +2631,7 @@ static int processArgs(int argc, char *argv[], LoggedFS_Args *out)
 
     int got_p = 0;
 
-    while ((res = getopt(argc, argv, "hpfec:l:")) != -1) {
+    while ((res = getopt(argc, argv, "hpfec:l:j:b:")) != -1) {
         switch (res)
         {
         case 'h':
@@ -969,6 +2666,14 @@ static int processArgs(int argc, char *argv[], LoggedFS_Args *out)
             out->logFilename = optarg;
             break;
         }
+        case 'j':
+            fprintf(stderr,"LoggedFS journal file : %s\n", optarg);
+            out->journalFilename = optarg;
+            break;
+        case 'b':
+            fprintf(stderr,"LoggedFS binary log file : %s\n", optarg);
+            out->binlogFilename = optarg;
+            break;
         default:
             break;
         }
@@ -1010,7 +2715,97 @@ static int processArgs(int argc, char *argv[], LoggedFS_Args *out)
     return 1;
 }
 
-void init_fuse_oper(struct fuse_operations *loggedFS_oper) {
+// Timing wrappers: the whole handler is timed, Store_In_Hash() adds its
+// own share to stats_record_ns, and the difference is the backing time.
+// PATH is the path an operation is recorded under.
+#define TIMED_OP(NAME, OP, PATH, PARAMS, ARGS)                \
+    static int timed_##NAME PARAMS {                          \
+        uint64_t t0 = Stats_Clock();                          \
+        int res = loggedFS_##NAME ARGS;                       \
+        uint64_t ns = Stats_Clock() - t0;                     \
+        uint64_t record_ns = Stats_Time(OP, ns);              \
+        if (Slowlog_Is_Slow(ns)) {                            \
+            Slowlog_Add(OP, PATH, res, ns, ns - record_ns);   \
+        }                                                     \
+        if (Trace_Wants(ns)) {                                \
+            Trace_Add(OP, PATH, res, t0, ns);                 \
+        }                                                     \
+        return res;                                           \
+    }
+
+TIMED_OP(getattr, OP_GETATTR, p, (const char *p, struct stat *st), (p, st))
+TIMED_OP(access, OP_ACCESS, p, (const char *p, int mask), (p, mask))
+TIMED_OP(readlink, OP_READLINK, p, (const char *p, char *buf, size_t size), (p, buf, size))
+TIMED_OP(readdir, OP_READDIR, p, (const char *p, void *buf, fuse_fill_dir_t filler, off_t off,
+                                  struct fuse_file_info *fi), (p, buf, filler, off, fi))
+TIMED_OP(mknod, OP_MKNOD, p, (const char *p, mode_t mode, dev_t rdev), (p, mode, rdev))
+TIMED_OP(mkdir, OP_MKDIR, p, (const char *p, mode_t mode), (p, mode))
+TIMED_OP(symlink, OP_SYMLINK, to, (const char *from, const char *to), (from, to))
+TIMED_OP(unlink, OP_UNLINK, p, (const char *p), (p))
+TIMED_OP(rmdir, OP_RMDIR, p, (const char *p), (p))
+TIMED_OP(rename, OP_RENAME, from, (const char *from, const char *to), (from, to))
+TIMED_OP(link, OP_LINK, from, (const char *from, const char *to), (from, to))
+TIMED_OP(chmod, OP_CHMOD, p, (const char *p, mode_t mode), (p, mode))
+TIMED_OP(chown, OP_CHOWN, p, (const char *p, uid_t uid, gid_t gid), (p, uid, gid))
+TIMED_OP(truncate, OP_TRUNCATE, p, (const char *p, off_t size), (p, size))
+#if (FUSE_USE_VERSION == 25)
+TIMED_OP(utime, OP_UTIME, p, (const char *p, struct utimbuf *buf), (p, buf))
+#else
+TIMED_OP(utimens, OP_UTIMENS, p, (const char *p, const struct timespec ts[2]), (p, ts))
+#endif
+TIMED_OP(open, OP_OPEN, p, (const char *p, struct fuse_file_info *fi), (p, fi))
+TIMED_OP(read, OP_READ, p, (const char *p, char *buf, size_t size, off_t off,
+                            struct fuse_file_info *fi), (p, buf, size, off, fi))
+TIMED_OP(write, OP_WRITE, p, (const char *p, const char *buf, size_t size, off_t off,
+                              struct fuse_file_info *fi), (p, buf, size, off, fi))
+TIMED_OP(statfs, OP_STATFS, p, (const char *p, struct statvfs *st), (p, st))
+TIMED_OP(release, OP_RELEASE, p, (const char *p, struct fuse_file_info *fi), (p, fi))
+TIMED_OP(fsync, OP_FSYNC, p, (const char *p, int isdatasync, struct fuse_file_info *fi), (p, isdatasync, fi))
+#ifdef HAVE_SETXATTR
+TIMED_OP(setxattr, OP_SETXATTR, p, (const char *p, const char *name, const char *value, size_t size,
+                                    int flags), (p, name, value, size, flags))
+TIMED_OP(getxattr, OP_GETXATTR, p, (const char *p, const char *name, char *value, size_t size),
+         (p, name, value, size))
+TIMED_OP(listxattr, OP_LISTXATTR, p, (const char *p, char *list, size_t size), (p, list, size))
+TIMED_OP(removexattr, OP_REMOVEXATTR, p, (const char *p, const char *name), (p, name))
+#endif
+
+// Swaps every handler for its timing wrapper
+static void time_fuse_oper(struct fuse_operations *loggedFS_oper) {
+    loggedFS_oper->getattr = timed_getattr;
+    loggedFS_oper->access = timed_access;
+    loggedFS_oper->readlink = timed_readlink;
+    loggedFS_oper->readdir = timed_readdir;
+    loggedFS_oper->mknod = timed_mknod;
+    loggedFS_oper->mkdir = timed_mkdir;
+    loggedFS_oper->symlink = timed_symlink;
+    loggedFS_oper->unlink = timed_unlink;
+    loggedFS_oper->rmdir = timed_rmdir;
+    loggedFS_oper->rename = timed_rename;
+    loggedFS_oper->link = timed_link;
+    loggedFS_oper->chmod = timed_chmod;
+    loggedFS_oper->chown = timed_chown;
+    loggedFS_oper->truncate = timed_truncate;
+#if (FUSE_USE_VERSION == 25)
+    loggedFS_oper->utime = timed_utime;
+#else
+    loggedFS_oper->utimens = timed_utimens;
+#endif
+    loggedFS_oper->open = timed_open;
+    loggedFS_oper->read = timed_read;
+    loggedFS_oper->write = timed_write;
+    loggedFS_oper->statfs = timed_statfs;
+    loggedFS_oper->release = timed_release;
+    loggedFS_oper->fsync = timed_fsync;
+#ifdef HAVE_SETXATTR
+    loggedFS_oper->setxattr = timed_setxattr;
+    loggedFS_oper->getxattr = timed_getxattr;
+    loggedFS_oper->listxattr = timed_listxattr;
+    loggedFS_oper->removexattr = timed_removexattr;
+#endif
+}
+
+void init_fuse_oper(struct fuse_operations *loggedFS_oper, int timed) {
     // in case this code is compiled against a newer FUSE library and new
     // members have been added to fuse_operations, make sure they get set to
     // 0..
@@ -1048,32 +2843,69 @@ void init_fuse_oper(struct fuse_operations *loggedFS_oper) {
     loggedFS_oper->listxattr = loggedFS_listxattr;
     loggedFS_oper->removexattr = loggedFS_removexattr;
 #endif
+    if (timed) {
+        time_fuse_oper(loggedFS_oper);
+    }
 }
 
-int parse_config(const char *config_file) {
-    int rc=0;
-    FILE* fp;
-    char errbuf[256];
-
-    fp = fopen(config_file, "r");
-    if (!fp) {
-        fprintf(stderr, "Config file not found!\n");
-        return rc;
+// Caller rules of [filter]: "uids", "gids", "commands", "pids" and
+// "cgroups" record only the callers listed, "exclude_..." all but them
+static int parse_callers(toml_table_t *ops, filter_desc_t *filter) {
+
+    static const char *keys[CALLER_KINDS] = { "uids", "gids", "commands", "pids", "cgroups" };
+    toml_datum_t ttl = toml_int_in(ops, "caller_ttl_ms");
+    char key[32], num[24];
+
+    for (int kind=0;kind<CALLER_KINDS;kind++) {
+        for (int exclude=0;exclude<2;exclude++) {
+            snprintf(key, sizeof(key), "%s%s", exclude ? "exclude_" : "", keys[kind]);
+            toml_array_t* values = toml_array_in(ops, key);
+            for (int i = 0; values!=NULL && i<toml_array_nelem(values); i++) {
+                toml_datum_t str = toml_string_at(values, i);
+                toml_datum_t id = toml_int_at(values, i);
+                const char *value = str.ok ? str.u.s : num;
+                if (!str.ok && !id.ok) {
+                    continue;
+                }
+                if (!str.ok) {
+                    snprintf(num, sizeof(num), "%" PRId64, id.u.i);
+                }
+                if (filter->callers==NULL) {
+                    filter->callers = Caller_New(ttl.ok ? (int)ttl.u.i : 100);
+                }
+                if (Caller_Add(filter->callers, kind, exclude, value)!=0) {
+                    fprintf(stderr, "Wrong value [%s] in [filter] %s\n", value, key);
+                    if (str.ok) {
+                        free(str.u.s);
+                    }
+                    return 3;
+                }
+                fprintf(stderr, "Caller filter: %s %s\n", key, value);
+                if (str.ok) {
+                    free(str.u.s);
+                }
+            }
+        }
     }
+    return 0;
+}
 
-    toml_table_t* conf = toml_parse_file(fp, errbuf, sizeof(errbuf));
-    toml_table_t* exclude = toml_table_in(conf, "exclude");
+// [exclude], [include_only] and [filter]; shared by startup and "reload"
+static int parse_filters(toml_table_t *conf, filter_desc_t *filter, int *flags) {
 
+    toml_table_t* exclude = toml_table_in(conf, "exclude");
     if (exclude!=NULL) {
          toml_array_t* path_array = toml_array_in(exclude, "paths");
          if (path_array!=NULL) {
-             g_filter->exclude_path_count = toml_array_nelem(path_array);
-             if (g_filter->exclude_path_count>0) {
-                 g_filter->exclude_path=malloc(g_filter->exclude_path_count*sizeof(char*));
-                 for (int i = 0; i<g_filter->exclude_path_count; i++) {
+             filter->exclude_path_count = toml_array_nelem(path_array);
+             if (filter->exclude_path_count>0) {
+                 filter->exclude_path=malloc(filter->exclude_path_count*sizeof(char*));
+                 filter->bytes += malloc_usable_size(filter->exclude_path);
+                 for (int i = 0; i<filter->exclude_path_count; i++) {
                      toml_datum_t path = toml_string_at(path_array, i);
                      if (path.ok>0) {
-                         g_filter->exclude_path[i]=strdup(path.u.s);
+                         filter->exclude_path[i]=strdup(path.u.s);
+                         filter->bytes += malloc_usable_size(filter->exclude_path[i]);
                          fprintf(stderr, "Exclude Path: %s\n", path.u.s);
                      }
                  }
@@ -1085,13 +2917,15 @@ int parse_config(const char *config_file) {
     if (include!=NULL) {
          toml_array_t* path_array = toml_array_in(include, "paths");
          if (path_array!=NULL) {
-             g_filter->include_path_count = toml_array_nelem(path_array);
-             if (g_filter->include_path_count>0) {
-                 g_filter->include_path=malloc(g_filter->include_path_count*sizeof(char*));
-                 for (int i = 0; i<g_filter->include_path_count; i++) {
+             filter->include_path_count = toml_array_nelem(path_array);
+             if (filter->include_path_count>0) {
+                 filter->include_path=malloc(filter->include_path_count*sizeof(char*));
+                 filter->bytes += malloc_usable_size(filter->include_path);
+                 for (int i = 0; i<filter->include_path_count; i++) {
                      toml_datum_t path = toml_string_at(path_array, i);
                      if (path.ok>0) {
-                         g_filter->include_path[i]=strdup(path.u.s);
+                         filter->include_path[i]=strdup(path.u.s);
+                         filter->bytes += malloc_usable_size(filter->include_path[i]);
                          fprintf(stderr, "Include Path: %s\n", path.u.s);
                      }
                  }
@@ -1099,30 +2933,299 @@ int parse_config(const char *config_file) {
          }
     }
 
-
-    toml_table_t* filter = toml_table_in(conf, "filter");
-    for (int i=0;i<QN_FLAGS;i++) {
-        toml_datum_t filter_value = toml_string_in(filter, op_names[i]);
+    toml_table_t* ops = toml_table_in(conf, "filter");
+    if (ops!=NULL && parse_callers(ops, filter)!=0) {
+        return 3;
+    }
+    for (int i=0;ops!=NULL && i<QN_FLAGS;i++) {
+        toml_datum_t filter_value = toml_string_in(ops, op_names[i]);
         if (filter_value.ok) {
             if (strcmp(filter_value.u.s, "success")==0) {
-                op_flags[i]=LOG_SUCCESS;
+                flags[i]=LOG_SUCCESS;
             }
             else if (strcmp(filter_value.u.s, "unsuccess")==0) {
-                op_flags[i]=LOG_UNSUCCESS;
+                flags[i]=LOG_UNSUCCESS;
             }
             else if (strcmp(filter_value.u.s, "all")==0) {
-                op_flags[i]= LOG_UNSUCCESS | LOG_UNSUCCESS;
+                flags[i]= LOG_SUCCESS | LOG_UNSUCCESS;
             }
             else if (strcmp(filter_value.u.s, "never")==0) {
-                op_flags[i]=0;
+                flags[i]=0;
             }
             else {
                 fprintf(stderr, "Wrong value [%s] for operation: [%s]\n", filter_value.u.s, op_names[i]);
-                rc=3;
-                goto close;
+                return 3;
+            }
+        }
+    }
+    return 0;
+}
+
+int parse_config(const char *config_file) {
+    int rc=0;
+    FILE* fp;
+    char errbuf[256];
+
+    fp = fopen(config_file, "r");
+    if (!fp) {
+        fprintf(stderr, "Config file not found!\n");
+        return rc;
+    }
+
+    toml_table_t* conf = toml_parse_file(fp, errbuf, sizeof(errbuf));
+    rc = parse_filters(conf, g_filter, op_flags);
+    if (rc!=0) {
+        goto close;
+    }
+
+    toml_table_t* cache = toml_table_in(conf, "cache");
+    if (cache!=NULL) {
+        toml_datum_t enabled = toml_bool_in(cache, "negative_lookup");
+        toml_datum_t ttl = toml_int_in(cache, "negative_ttl_ms");
+        toml_datum_t max_names = toml_int_in(cache, "negative_max_names");
+        NegCache_Init(enabled.ok ? enabled.u.b : 0,
+                      ttl.ok ? (int)ttl.u.i : 1000,
+                      max_names.ok ? (int)max_names.u.i : 262144);
+        if (enabled.ok && enabled.u.b) {
+            fprintf(stderr, "Negative lookup cache: ttl %d ms\n", ttl.ok ? (int)ttl.u.i : 1000);
+        }
+
+        toml_datum_t readdir_on = toml_bool_in(cache, "readdir");
+        toml_datum_t max_mb = toml_int_in(cache, "readdir_max_mb");
+        DirCache_Init(readdir_on.ok ? readdir_on.u.b : 0, max_mb.ok ? (int)max_mb.u.i : 64);
+        if (readdir_on.ok && readdir_on.u.b) {
+            fprintf(stderr, "Readdir cache: %d MB\n", max_mb.ok ? (int)max_mb.u.i : 64);
+        }
+    }
+
+    toml_table_t* sync = toml_table_in(conf, "fsync");
+    if (sync!=NULL) {
+        toml_datum_t window = toml_int_in(sync, "group_window_us");
+        toml_datum_t threshold = toml_int_in(sync, "syncfs_threshold");
+        GroupSync_Init(window.ok ? (int)window.u.i : 200, threshold.ok ? (int)threshold.u.i : 8);
+        fprintf(stderr, "Fsync group window: %d us\n", window.ok ? (int)window.u.i : 200);
+    }
+
+    toml_table_t* snapshot = toml_table_in(conf, "snapshot");
+    if (snapshot!=NULL) {
+        toml_datum_t path = toml_string_in(snapshot, "path");
+        if (path.ok) {
+            snapshot_base = path.u.s;
+        }
+    }
+
+    toml_table_t* journal = toml_table_in(conf, "journal");
+    if (journal!=NULL) {
+        toml_datum_t ring_kb = toml_int_in(journal, "ring_kb");
+        if (ring_kb.ok) {
+            journal_ring_kb = (int)ring_kb.u.i;
+        }
+    }
+
+    toml_table_t* output = toml_table_in(conf, "output");
+    if (output!=NULL) {
+        toml_datum_t threads = toml_int_in(output, "dump_threads");
+        if (threads.ok) {
+            dump_threads = (int)threads.u.i;
+        }
+        toml_datum_t level = toml_int_in(output, "compression_level");
+        if (level.ok) {
+            compression_level = (int)level.u.i;
+        }
+        toml_datum_t sort = toml_string_in(output, "sort");
+        if (sort.ok) {
+            if (strcmp(sort.u.s, "path")==0) {
+                sort_output = DUMP_SORT_PATH;
+            }
+            else if (strcmp(sort.u.s, "first")==0) {
+                sort_output = DUMP_SORT_FIRST;
+            }
+            else if (strcmp(sort.u.s, "none")!=0) {
+                fprintf(stderr, "Unknown [output] sort value '%s', using none\n", sort.u.s);
+            }
+        }
+        toml_array_t* columns = toml_array_in(output, "columns");
+        if (columns!=NULL) {
+            output_columns = calloc(1, sizeof(dump_columns_t));
+            for (int i = 0; i < toml_array_nelem(columns); i++) {
+                toml_datum_t name = toml_string_at(columns, i);
+                int col;
+                if (!name.ok) {
+                    continue;
+                }
+                // the path always ends the line
+                if (strcmp(name.u.s, "path")==0) {
+                    free(name.u.s);
+                    continue;
+                }
+                if (Dump_Column(name.u.s, &col)!=0) {
+                    fprintf(stderr, "Unknown [output] column '%s', ignored\n", name.u.s);
+                }
+                else if (Dump_Has_Column(output_columns, col)) {
+                    fprintf(stderr, "Repeated [output] column '%s', ignored\n", name.u.s);
+                }
+                else if (output_columns->n < DUMP_MAX_COLUMNS) {
+                    output_columns->col[output_columns->n++] = col;
+                }
+                free(name.u.s);
+            }
+            entry_times = Dump_Needs_Times(output_columns);
+            entry_attrib = Dump_Needs_Procs(output_columns);
+        }
+    }
+
+    toml_table_t* sessions = toml_table_in(conf, "sessions");
+    if (sessions!=NULL) {
+        toml_datum_t enabled = toml_bool_in(sessions, "enabled");
+        toml_datum_t ttl = toml_int_in(sessions, "ttl_ms");
+        if (enabled.ok) {
+            sessions_enabled = enabled.u.b;
+        }
+        if (ttl.ok) {
+            sessions_ttl_ms = ttl.u.i < 0 ? 0 : (int)ttl.u.i;
+        }
+    }
+
+    toml_table_t* phases = toml_table_in(conf, "phases");
+    if (phases!=NULL) {
+        toml_datum_t enabled = toml_bool_in(phases, "enabled");
+        toml_datum_t start = toml_string_in(phases, "start");
+        if (enabled.ok) {
+            phases_enabled = enabled.u.b;
+        }
+        if (start.ok) {
+            free(initial_phase);
+            initial_phase = start.u.s;
+        }
+    }
+
+    toml_table_t* attribution = toml_table_in(conf, "attribution");
+    if (attribution!=NULL) {
+        toml_array_t* roots = toml_array_in(attribution, "roots");
+        toml_datum_t depth = toml_int_in(attribution, "depth");
+        toml_datum_t ttl = toml_int_in(attribution, "ttl_ms");
+        if (roots!=NULL) {
+            attrib_roots = malloc((toml_array_nelem(roots) + 1)*sizeof(char *));
+            for (int i = 0; i < toml_array_nelem(roots); i++) {
+                toml_datum_t name = toml_string_at(roots, i);
+                if (name.ok) {
+                    attrib_roots[attrib_n_roots++] = name.u.s;
+                }
             }
         }
+        if (depth.ok) {
+            attrib_depth = (int)depth.u.i;
+        }
+        if (ttl.ok) {
+            attrib_ttl_ms = ttl.u.i < 0 ? 0 : (int)ttl.u.i;
+        }
+    }
+
+    toml_table_t* stats = toml_table_in(conf, "stats");
+    if (stats!=NULL) {
+        toml_datum_t latency = toml_bool_in(stats, "latency");
+        if (latency.ok) {
+            latency_enabled = latency.u.b;
+        }
+    }
+
+    toml_table_t* slowlog = toml_table_in(conf, "slowlog");
+    if (slowlog!=NULL) {
+        toml_datum_t path = toml_string_in(slowlog, "path");
+        toml_datum_t threshold = toml_int_in(slowlog, "threshold_ms");
+        toml_datum_t max_kb = toml_int_in(slowlog, "max_kb");
+        if (path.ok) {
+            slowlog_file = path.u.s;
+        }
+        if (threshold.ok) {
+            slowlog_threshold_ms = (int)threshold.u.i;
+        }
+        if (max_kb.ok) {
+            slowlog_max_kb = (int)max_kb.u.i;
+        }
+    }
+
+    toml_table_t* timeline = toml_table_in(conf, "timeline");
+    if (timeline!=NULL) {
+        toml_datum_t interval = toml_int_in(timeline, "interval_ms");
+        toml_datum_t path = toml_string_in(timeline, "path");
+        if (interval.ok) {
+            timeline_ms = interval.u.i < 10 ? 10 : (int)interval.u.i;
+        }
+        if (path.ok) {
+            timeline_file = path.u.s;
+        }
+    }
+
+    toml_table_t* trace = toml_table_in(conf, "trace");
+    if (trace!=NULL) {
+        toml_datum_t path = toml_string_in(trace, "path");
+        toml_datum_t sample = toml_int_in(trace, "sample");
+        toml_datum_t slow_ms = toml_int_in(trace, "slow_ms");
+        if (path.ok) {
+            trace_file = path.u.s;
+        }
+        if (sample.ok) {
+            trace_every = (int)sample.u.i;
+        }
+        if (slow_ms.ok) {
+            trace_slow_ms = (int)slow_ms.u.i;
+        }
+    }
+
+    toml_table_t* shm = toml_table_in(conf, "shm");
+    if (shm!=NULL) {
+        toml_datum_t enabled = toml_bool_in(shm, "enabled");
+        toml_datum_t interval = toml_int_in(shm, "interval_ms");
+        if (enabled.ok) {
+            shm_enabled = enabled.u.b;
+        }
+        if (interval.ok) {
+            shm_interval_ms = interval.u.i < 10 ? 10 : (int)interval.u.i;
+        }
+    }
+
+    toml_table_t* extents = toml_table_in(conf, "extents");
+    if (extents!=NULL) {
+        toml_datum_t enabled = toml_bool_in(extents, "enabled");
+        toml_datum_t granularity = toml_int_in(extents, "granularity");
+        if (enabled.ok) {
+            extents_enabled = enabled.u.b;
+        }
+        if (granularity.ok) {
+            extents_granularity = granularity.u.i < 1 ? 1 : (int)granularity.u.i;
+        }
+    }
+
+    toml_table_t* prometheus = toml_table_in(conf, "prometheus");
+    if (prometheus!=NULL) {
+        toml_datum_t path = toml_string_in(prometheus, "path");
+        toml_datum_t interval = toml_int_in(prometheus, "interval_ms");
+        if (path.ok) {
+            prom_file = path.u.s;
+        }
+        if (interval.ok) {
+            prom_interval_ms = interval.u.i < 10 ? 10 : (int)interval.u.i;
+        }
+    }
+
+    toml_table_t* limits = toml_table_in(conf, "limits");
+    if (limits!=NULL) {
+        toml_datum_t memory_mb = toml_int_in(limits, "memory_mb");
+        if (memory_mb.ok && memory_mb.u.i > 0) {
+            memory_limit = (size_t)memory_mb.u.i*1024*1024;
+            fprintf(stderr, "Memory soft limit: %d MB\n", (int)memory_mb.u.i);
+        }
+    }
+
+    toml_table_t* control = toml_table_in(conf, "control");
+    if (control!=NULL) {
+        toml_datum_t enabled = toml_bool_in(control, "enabled");
+        if (enabled.ok) {
+            control_enabled = enabled.u.b;
+        }
     }
+
 close:
     toml_free(conf);
     fclose(fp);
@@ -1130,19 +3233,70 @@ close:
 }
 
 
+// "reload" from the control interface: builds a new filter and swaps it
+// in. Operations in flight may still use the old one, so it is not freed
+// (reloads are rare and filters small).
+static int Reload_Config(ctl_buf_t *out) {
+
+    filter_desc_t *filter;
+    int flags[QN_FLAGS];
+    char errbuf[256];
+    FILE *fp;
+    int rc;
+
+    if (loggedfsArgs->configFilename==NULL) {
+        Ctl_Printf(out, "No configuration file (-c) to reload\n");
+        return -ENOENT;
+    }
+    fp = fopen(loggedfsArgs->configFilename, "r");
+    if (fp==NULL) {
+        rc = -errno;
+        Ctl_Printf(out, "Can't open %s: %s\n", loggedfsArgs->configFilename, strerror(-rc));
+        return rc;
+    }
+    toml_table_t* conf = toml_parse_file(fp, errbuf, sizeof(errbuf));
+    fclose(fp);
+    if (conf==NULL) {
+        Ctl_Printf(out, "%s: %s\n", loggedfsArgs->configFilename, errbuf);
+        return -EINVAL;
+    }
+
+    for (int i=0;i<QN_FLAGS;i++) {
+        flags[i] = LOG_SUCCESS | LOG_UNSUCCESS;
+    }
+    filter = calloc(1, sizeof(filter_desc_t));
+    rc = parse_filters(conf, filter, flags);
+    toml_free(conf);
+    if (rc!=0) {
+        Ctl_Printf(out, "Invalid [filter] section, configuration not changed\n");
+        Caller_Free(filter->callers);
+        free(filter);
+        return -EINVAL;
+    }
+
+    for (int i=0;i<QN_FLAGS;i++) {
+        __atomic_store_n(&op_flags[i], flags[i], __ATOMIC_RELAXED);
+    }
+    filter->bytes += malloc_usable_size(filter);
+    __atomic_add_fetch(&retired_filter_bytes, g_filter->bytes + Caller_Bytes(g_filter->callers), __ATOMIC_RELAXED);
+    __atomic_store_n(&g_filter, filter, __ATOMIC_RELEASE);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
     struct fuse_operations loggedFS_oper;
 
     h = Hash_New(32);
+    op_spill = kh_init(spill);
     loggedfsArgs = (LoggedFS_Args *) malloc(sizeof(LoggedFS_Args));
 
     umask(0);
-    init_fuse_oper(&loggedFS_oper);
 
     for (int i=0;i<QN_FLAGS;i++) {
         op_flags[i]= LOG_SUCCESS | LOG_UNSUCCESS;
     }
+    GroupSync_Init(200, 8);
 
     for (int i = 0; i < MaxFuseArgs; ++i) {
         loggedfsArgs->fuseArgv[i] = NULL; // libfuse expects null args..
@@ -1153,9 +3307,130 @@ int main(int argc, char *argv[]) {
             loggerId = "syslog";
         }
 
+        g_filter=(filter_desc_t*) malloc(sizeof(filter_desc_t));
+        memset(g_filter,0, sizeof(filter_desc_t));
+        g_filter->bytes = malloc_usable_size(g_filter);
+
+        if (loggedfsArgs->configFilename!=NULL) {
+            int rc=parse_config(loggedfsArgs->configFilename);         // this function modify g_filter & op_flags
+            if (rc!=0) {
+                return rc;
+            }
+        }
+
+        if (loggedfsArgs->journalFilename!=NULL) {
+            int rc=Journal_Open(loggedfsArgs->journalFilename, op_flags, QN_FLAGS,
+                                loggedfsArgs->mountPoint, journal_ring_kb);
+            if (rc!=0) {
+                fprintf(stderr, "Can't open journal %s: %s\n", loggedfsArgs->journalFilename, strerror(-rc));
+                return 4;
+            }
+        }
+
+        if (slowlog_file!=NULL) {
+            // Rotation reopens the file by name after chdir() into the mount
+            slowlog_file = absolute_path(slowlog_file);
+            int rc=Slowlog_Open(slowlog_file, slowlog_threshold_ms, slowlog_max_kb, op_names);
+            if (rc!=0) {
+                fprintf(stderr, "Can't open slow operation log %s: %s\n", slowlog_file, strerror(-rc));
+                return 4;
+            }
+            fprintf(stderr, "Slow operation log: %s, over %d ms\n", slowlog_file, slowlog_threshold_ms);
+        }
+
+        // The timeline goes next to the log unless [timeline] names a file
+        if (timeline_ms>0) {
+            char *name = timeline_file;
+            if (name==NULL) {
+                const char *base = loggedfsArgs->logFilename!=NULL ? loggedfsArgs->logFilename : "distillerfs.log";
+                size_t len = strlen(base) - strlen(Sink_Suffix(Sink_Kind(base)));
+                name = malloc(len + sizeof(".timeline"));
+                sprintf(name, "%.*s.timeline", (int)len, base);
+            }
+            timeline_fp = fopen(name, "w");
+            if (timeline_fp==NULL) {
+                fprintf(stderr, "Can't create timeline %s: %s\n", name, strerror(errno));
+                return 4;
+            }
+            fprintf(stderr, "Timeline: %s, every %d ms\n", name, timeline_ms);
+        }
+
+        if (trace_file!=NULL) {
+            int rc=Trace_Open(trace_file, trace_every, trace_slow_ms, op_names);
+            if (rc!=0) {
+                fprintf(stderr, "Can't create trace %s: %s\n", trace_file, strerror(-rc));
+                return 4;
+            }
+            fprintf(stderr, "Trace: %s, 1 in %d operations\n", trace_file, trace_every);
+        }
+
+        if (shm_enabled) {
+            Shmstat_Name(loggedfsArgs->mountPoint, shm_name, sizeof(shm_name));
+            shm_stats = Shmstat_Create(shm_name);
+            if (shm_stats==NULL) {
+                fprintf(stderr, "Can't create shared memory statistics %s: %s\n", shm_name, strerror(errno));
+                return 4;
+            }
+            strncpy(shm_stats->mount, loggedfsArgs->mountPoint, sizeof(shm_stats->mount) - 1);
+            shm_stats->qn_ops = QN_FLAGS;
+            shm_stats->n_mem = MEM_KINDS;
+            shm_stats->interval_ms = shm_interval_ms;
+            for (int i=0;i<QN_FLAGS && i<SHMSTAT_OPS;i++) {
+                strncpy(shm_stats->op_names[i], op_names[i], sizeof(shm_stats->op_names[i]) - 1);
+            }
+            for (int i=0;i<MEM_KINDS && i<SHMSTAT_MEM;i++) {
+                strncpy(shm_stats->mem_names[i], mem_names[i], sizeof(shm_stats->mem_names[i]) - 1);
+            }
+            fprintf(stderr, "Shared memory statistics: %s, every %d ms\n", shm_name, shm_interval_ms);
+        }
+
+        if (entry_attrib) {
+            static char *default_roots[] = { "ninja", "make" };
+            if (attrib_roots==NULL) {
+                attrib_roots = default_roots;
+                attrib_n_roots = 2;
+            }
+            Attrib_Init(attrib_roots, attrib_n_roots, attrib_depth, attrib_ttl_ms);
+            fprintf(stderr, "Process attribution: %d levels, /proc re-read after %d ms\n", attrib_depth, attrib_ttl_ms);
+        }
+
+        if (sessions_enabled) {
+            Session_Init(sessions_ttl_ms, Clear_Session);
+            fprintf(stderr, "Recording sessions: up to %d, started through %s/ctl\n", SESSION_MAX, CTL_DIR);
+        }
+        if (phases_enabled && initial_phase!=NULL && Phase_Start(initial_phase)<0) {
+            fprintf(stderr, "Invalid phase name: %s\n", initial_phase);
+            return 3;
+        }
+        if (phases_enabled) {
+            fprintf(stderr, "Recording phases: %s\n", initial_phase!=NULL ? initial_phase : "none until one is started");
+        }
+        Entry_Layout();
+        Update_Recording();
+
+        if (extents_enabled) {
+            Extent_Init(extents_granularity);
+            fprintf(stderr, "Extent maps: granularity %d bytes\n", extents_granularity);
+        }
+
+        // Handlers are timed for [stats] latency, the slow operation log and the trace
+        timing_enabled = latency_enabled || slowlog_file!=NULL || trace_file!=NULL;
+        init_fuse_oper(&loggedFS_oper, timing_enabled);
+
+        if (dump_threads<=0) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            dump_threads = cpus < 1 ? 1 : (cpus > 8 ? 8 : (int)cpus);
+        }
+
+        // The log is opened once [output] is known; its suffix selects compression
         if (loggedfsArgs->isDaemon==1) {
             if (loggedfsArgs->logFilename!=NULL) {
-                hash_log = fopen(loggedfsArgs->logFilename, "w");
+                hash_log = Sink_Open(loggedfsArgs->logFilename, Sink_Kind(loggedfsArgs->logFilename),
+                                     compression_level, dump_threads);
+                if (hash_log==NULL) {
+                    fprintf(stderr, "Can't open log file %s: %s\n", loggedfsArgs->logFilename, strerror(errno));
+                    return 4;
+                }
                 fprintf(stderr, "Log file: %s\n", loggedfsArgs->logFilename);
             }
             else {
@@ -1163,19 +3438,35 @@ int main(int argc, char *argv[]) {
             }
         }
         else {
-            hash_log = stderr;
+            hash_log = Sink_Fd(STDERR_FILENO);
         }
 
-
-        g_filter=(filter_desc_t*) malloc(sizeof(filter_desc_t));
-        memset(g_filter,0, sizeof(filter_desc_t));
-
-        if (loggedfsArgs->configFilename!=NULL) {
-            int rc=parse_config(loggedfsArgs->configFilename);         // this function modify g_filter & op_flags
-            if (rc!=0) {
-                return rc;
+        // The control interface reloads the configuration after chdir()
+        if (loggedfsArgs->configFilename!=NULL && loggedfsArgs->configFilename[0]!='/') {
+            char *abs_config = realpath(loggedfsArgs->configFilename, NULL);
+            if (abs_config!=NULL) {
+                loggedfsArgs->configFilename = abs_config;
             }
         }
+        if (control_enabled) {
+            ctl_ops_t ops = { Ctl_Stats, Ctl_Query, Ctl_Command };
+            Ctl_Init(1, &ops);
+        }
+
+        // Snapshots, metrics and the binary log are written after chdir() into
+        // the mount, so make names absolute while relative paths still mean
+        // what the user meant
+        if (snapshot_base==NULL) {
+            snapshot_base = loggedfsArgs->logFilename!=NULL ? loggedfsArgs->logFilename : "distillerfs.log";
+        }
+        snapshot_base = absolute_path(snapshot_base);
+        if (prom_file!=NULL) {
+            prom_file = absolute_path(prom_file);
+            fprintf(stderr, "Prometheus metrics: %s, every %d ms\n", prom_file, prom_interval_ms);
+        }
+        if (loggedfsArgs->binlogFilename!=NULL) {
+            loggedfsArgs->binlogFilename = absolute_path(loggedfsArgs->binlogFilename);
+        }
 
         fprintf(stderr, "LoggedFS starting at %s.\n", loggedfsArgs->mountPoint);
         fprintf(stderr, "Chdir to %s\n", loggedfsArgs->mountPoint);
@@ -1187,28 +3478,50 @@ int main(int argc, char *argv[]) {
 #else
         fuse_main(loggedfsArgs->fuseArgc, (char **)(loggedfsArgs->fuseArgv), &loggedFS_oper, NULL);
 #endif
-        fprintf(hash_log, "#### Hash size: [%d] ####\n", kh_size(h));
-        fprintf(hash_log, "#### Log mask/legend:\n#");
-
-        for (int i=0;i<QN_FLAGS;i++) {
-            if (op_flags[i]==(LOG_UNSUCCESS | LOG_UNSUCCESS)) {
-                fprintf(hash_log, "a");
-            }
-            else if (op_flags[i] == LOG_SUCCESS) {
-                fprintf(hash_log, "s");
+        Stop_Service();
+        if (timeline_fp!=NULL) {
+            fclose(timeline_fp);
+        }
+        Shmstat_Destroy(shm_stats, shm_name);
+        Slowlog_Close();
+        Trace_Close();
+        Journal_Close();
+        if (hash_log!=NULL) {
+            Print_Hash(hash_log, h);
+        }
+        // Sessions still running end with the mount
+        for (int i=0;i<SESSION_MAX && sessions_enabled;i++) {
+            if (Session_Running() & (1ULL << i)) {
+                char name[PATH_MAX];
+                int rc = Write_Subset(SUBSET_SESSION, i, name, sizeof(name));
+                if (rc!=0) {
+                    fprintf(stderr, "Can't write session log %s: %s\n", name, strerror(-rc));
+                }
             }
-            else if (op_flags[i] == LOG_UNSUCCESS) {
-                fprintf(hash_log, "u");
+        }
+        for (int i=0;i<Phase_Count() && phases_enabled;i++) {
+            char name[PATH_MAX];
+            int rc = Write_Subset(SUBSET_PHASE, i, name, sizeof(name));
+            if (rc!=0) {
+                fprintf(stderr, "Can't write phase log %s: %s\n", name, strerror(-rc));
             }
-            else {
-                fprintf(hash_log, ".");
+        }
+        if (loggedfsArgs->binlogFilename!=NULL) {
+            int rc=Write_Binlog(loggedfsArgs->binlogFilename, h);
+            if (rc!=0) {
+                fprintf(stderr, "Can't write binary log %s: %s\n", loggedfsArgs->binlogFilename, strerror(-rc));
             }
         }
-        fprintf(hash_log, "####\n");
-        fprintf(hash_log, "#GArdKMSuDNLmoTnsORWteFXxlv\n");
-        Print_Hash(hash_log, h);
         Free_Hash(h);
-        fclose(hash_log);
+        Attrib_Free();
+        Session_Free();
+        Proc_Cache_Free();
+        Extent_Free();
+        NegCache_Free();
+        DirCache_Free();
+        if (Sink_Close(hash_log, 0)!=0) {
+            fprintf(stderr, "Error writing log file\n");
+        }
         fprintf(stderr, "LoggedFS closing.\n");
     }
 }
@@ -0,0 +1,95 @@
+#ifndef distillerfs_h
+#define distillerfs_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QN_FLAGS                26
+#define OP_SYMBOLS              "GArdKMSuDNLmoTnsORWteFXxlv"
+
+#define LOG_SUCCESS   1
+#define LOG_UNSUCCESS 2
+
+enum FUSE_OPS {
+    OP_GETATTR,
+    OP_ACCESS,
+    OP_READLINK,
+    OP_READDIR,
+    OP_MKNOD,
+    OP_MKDIR,
+    OP_SYMLINK,
+    OP_UNLINK,
+    OP_RMDIR,
+    OP_RENAME,
+    OP_LINK,
+    OP_CHMOD,
+    OP_CHOWN,
+    OP_TRUNCATE,
+    OP_UTIME,
+    OP_UTIMENS,
+    OP_OPEN,
+    OP_READ,
+    OP_WRITE,
+    OP_STATFS,
+    OP_RELEASE,
+    OP_FSYNC,
+    OP_SETXATTR,
+    OP_GETXATTR,
+    OP_LISTXATTR,
+    OP_REMOVEXATTR
+};
+
+#define FLAG_GETATTR        (1<<OP_GETATTR)     //  G
+#define FLAG_ACCESS         (1<<OP_ACCESS)      //  A
+#define FLAG_READLINK       (1<<OP_READLINK)    //  r
+#define FLAG_READDIR        (1<<OP_READDIR)     //  d
+#define FLAG_MKNOD          (1<<OP_MKNOD)       //  K
+#define FLAG_MKDIR          (1<<OP_MKDIR)       //  M
+#define FLAG_SYMLINK        (1<<OP_SYMLINK)     //  S
+#define FLAG_UNLINK         (1<<OP_UNLINK)      //  u
+#define FLAG_RMDIR          (1<<OP_RMDIR)       //  D
+#define FLAG_RENAME         (1<<OP_RENAME)      //  N
+#define FLAG_LINK           (1<<OP_LINK)        //  L
+#define FLAG_CHMOD          (1<<OP_CHMOD)       //  m
+#define FLAG_CHOWN          (1<<OP_CHOWN)       //  o
+#define FLAG_TRUNCATE       (1<<OP_TRUNCATE)    //  T
+#define FLAG_UTIME          (1<<OP_UTIME)       //  n
+#define FLAG_UTIMENS        (1<<OP_UTIMENS)     //  s
+#define FLAG_OPEN           (1<<OP_OPEN)        //  O
+#define FLAG_READ           (1<<OP_READ)        //  R
+#define FLAG_WRITE          (1<<OP_WRITE)       //  W
+#define FLAG_STATFS         (1<<OP_STATFS)      //  t
+#define FLAG_RELEASE        (1<<OP_RELEASE)     //  e
+#define FLAG_FSYNC          (1<<OP_FSYNC)       //  F
+#define FLAG_SETXATTR       (1<<OP_SETXATTR)    //  X
+#define FLAG_GETXATTR       (1<<OP_GETXATTR)    //  x
+#define FLAG_LISTXATTR      (1<<OP_LISTXATTR)   //  l
+#define FLAG_REMOVEXATTR    (1<<OP_REMOVEXATTR) //  v
+
+// One entry as dumped. Per-op counts, when collected, are one per bit
+// set in flags, in bit order, starting at the snapshot's op_counts[ops].
+typedef struct lfs_count {
+    char    *path;
+    uint64_t count;                    // all operations
+    uint32_t flags;
+    uint32_t ops;
+    uint32_t seq;                      // first-access order
+    uint64_t first_ns;                 // since mount, when times are kept
+    uint64_t last_ns;
+    const char *procs;                 // command numbers, "3,7,12", when attributed
+    uint64_t sessions;                 // bit per recording session slot
+    uint64_t phases;                   // bit per phase
+} lfs_count_t;
+
+extern const char *op_names[];
+extern const char  symbols[QN_FLAGS];
+extern int         op_flags[QN_FLAGS];
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
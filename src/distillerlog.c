@@ -0,0 +1,404 @@
+// distillerlog - offline tool for DistillerFS journals and logs.
+// Journals and logs ending in .gz or .zst are read and written compressed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include "journal.h"
+#include "binlog.h"
+#include "sink.h"
+#include "distillerfs.h"
+
+const char symbols[QN_FLAGS]=OP_SYMBOLS;
+
+typedef struct path_stat {
+    char     *path;
+    uint64_t  count;
+    uint32_t  flags;
+} path_stat_t;
+
+#define MAX_IDS  (1u << 26)           // path ids a journal can use, a corrupt one aside
+
+static path_stat_t *stats = NULL;
+static size_t       stats_size = 0;
+
+// NULL for an id out of range or when the table can't grow
+static path_stat_t *get_stat(uint32_t id) {
+    if (id >= MAX_IDS) {
+        return NULL;
+    }
+    if (id >= stats_size) {
+        size_t size = stats_size ? stats_size : 1024;
+        while (size <= id) {
+            size *= 2;
+        }
+        path_stat_t *grown = realloc(stats, size*sizeof(path_stat_t));
+        if (grown == NULL) {
+            return NULL;
+        }
+        stats = grown;
+        memset(stats + stats_size, 0, (size - stats_size)*sizeof(path_stat_t));
+        stats_size = size;
+    }
+    return &stats[id];
+}
+
+static void print_legend(FILE *out, const uint8_t *op_flags, uint32_t entries) {
+    fprintf(out, "#### Hash size: [%u] ####\n", entries);
+    fprintf(out, "#### Log mask/legend:\n#");
+    for (int i=0;i<QN_FLAGS;i++) {
+        if (op_flags[i] == (LOG_SUCCESS | LOG_UNSUCCESS)) {
+            fprintf(out, "a");
+        }
+        else if (op_flags[i] == LOG_SUCCESS) {
+            fprintf(out, "s");
+        }
+        else if (op_flags[i] == LOG_UNSUCCESS) {
+            fprintf(out, "u");
+        }
+        else {
+            fprintf(out, ".");
+        }
+    }
+    fprintf(out, "####\n");
+    fprintf(out, "#GArdKMSuDNLmoTnsORWteFXxlv\n");
+}
+
+static void print_entry(FILE *out, uint32_t flags, uint64_t count, const char *path) {
+    char mask[QN_FLAGS+1];
+
+    for (int i=0;i<QN_FLAGS;i++) {
+        mask[i] = (flags & (1u << i)) ? symbols[i] : '.';
+    }
+    mask[QN_FLAGS] = 0;
+    fprintf(out, "[%s]:%010" PRIu64 ":%s\n", mask, count, path);
+}
+
+// Replays a journal into the aggregate "[mask]:count:path" log
+static int journal_to_log(const char *in_file, FILE *out) {
+    FILE *in;
+    journal_header_t hdr;
+    uint32_t entries = 0;
+    uint64_t events = 0, orphans = 0;
+    int type, rc = 0;
+
+    in = Sink_Fopen(in_file, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Can't open %s\n", in_file);
+        return 1;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic)) != 0) {
+        fprintf(stderr, "%s is not a DistillerFS journal\n", in_file);
+        fclose(in);
+        return 2;
+    }
+    for (uint32_t i = 0; i < hdr.mount_len; i++) {
+        getc(in);                      // compressed input can't seek
+    }
+
+    while ((type = getc(in)) != EOF) {
+        ungetc(type, in);
+        if (type == JREC_EVENT) {
+            jrec_event_t e;
+            if (fread(&e, sizeof(e), 1, in) != 1) {
+                break;                 // truncated by a crash
+            }
+            if (e.op >= QN_FLAGS) {
+                continue;
+            }
+            path_stat_t *st = get_stat(e.id);
+            if (st == NULL) {
+                fprintf(stderr, "Can't keep path id %u, stopping\n", e.id);
+                rc = 1;
+                break;
+            }
+            st->count++;
+            st->flags |= 1u << e.op;
+            events++;
+        }
+        else if (type == JREC_PATH) {
+            jrec_path_t p;
+            if (fread(&p, sizeof(p), 1, in) != 1) {
+                break;
+            }
+            path_stat_t *st = p.len < PATH_MAX ? get_stat(p.id) : NULL;
+            if (st == NULL) {
+                fprintf(stderr, "Can't keep path id %u (%u bytes), stopping\n", p.id, p.len);
+                rc = 1;
+                break;
+            }
+            free(st->path);
+            st->path = malloc(p.len + 1);
+            if (st->path == NULL || fread(st->path, 1, p.len, in) != p.len) {
+                free(st->path);
+                st->path = NULL;
+                break;
+            }
+            st->path[p.len] = '\0';
+        }
+        else {
+            fprintf(stderr, "Unknown record type %d, stopping\n", type);
+            break;
+        }
+    }
+    fclose(in);
+
+    for (size_t id = 0; id < stats_size; id++) {
+        if (stats[id].path != NULL && stats[id].count > 0) {
+            entries++;
+        }
+        else if (stats[id].count > 0) {
+            orphans++;
+        }
+    }
+
+    print_legend(out, hdr.op_flags, entries);
+    for (size_t id = 0; id < stats_size; id++) {
+        path_stat_t *st = &stats[id];
+        if (st->path != NULL && st->count > 0) {
+            print_entry(out, st->flags, st->count, st->path);
+        }
+    }
+
+    fprintf(stderr, "%" PRIu64 " events, %u paths", events, entries);
+    if (orphans > 0) {
+        fprintf(stderr, ", %" PRIu64 " ids without path (truncated journal?)", orphans);
+    }
+    fprintf(stderr, "\n");
+    return rc;
+}
+
+#define MAX_COLUMNS  (QN_FLAGS + 8)   // columns before the path, at most
+
+// Reads "#### Columns: mask:count:procs:path ####": the number of
+// columns before the path and where the mask and count are. -1 when the
+// log lacks either, a binary log needs both.
+static int parse_columns(const char *line, int *ncols, int *mask_at, int *count_at) {
+    char names[8192];
+    char *save = NULL;
+    int n = 0;
+
+    snprintf(names, sizeof(names), "%s", line + strlen("#### Columns: "));
+    *mask_at = *count_at = -1;
+    for (char *tok = strtok_r(names, ":", &save); tok != NULL; tok = strtok_r(NULL, ":", &save)) {
+        if (strncmp(tok, "path", 4) == 0 && (tok[4] == ' ' || tok[4] == '\0')) {
+            break;
+        }
+        if (strcmp(tok, "mask") == 0) {
+            *mask_at = n;
+        }
+        else if (strcmp(tok, "count") == 0) {
+            *count_at = n;
+        }
+        n++;
+    }
+    *ncols = n;
+    return *mask_at >= 0 && *count_at >= 0 && n <= MAX_COLUMNS ? 0 : -1;
+}
+
+// Parses an aggregate text log and writes it as a binary log
+static int text_to_binlog(const char *in_file, const char *out_file) {
+    FILE *in;
+    char line[8192];
+    int op_flags[QN_FLAGS];
+    int legend_next = 0;
+    int ncols = 2, mask_at = 0, count_at = 1;     // "[mask]:count:path"
+    binlog_entry_t *entries = NULL;
+    size_t n = 0, cap = 0;
+    int rc;
+
+    for (int i=0;i<QN_FLAGS;i++) {
+        op_flags[i] = LOG_SUCCESS | LOG_UNSUCCESS;
+    }
+
+    in = Sink_Fopen(in_file, "r");
+    if (in == NULL) {
+        fprintf(stderr, "Can't open %s\n", in_file);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), in) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#') {
+            if (legend_next && strlen(line) >= QN_FLAGS + 1) {
+                for (int i=0;i<QN_FLAGS;i++) {
+                    switch (line[i+1]) {
+                    case 'a': op_flags[i] = LOG_SUCCESS | LOG_UNSUCCESS; break;
+                    case 's': op_flags[i] = LOG_SUCCESS; break;
+                    case 'u': op_flags[i] = LOG_UNSUCCESS; break;
+                    default:  op_flags[i] = 0; break;
+                    }
+                }
+            }
+            if (strncmp(line, "#### Columns: ", 14) == 0 &&
+                parse_columns(line, &ncols, &mask_at, &count_at) != 0) {
+                fprintf(stderr, "%s has no mask or count column, can't convert it\n", in_file);
+                fclose(in);
+                free(entries);
+                return 1;
+            }
+            legend_next = strcmp(line, "#### Log mask/legend:") == 0;
+            continue;
+        }
+        // ncols fields, then the path, which may itself contain ':'
+        char *field[MAX_COLUMNS] = { NULL };
+        char *p = line;
+        int ok = 1;
+        for (int c = 0; c < ncols && ok; c++) {
+            char *end = strchr(p, ':');
+            field[c] = p;
+            ok = end != NULL;
+            p = ok ? end + 1 : p;
+        }
+        char *mask = field[mask_at], *count_end;
+        ok = ok && mask[0] == '[' && strlen(mask) >= QN_FLAGS + 3 && mask[QN_FLAGS+1] == ']' &&
+             mask[QN_FLAGS+2] == ':';
+        uint64_t count = ok ? strtoull(field[count_at], &count_end, 10) : 0;
+        if (!ok || *count_end != ':') {
+            fprintf(stderr, "Skipping malformed line: %s\n", line);
+            continue;
+        }
+        uint32_t flags = 0;
+        for (int i=0;i<QN_FLAGS;i++) {
+            if (mask[i+1] == symbols[i]) {
+                flags |= 1u << i;
+            }
+        }
+        if (strlen(p) >= PATH_MAX) {
+            fprintf(stderr, "Skipping path longer than %d bytes: %.64s...\n", PATH_MAX - 1, p);
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap*2 : 4096;
+            entries = realloc(entries, cap*sizeof(binlog_entry_t));
+        }
+        entries[n].path = strdup(p);
+        entries[n].count = count;
+        entries[n].flags = flags;
+        n++;
+    }
+    fclose(in);
+
+    rc = Binlog_Write(out_file, entries, n, op_flags, symbols, QN_FLAGS);
+    if (rc != 0) {
+        fprintf(stderr, "Can't write %s: %s\n", out_file, strerror(-rc));
+    }
+    else {
+        fprintf(stderr, "%zu entries\n", n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        free((char *)entries[i].path);
+    }
+    free(entries);
+    return rc != 0;
+}
+
+static int open_binlog(binlog_t *bl, const char *file) {
+    int rc = Binlog_Open(bl, file);
+    if (rc != 0) {
+        fprintf(stderr, "Can't open binary log %s: %s\n", file, strerror(-rc));
+    }
+    return rc;
+}
+
+static int binlog_to_text(const char *in_file, FILE *out) {
+    binlog_t bl;
+    binlog_iter_t it;
+    int64_t idx;
+
+    if (open_binlog(&bl, in_file) != 0) {
+        return 1;
+    }
+    print_legend(out, bl.hdr->op_flags, (uint32_t)bl.hdr->entry_count);
+    Binlog_Seek(&it, &bl, "");
+    while ((idx = Binlog_Next(&it)) >= 0) {
+        print_entry(out, bl.flags[idx], bl.counts[idx], it.path);
+    }
+    Binlog_Close(&bl);
+    return 0;
+}
+
+static int binlog_lookup(const char *in_file, const char *key, int prefix, FILE *out) {
+    binlog_t bl;
+    binlog_iter_t it;
+    int64_t idx;
+    size_t key_len = strlen(key);
+    int found = 0;
+
+    if (open_binlog(&bl, in_file) != 0) {
+        return 1;
+    }
+    if (prefix) {
+        Binlog_Seek(&it, &bl, key);
+        while ((idx = Binlog_Next(&it)) >= 0 && strncmp(it.path, key, key_len) == 0) {
+            print_entry(out, bl.flags[idx], bl.counts[idx], it.path);
+            found++;
+        }
+    }
+    else if ((idx = Binlog_Find(&bl, key)) >= 0) {
+        print_entry(out, bl.flags[idx], bl.counts[idx], key);
+        found++;
+    }
+    Binlog_Close(&bl);
+    return found > 0 ? 0 : 3;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "%s journal <journal-file> [log-file]   convert a journal to the aggregate log\n", name);
+    fprintf(stderr, "%s txt2bin <log-file> <binlog-file>    convert a text log to the binary format\n", name);
+    fprintf(stderr, "%s bin2txt <binlog-file> [log-file]    convert a binary log to text (sorted by path)\n", name);
+    fprintf(stderr, "%s lookup <binlog-file> <path>         print the entry for path\n", name);
+    fprintf(stderr, "%s prefix <binlog-file> <prefix>       print all entries under prefix\n", name);
+}
+
+int main(int argc, char *argv[]) {
+    FILE *out = stdout;
+    int rc;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "txt2bin") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return text_to_binlog(argv[2], argv[3]);
+    }
+    if (strcmp(argv[1], "lookup") == 0 || strcmp(argv[1], "prefix") == 0) {
+        if (argc < 4) {
+            usage(argv[0]);
+            return 1;
+        }
+        return binlog_lookup(argv[2], argv[3], argv[1][0] == 'p', stdout);
+    }
+
+    if (argc > 3) {
+        out = Sink_Fopen(argv[3], "w");
+        if (out == NULL) {
+            fprintf(stderr, "Can't create %s\n", argv[3]);
+            return 1;
+        }
+    }
+
+    if (strcmp(argv[1], "journal") == 0) {
+        rc = journal_to_log(argv[2], out);
+    }
+    else if (strcmp(argv[1], "bin2txt") == 0) {
+        rc = binlog_to_text(argv[2], out);
+    }
+    else {
+        usage(argv[0]);
+        rc = 1;
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return rc;
+}
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dump.h"
+
+#define DUMP_MAX_THREADS  32
+
+typedef struct dump_task {
+    const lfs_count_t    *items;
+    const uint64_t       *op_counts;
+    const dump_columns_t *columns;
+    size_t                from;
+    size_t                to;
+    char                 *buf;
+    size_t                len;
+    size_t                cap;
+} dump_task_t;
+
+static char mask_lut[4][256][8];
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+static pthread_once_t lut_once = PTHREAD_ONCE_INIT;
+
+static void init_lut(void) {
+    for (int byte = 0; byte < 4; byte++) {
+        for (int v = 0; v < 256; v++) {
+            for (int bit = 0; bit < 8; bit++) {
+                int op = byte*8 + bit;
+                mask_lut[byte][v][bit] = (op < QN_FLAGS && (v & (1 << bit))) ? symbols[op] : '.';
+            }
+        }
+    }
+}
+
+// At least `width` digits, zero padded
+static char *put_number(char *p, uint64_t v, int width) {
+    char tmp[24];
+    char *t = tmp + sizeof(tmp);
+    int len;
+
+    while (v >= 100) {
+        t -= 2;
+        memcpy(t, &digit_pairs[(v % 100)*2], 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        t -= 2;
+        memcpy(t, &digit_pairs[v*2], 2);
+    }
+    else {
+        *--t = (char)('0' + v);
+    }
+    len = tmp + sizeof(tmp) - t;
+    if (len < width) {
+        memset(p, '0', width - len);
+        p += width - len;
+    }
+    memcpy(p, t, len);
+    return p + len;
+}
+
+// Like "%010d"
+static char *put_count(char *p, uint64_t v) {
+    return put_number(p, v, 10);
+}
+
+static char *put_mask(char *p, uint32_t flags) {
+    *p++ = '[';
+    memcpy(p, mask_lut[0][flags & 0xff], 8);
+    memcpy(p + 8, mask_lut[1][(flags >> 8) & 0xff], 8);
+    memcpy(p + 16, mask_lut[2][(flags >> 16) & 0xff], 8);
+    memcpy(p + 24, mask_lut[3][(flags >> 24) & 0xff], QN_FLAGS - 24);
+    p += QN_FLAGS;
+    *p++ = ']';
+    return p;
+}
+
+// Count of op in entry v, 0 if it was never recorded
+static uint64_t op_count(const dump_task_t *t, const lfs_count_t *v, int op) {
+    uint32_t bit = 1u << op;
+
+    if ((v->flags & bit) == 0) {
+        return 0;
+    }
+    return t->op_counts[v->ops + __builtin_popcount(v->flags & (bit - 1))];
+}
+
+// Seconds with milliseconds, "12.345"
+static char *put_seconds(char *p, uint64_t ns) {
+    p = put_number(p, ns/1000000000ULL, 1);
+    *p++ = '.';
+    return put_number(p, ns/1000000 % 1000, 3);
+}
+
+// Worst case of a line besides the path, column by column: the mask,
+// every op as "X=<20 digits>,", the command set, numbers and seconds
+// within 32 bytes, each with its ':'
+static size_t columns_max_len(const dump_columns_t *c, size_t procs_len) {
+    size_t len = 0;
+
+    for (int i = 0; i < c->n; i++) {
+        if (c->col[i] == DUMP_COL_MASK) {
+            len += QN_FLAGS + 3;
+        }
+        else if (c->col[i] == DUMP_COL_OPS) {
+            len += QN_FLAGS*23 + 1;
+        }
+        else if (c->col[i] == DUMP_COL_PROCS) {
+            len += procs_len + 1;
+        }
+        else {
+            len += 32;
+        }
+    }
+    return len;
+}
+
+static void format_columns(dump_task_t *t, const lfs_count_t *v, size_t path_len) {
+    const dump_columns_t *c = t->columns;
+    size_t procs_len = v->procs != NULL ? strlen(v->procs) : 1;
+    size_t need = columns_max_len(c, procs_len) + path_len + 1;
+    char *p;
+
+    if (t->len + need > t->cap) {
+        t->cap = (t->cap + need)*2;
+        t->buf = realloc(t->buf, t->cap);
+    }
+    p = t->buf + t->len;
+    for (int i = 0; i < c->n; i++) {
+        int col = c->col[i];
+        if (col == DUMP_COL_MASK) {
+            p = put_mask(p, v->flags);
+        }
+        else if (col == DUMP_COL_COUNT) {
+            p = put_count(p, v->count);
+        }
+        else if (col == DUMP_COL_SEQ) {
+            p = put_number(p, v->seq, 1);
+        }
+        else if (col == DUMP_COL_FIRST) {
+            p = put_seconds(p, v->first_ns);
+        }
+        else if (col == DUMP_COL_LAST) {
+            p = put_seconds(p, v->last_ns);
+        }
+        else if (col == DUMP_COL_PROCS) {
+            if (v->procs != NULL) {
+                memcpy(p, v->procs, procs_len);
+                p += procs_len;
+            }
+            else {
+                *p++ = '-';
+            }
+        }
+        else if (col == DUMP_COL_OPS) {
+            uint32_t rest = v->flags;
+            int first = 1;
+            while (rest != 0) {
+                int op = __builtin_ctz(rest);
+                rest &= rest - 1;
+                if (!first) {
+                    *p++ = ',';
+                }
+                *p++ = symbols[op];
+                *p++ = '=';
+                p = put_number(p, op_count(t, v, op), 1);
+                first = 0;
+            }
+        }
+        else {
+            p = put_number(p, op_count(t, v, col), 1);
+        }
+        *p++ = ':';
+    }
+    memcpy(p, v->path, path_len);
+    p += path_len;
+    *p++ = '\n';
+    t->len = p - t->buf;
+}
+
+static void *format_range(void *arg) {
+    dump_task_t *t = arg;
+
+    for (size_t i = t->from; i < t->to; i++) {
+        const lfs_count_t *v = &t->items[i];
+        size_t path_len = strlen(v->path);
+        char *p;
+
+        if (t->columns != NULL) {
+            format_columns(t, v, path_len);
+            continue;
+        }
+        // '[' + mask + "]:" + count (<= 20) + ':' + path + '\n'
+        if (t->len + QN_FLAGS + path_len + 32 > t->cap) {
+            t->cap = (t->cap + path_len + 64)*2;
+            t->buf = realloc(t->buf, t->cap);
+        }
+        p = put_mask(t->buf + t->len, v->flags);
+        *p++ = ':';
+        p = put_count(p, v->count);
+        *p++ = ':';
+        memcpy(p, v->path, path_len);
+        p += path_len;
+        *p++ = '\n';
+        t->len = p - t->buf;
+    }
+    return NULL;
+}
+
+// Names of the DUMP_COL_* columns, by -col - 1
+static const char *column_names[] = { "mask", "count", "ops", "seq", "first", "last", "procs" };
+
+#define QN_COLUMN_NAMES  (int)(sizeof(column_names)/sizeof(column_names[0]))
+
+int Dump_Column(const char *name, int *col) {
+    for (int i = 0; i < QN_COLUMN_NAMES; i++) {
+        if (strcmp(name, column_names[i]) == 0) {
+            *col = -i - 1;
+            return 0;
+        }
+    }
+    for (int i = 0; i < QN_FLAGS; i++) {
+        if (strcmp(name, op_names[i]) == 0) {
+            *col = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *Dump_Column_Name(int col) {
+    if (col < 0 && -col - 1 < QN_COLUMN_NAMES) {
+        return column_names[-col - 1];
+    }
+    return col < QN_FLAGS ? op_names[col] : "?";
+}
+
+int Dump_Has_Column(const dump_columns_t *columns, int col) {
+    for (int i = 0; columns != NULL && i < columns->n; i++) {
+        if (columns->col[i] == col) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Dump_Needs_Ops(const dump_columns_t *columns) {
+    if (columns == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < columns->n; i++) {
+        if (columns->col[i] >= 0 || columns->col[i] == DUMP_COL_OPS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Dump_Needs_Times(const dump_columns_t *columns) {
+    if (columns == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < columns->n; i++) {
+        if (columns->col[i] == DUMP_COL_FIRST || columns->col[i] == DUMP_COL_LAST) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Dump_Needs_Procs(const dump_columns_t *columns) {
+    if (columns == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < columns->n; i++) {
+        if (columns->col[i] == DUMP_COL_PROCS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Dump_Entries(sink_t *out, const lfs_count_t *items, size_t n, const uint64_t *op_counts,
+                 const dump_columns_t *columns, int threads) {
+    dump_task_t tasks[DUMP_MAX_THREADS];
+    pthread_t tids[DUMP_MAX_THREADS];
+    struct iovec iov[DUMP_MAX_THREADS];
+    int rc = 0;
+
+    pthread_once(&lut_once, init_lut);
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > DUMP_MAX_THREADS) {
+        threads = DUMP_MAX_THREADS;
+    }
+    memset(tasks, 0, sizeof(tasks));
+
+    // Rounds of `threads` ranges keep memory bounded by the round size
+    for (size_t start = 0; start < n && rc == 0; start += (size_t)threads*DUMP_RANGE) {
+        int cnt = 0;
+
+        for (int i = 0; i < threads; i++) {
+            size_t from = start + (size_t)i*DUMP_RANGE;
+            if (from >= n) {
+                break;
+            }
+            tasks[i].items = items;
+            tasks[i].op_counts = op_counts;
+            tasks[i].columns = columns;
+            tasks[i].from = from;
+            tasks[i].to = from + DUMP_RANGE < n ? from + DUMP_RANGE : n;
+            tasks[i].len = 0;
+            cnt++;
+        }
+        for (int i = 1; i < cnt; i++) {
+            if (pthread_create(&tids[i], NULL, format_range, &tasks[i]) != 0) {
+                format_range(&tasks[i]);
+                tids[i] = 0;
+            }
+        }
+        format_range(&tasks[0]);
+        for (int i = 1; i < cnt; i++) {
+            if (tids[i] != 0) {
+                pthread_join(tids[i], NULL);
+            }
+        }
+
+        for (int i = 0; i < cnt; i++) {
+            iov[i].iov_base = tasks[i].buf;
+            iov[i].iov_len = tasks[i].len;
+        }
+        rc = Sink_Writev(out, iov, cnt);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        free(tasks[i].buf);
+    }
+    return rc;
+}
+
+typedef int (*cmp_fn_t)(const void *, const void *);
+
+typedef struct sort_task {
+    lfs_count_t *src;
+    lfs_count_t *dst;
+    size_t       lo;
+    size_t       mid;
+    size_t       hi;
+    cmp_fn_t     cmp;
+} sort_task_t;
+
+static int cmp_path(const void *a, const void *b) {
+    return strcmp(((const lfs_count_t *)a)->path, ((const lfs_count_t *)b)->path);
+}
+
+static int cmp_seq(const void *a, const void *b) {
+    uint32_t x = ((const lfs_count_t *)a)->seq, y = ((const lfs_count_t *)b)->seq;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void *sort_run(void *arg) {
+    sort_task_t *t = arg;
+    qsort(t->src + t->lo, t->hi - t->lo, sizeof(lfs_count_t), t->cmp);
+    return NULL;
+}
+
+static void *merge_runs(void *arg) {
+    sort_task_t *t = arg;
+    size_t i = t->lo, j = t->mid, k = t->lo;
+
+    while (i < t->mid && j < t->hi) {
+        if (t->cmp(&t->src[j], &t->src[i]) < 0) {
+            t->dst[k++] = t->src[j++];
+        }
+        else {
+            t->dst[k++] = t->src[i++];
+        }
+    }
+    memcpy(t->dst + k, t->src + i, (t->mid - i)*sizeof(lfs_count_t));
+    k += t->mid - i;
+    memcpy(t->dst + k, t->src + j, (t->hi - j)*sizeof(lfs_count_t));
+    return NULL;
+}
+
+// Runs fn over tasks[0..cnt) on cnt threads, the caller taking task 0
+static void run_tasks(void *(*fn)(void *), sort_task_t *tasks, int cnt) {
+    pthread_t tids[DUMP_MAX_THREADS];
+
+    for (int i = 1; i < cnt; i++) {
+        if (pthread_create(&tids[i], NULL, fn, &tasks[i]) != 0) {
+            fn(&tasks[i]);
+            tids[i] = 0;
+        }
+    }
+    fn(&tasks[0]);
+    for (int i = 1; i < cnt; i++) {
+        if (tids[i] != 0) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+}
+
+void Dump_Sort(lfs_count_t *items, size_t n, int order, int threads) {
+    sort_task_t tasks[DUMP_MAX_THREADS];
+    size_t bounds[DUMP_MAX_THREADS + 1];
+    lfs_count_t *src = items, *dst;
+    cmp_fn_t cmp = order == DUMP_SORT_FIRST ? cmp_seq : cmp_path;
+    int runs;
+
+    if (threads > DUMP_MAX_THREADS) {
+        threads = DUMP_MAX_THREADS;
+    }
+    if (threads <= 1 || n < (size_t)threads*1024) {
+        qsort(items, n, sizeof(lfs_count_t), cmp);
+        return;
+    }
+    dst = malloc(n*sizeof(lfs_count_t));
+    if (dst == NULL) {
+        qsort(items, n, sizeof(lfs_count_t), cmp);
+        return;
+    }
+
+    runs = threads;
+    for (int i = 0; i <= runs; i++) {
+        bounds[i] = n*i/runs;
+    }
+    for (int i = 0; i < runs; i++) {
+        tasks[i].src = src;
+        tasks[i].cmp = cmp;
+        tasks[i].lo = bounds[i];
+        tasks[i].hi = bounds[i + 1];
+    }
+    run_tasks(sort_run, tasks, runs);
+
+    while (runs > 1) {
+        int cnt = 0;
+        lfs_count_t *tmp;
+
+        for (int i = 0; i < runs; i += 2) {
+            tasks[cnt].src = src;
+            tasks[cnt].dst = dst;
+            tasks[cnt].cmp = cmp;
+            tasks[cnt].lo = bounds[i];
+            // an odd run out is merged with an empty one, i.e. copied
+            tasks[cnt].mid = bounds[i + 1];
+            tasks[cnt].hi = i + 1 < runs ? bounds[i + 2] : bounds[i + 1];
+            bounds[cnt] = bounds[i];
+            cnt++;
+        }
+        bounds[cnt] = n;
+        run_tasks(merge_runs, tasks, cnt);
+        tmp = src;
+        src = dst;
+        dst = tmp;
+        runs = cnt;
+    }
+
+    if (src != items) {
+        memcpy(items, src, n*sizeof(lfs_count_t));
+        free(src);
+    }
+    else {
+        free(dst);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef dump_h
+#define dump_h
+
+#include <stddef.h>
+#include "distillerfs.h"
+#include "sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Formats "[mask]:count:path" lines without stdio: masks come from a
+// per-byte lookup table, counters from a digit-pair table. Ranges of
+// DUMP_RANGE entries are formatted by up to `threads` threads into large
+// buffers that are passed to the sink in order (one writev() when plain).
+
+#define DUMP_RANGE  32768
+
+// Output columns, separated by ':', the path always last. Without a
+// column list lines are "[mask]:count:path".
+#define DUMP_MAX_COLUMNS  (QN_FLAGS + 7)
+#define DUMP_COL_MASK     -1           // "[GA.d...]"
+#define DUMP_COL_COUNT    -2           // all operations, 10 digits or more
+#define DUMP_COL_OPS      -3           // "G=12,R=40", every recorded op
+#define DUMP_COL_SEQ      -4           // first-access sequence number
+#define DUMP_COL_FIRST    -5           // first access, seconds since mount
+#define DUMP_COL_LAST     -6           // last access
+#define DUMP_COL_PROCS    -7           // commands that accessed it, "3,7,12"
+                                       // 0..QN_FLAGS-1: count of that op
+typedef struct dump_columns {
+    int n;
+    int col[DUMP_MAX_COLUMNS];
+} dump_columns_t;
+
+// op_counts holds the per-op counts of the snapshot; it is only read
+// for DUMP_COL_OPS and per-op columns
+int  Dump_Entries(sink_t *out, const lfs_count_t *items, size_t n, const uint64_t *op_counts,
+                  const dump_columns_t *columns, int threads);
+// Parses a column name ("mask", "count", "ops", "seq", "first", "last",
+// "procs" or an operation); -1 if unknown
+int  Dump_Column(const char *name, int *col);
+const char *Dump_Column_Name(int col);
+// True when col is one of the columns
+int  Dump_Has_Column(const dump_columns_t *columns, int col);
+// True when any column needs per-op counts
+int  Dump_Needs_Ops(const dump_columns_t *columns);
+// True when any column needs access times
+int  Dump_Needs_Times(const dump_columns_t *columns);
+// True when any column needs the commands of each path
+int  Dump_Needs_Procs(const dump_columns_t *columns);
+
+#define DUMP_SORT_PATH   0             // strcmp order
+#define DUMP_SORT_FIRST  1             // first-access order
+
+// Sorts entries: each thread sorts one run, then runs are merged
+// pairwise, in parallel, until one is left.
+void Dump_Sort(lfs_count_t *items, size_t n, int order, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include "evq.h"
+
+typedef struct evq_ring {
+    struct evq_ring *next;
+    uint64_t         head;             // advanced by the producer only
+    uint64_t         tail;             // advanced by the consumer only
+    int              orphaned;         // producer thread has exited
+    size_t           mask;
+    char            *data;
+} evq_ring_t;
+
+struct evq {
+    size_t           ring_bytes;       // power of two
+    int              mode;
+    int              period_ms;
+    evq_consume_t    consume;
+    evq_flush_t      flush;
+    void            *ctx;
+    evq_ring_t      *rings;
+    pthread_mutex_t  lock;             // protects the ring list
+    pthread_key_t    key;              // calling thread's ring
+    pthread_t        thread;
+    int              stop;
+    uint64_t         dropped;
+    char            *scratch;          // reassembles records split by wrap
+};
+
+static void ring_orphan(void *arg) {
+    evq_ring_t *r = arg;
+    __atomic_store_n(&r->orphaned, 1, __ATOMIC_RELEASE);
+}
+
+static evq_ring_t *ring_new(evq_t *q) {
+    evq_ring_t *r = calloc(1, sizeof(evq_ring_t));
+    r->mask = q->ring_bytes - 1;
+    r->data = malloc(q->ring_bytes);
+    pthread_setspecific(q->key, r);
+
+    pthread_mutex_lock(&q->lock);
+    r->next = q->rings;
+    q->rings = r;
+    pthread_mutex_unlock(&q->lock);
+    return r;
+}
+
+static void ring_put(evq_ring_t *r, uint64_t pos, const void *src, size_t len) {
+    size_t off = pos & r->mask;
+    size_t first = r->mask + 1 - off;
+    if (first >= len) {
+        memcpy(r->data + off, src, len);
+    }
+    else {
+        memcpy(r->data + off, src, first);
+        memcpy(r->data, (const char *)src + first, len - first);
+    }
+}
+
+static const void *ring_get(evq_ring_t *r, uint64_t pos, void *scratch, size_t len) {
+    size_t off = pos & r->mask;
+    size_t first = r->mask + 1 - off;
+    if (first >= len) {
+        return r->data + off;
+    }
+    memcpy(scratch, r->data + off, first);
+    memcpy((char *)scratch + first, r->data, len - first);
+    return scratch;
+}
+
+int Evq_Push(evq_t *q, const void *rec, uint32_t len) {
+    evq_ring_t *r;
+    uint64_t need = sizeof(uint32_t) + len;
+
+    if (q == NULL) {
+        return -1;
+    }
+    r = pthread_getspecific(q->key);
+    if (r == NULL) {
+        r = ring_new(q);
+    }
+    if (need > q->ring_bytes) {
+        __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    while (r->head + need - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > q->ring_bytes) {
+        if (q->mode == EVQ_DROP) {
+            __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        sched_yield();
+    }
+    ring_put(r, r->head, &len, sizeof(uint32_t));
+    ring_put(r, r->head + sizeof(uint32_t), rec, len);
+    __atomic_store_n(&r->head, r->head + need, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// One pass over all rings; returns the number of records consumed
+static int drain(evq_t *q) {
+    evq_ring_t **link;
+    int n = 0;
+
+    pthread_mutex_lock(&q->lock);
+    link = &q->rings;
+    while (*link != NULL) {
+        evq_ring_t *r = *link;
+        int orphaned = __atomic_load_n(&r->orphaned, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = r->tail;
+
+        while (tail < head) {
+            uint32_t len;
+            memcpy(&len, ring_get(r, tail, q->scratch, sizeof(uint32_t)), sizeof(uint32_t));
+            q->consume(q->ctx, ring_get(r, tail + sizeof(uint32_t), q->scratch, len), len);
+            tail += sizeof(uint32_t) + len;
+            n++;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+        if (orphaned) {
+            *link = r->next;
+            free(r->data);
+            free(r);
+        }
+        else {
+            link = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+static void *evq_thread(void *arg) {
+    evq_t *q = arg;
+
+    while (__atomic_load_n(&q->stop, __ATOMIC_ACQUIRE) == 0) {
+        drain(q);
+        if (q->flush != NULL) {
+            q->flush(q->ctx);
+        }
+        usleep(q->period_ms*1000);
+    }
+    drain(q);
+    if (q->flush != NULL) {
+        q->flush(q->ctx);
+    }
+    return NULL;
+}
+
+evq_t *Evq_New(size_t ring_bytes, int mode, int period_ms,
+               evq_consume_t consume, evq_flush_t flush, void *ctx) {
+    evq_t *q = calloc(1, sizeof(evq_t));
+    size_t size = 4096;
+
+    while (size < ring_bytes) {
+        size <<= 1;
+    }
+    q->ring_bytes = size;
+    q->mode = mode;
+    q->period_ms = period_ms > 0 ? period_ms : 10;
+    q->consume = consume;
+    q->flush = flush;
+    q->ctx = ctx;
+    q->scratch = malloc(size);
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_key_create(&q->key, ring_orphan);
+    if (pthread_create(&q->thread, NULL, evq_thread, q) != 0) {
+        pthread_key_delete(q->key);
+        free(q->scratch);
+        free(q);
+        return NULL;
+    }
+    return q;
+}
+
+uint64_t Evq_Dropped(evq_t *q) {
+    return q ? __atomic_load_n(&q->dropped, __ATOMIC_RELAXED) : 0;
+}
+
+// Queue, scratch buffer and one ring per thread that ever pushed
+size_t Evq_Bytes(evq_t *q) {
+    size_t bytes;
+
+    if (q == NULL) {
+        return 0;
+    }
+    bytes = sizeof(evq_t) + q->ring_bytes;
+    pthread_mutex_lock(&q->lock);
+    for (evq_ring_t *r = q->rings; r != NULL; r = r->next) {
+        bytes += sizeof(evq_ring_t) + q->ring_bytes;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return bytes;
+}
+
+// Drains everything that was pushed before the call and frees the queue.
+// No thread may push to q afterwards.
+void Evq_Stop(evq_t *q) {
+    evq_ring_t *r, *next;
+
+    if (q == NULL) {
+        return;
+    }
+    __atomic_store_n(&q->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(q->thread, NULL);
+
+    for (r = q->rings; r != NULL; r = next) {
+        next = r->next;
+        free(r->data);
+        free(r);
+    }
+    pthread_key_delete(q->key);
+    pthread_mutex_destroy(&q->lock);
+    free(q->scratch);
+    free(q);
+}
@@ -0,0 +1,36 @@
+#ifndef evq_h
+#define evq_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Event queue: every producing thread gets its own lock-free single
+// producer/single consumer byte ring; one background thread drains all
+// rings and hands each record to consume(), then calls flush() once per
+// pass, also when nothing was drained. Records from different threads
+// are not ordered relative to each other.
+
+#define EVQ_BLOCK   0                  // producer waits when its ring is full
+#define EVQ_DROP    1                  // producer drops the record and counts it
+
+typedef void (*evq_consume_t)(void *ctx, const void *rec, uint32_t len);
+typedef void (*evq_flush_t)(void *ctx);
+
+typedef struct evq evq_t;
+
+evq_t    *Evq_New(size_t ring_bytes, int mode, int period_ms,
+                  evq_consume_t consume, evq_flush_t flush, void *ctx);
+int       Evq_Push(evq_t *q, const void *rec, uint32_t len);
+uint64_t  Evq_Dropped(evq_t *q);
+size_t    Evq_Bytes(evq_t *q);
+void      Evq_Stop(evq_t *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
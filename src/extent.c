@@ -0,0 +1,222 @@
+#include <string.h>
+#include "utils.h"
+#include "extent.h"
+
+#define EXT_MIN_CAP  4
+
+typedef struct extent_set {
+    extent_t *r;
+    uint32_t  n;
+    uint32_t  sorted;                  // r[0..sorted) is sorted and disjoint
+    uint32_t  cap;
+} extent_set_t;
+
+typedef struct extent_file {
+    char         *path;
+    extent_set_t  set[EXT_KINDS];
+} extent_file_t;
+
+static int      ext_enabled = 0;
+static uint64_t ext_gran = 4096;
+static Hash    *ext_files = NULL;
+static size_t   ext_bytes = 0;         // malloc'ed sizes
+static pthread_mutex_t extmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int cmp_extent(const void *a, const void *b) {
+    const extent_t *x = a, *y = b;
+    return x->start < y->start ? -1 : (x->start > y->start ? 1 : 0);
+}
+
+static void coalesce(extent_set_t *s) {
+    uint32_t out = 0;
+
+    if (s->sorted == s->n) {
+        return;
+    }
+    qsort(s->r, s->n, sizeof(extent_t), cmp_extent);
+    for (uint32_t i = 1; i < s->n; i++) {
+        if (s->r[i].start <= s->r[out].end) {
+            if (s->r[i].end > s->r[out].end) {
+                s->r[out].end = s->r[i].end;
+            }
+        }
+        else {
+            s->r[++out] = s->r[i];
+        }
+    }
+    s->n = s->sorted = out + 1;
+}
+
+static void set_add(extent_set_t *s, uint64_t start, uint64_t end) {
+    if (s->n > 0) {
+        extent_t *last = &s->r[s->n - 1];
+        if (start <= last->end && end >= last->start) {
+            if (start < last->start || end > last->end) {
+                if (start < last->start) {
+                    last->start = start;
+                }
+                if (end > last->end) {
+                    last->end = end;
+                }
+                // A widened last range may now overlap its sorted neighbours
+                if (s->sorted == s->n) {
+                    s->sorted--;
+                }
+            }
+            return;
+        }
+    }
+    if (s->n == s->cap) {
+        coalesce(s);
+        // Grow only if merging did not free a good part of the array
+        if (s->n > s->cap/2 || s->cap == 0) {
+            ext_bytes -= s->r != NULL ? malloc_usable_size(s->r) : 0;
+            s->cap = s->cap ? s->cap*2 : EXT_MIN_CAP;
+            s->r = realloc(s->r, s->cap*sizeof(extent_t));
+            ext_bytes += malloc_usable_size(s->r);
+        }
+    }
+    if (s->sorted == s->n && (s->n == 0 || start > s->r[s->n - 1].end)) {
+        s->sorted++;                   // appending in order keeps it sorted
+    }
+    s->r[s->n].start = start;
+    s->r[s->n].end = end;
+    s->n++;
+}
+
+void Extent_Init(uint32_t granularity) {
+    ext_gran = granularity > 0 ? granularity : 1;
+    ext_files = Hash_New(32);
+    ext_enabled = 1;
+}
+
+int Extent_Enabled(void) {
+    return ext_enabled;
+}
+
+void Extent_Add(const char *path, int kind, uint64_t offset, uint64_t len) {
+    extent_file_t *f;
+    uint64_t start, end;
+
+    if (!ext_enabled || len == 0 || kind < 0 || kind >= EXT_KINDS) {
+        return;
+    }
+    start = offset - offset % ext_gran;
+    end = offset + len;
+    if (end % ext_gran != 0) {
+        end += ext_gran - end % ext_gran;
+    }
+
+    pthread_mutex_lock(&extmutex);
+    f = Hash_Find(ext_files, path);
+    if (f == NULL) {
+        f = calloc(1, sizeof(extent_file_t));
+        f->path = strdup(path);
+        Hash_Add(ext_files, f->path, f);
+        ext_bytes += malloc_usable_size(f) + malloc_usable_size(f->path);
+    }
+    set_add(&f->set[kind], start, end);
+    pthread_mutex_unlock(&extmutex);
+}
+
+typedef struct extent_copy {
+    const char *path;
+    extent_t   *r[EXT_KINDS];
+    uint32_t    n[EXT_KINDS];
+} extent_copy_t;
+
+static int cmp_copy(const void *a, const void *b) {
+    return strcmp(((const extent_copy_t *)a)->path, ((const extent_copy_t *)b)->path);
+}
+
+void Extent_Foreach(extent_visit_t fn, void *ctx) {
+    extent_copy_t *files;
+    extent_file_t *f;
+    size_t n = 0;
+
+    if (!ext_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&extmutex);
+    files = malloc((kh_size(ext_files) + 1)*sizeof(extent_copy_t));
+    kh_foreach_value(ext_files, f, {
+        files[n].path = strdup(f->path);
+        for (int k = 0; k < EXT_KINDS; k++) {
+            extent_set_t *s = &f->set[k];
+            coalesce(s);
+            files[n].n[k] = s->n;
+            files[n].r[k] = NULL;
+            if (s->n > 0) {
+                files[n].r[k] = malloc(s->n*sizeof(extent_t));
+                memcpy(files[n].r[k], s->r, s->n*sizeof(extent_t));
+            }
+        }
+        n++;
+    });
+    pthread_mutex_unlock(&extmutex);
+
+    qsort(files, n, sizeof(extent_copy_t), cmp_copy);
+    for (size_t i = 0; i < n; i++) {
+        for (int k = 0; k < EXT_KINDS; k++) {
+            uint64_t bytes = 0;
+            if (files[i].n[k] == 0) {
+                continue;
+            }
+            for (uint32_t j = 0; j < files[i].n[k]; j++) {
+                bytes += files[i].r[k][j].end - files[i].r[k][j].start;
+            }
+            fn(ctx, files[i].path, k, files[i].r[k], files[i].n[k], bytes);
+            free(files[i].r[k]);
+        }
+        free((char *)files[i].path);
+    }
+    free(files);
+}
+
+static void free_files(void) {
+    extent_file_t *f;
+
+    kh_foreach_value(ext_files, f, {
+        for (int k = 0; k < EXT_KINDS; k++) {
+            free(f->set[k].r);
+        }
+        free(f->path);
+        free(f);
+    });
+}
+
+void Extent_Reset(void) {
+    if (!ext_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&extmutex);
+    free_files();
+    kh_clear(text, ext_files);
+    ext_bytes = 0;
+    pthread_mutex_unlock(&extmutex);
+}
+
+void Extent_Free(void) {
+    if (!ext_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&extmutex);
+    free_files();
+    Hash_Free(ext_files);
+    ext_files = NULL;
+    ext_enabled = 0;
+    ext_bytes = 0;
+    pthread_mutex_unlock(&extmutex);
+}
+
+size_t Extent_Bytes(void) {
+    size_t bytes;
+
+    if (!ext_enabled) {
+        return 0;
+    }
+    pthread_mutex_lock(&extmutex);
+    bytes = ext_bytes + Hash_Bytes(ext_files);
+    pthread_mutex_unlock(&extmutex);
+    return bytes;
+}
@@ -0,0 +1,44 @@
+#ifndef extent_h
+#define extent_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Extent maps: the byte ranges of each file that were read and written.
+// Ranges are widened to the granularity (a page by default) and appended
+// to a per-file array; adjacent appends, i.e. sequential I/O, extend the
+// last range in place. The array is sorted and coalesced only when it
+// fills up and when it is reported.
+
+#define EXT_READ   0
+#define EXT_WRITE  1
+#define EXT_KINDS  2
+
+typedef struct extent {
+    uint64_t start;
+    uint64_t end;                      // exclusive
+} extent_t;
+
+// ranges are sorted and disjoint; bytes is their total length
+typedef void (*extent_visit_t)(void *ctx, const char *path, int kind,
+                               const extent_t *ranges, size_t n, uint64_t bytes);
+
+void   Extent_Init(uint32_t granularity);
+int    Extent_Enabled(void);
+void   Extent_Add(const char *path, int kind, uint64_t offset, uint64_t len);
+// Calls fn for every file and kind with ranges, in path order. Ranges are
+// copied first, so fn runs without blocking Extent_Add().
+void   Extent_Foreach(extent_visit_t fn, void *ctx);
+void   Extent_Reset(void);
+void   Extent_Free(void);
+size_t Extent_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
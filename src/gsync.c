@@ -0,0 +1,127 @@
+#define _GNU_SOURCE                    // syncfs()
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "gsync.h"
+
+typedef struct sync_group {
+    int            count;              // members joined so far
+    int            refs;
+    int            closed;             // leader stopped accepting members
+    int            use_syncfs;
+    int            done;               // syncfs() finished, result is valid
+    int            result;
+    dev_t          dev;                // the leader's filesystem, what syncfs() flushes
+    pthread_cond_t cond;
+} sync_group_t;
+
+static int gs_window_us = 0;
+static int gs_threshold = 0;
+static sync_group_t *gs_open = NULL;
+static int gs_inflight = 0;            // callers inside GroupSync_Fsync()
+static pthread_mutex_t gsmutex = PTHREAD_MUTEX_INITIALIZER;
+
+void GroupSync_Init(int window_us, int syncfs_threshold) {
+    gs_window_us = window_us;
+    gs_threshold = syncfs_threshold;
+}
+
+static int sync_fd(int fd, int datasync) {
+    int res = datasync ? fdatasync(fd) : fsync(fd);
+    return res == -1 ? -errno : 0;
+}
+
+static dev_t fd_dev(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_dev : (dev_t)-1;
+}
+
+int GroupSync_Fsync(int fd, int datasync) {
+    sync_group_t *g;
+    int leader = 0;
+    int res;
+    dev_t dev;
+
+    if (gs_window_us <= 0) {
+        return sync_fd(fd, datasync);
+    }
+    dev = fd_dev(fd);
+
+    pthread_mutex_lock(&gsmutex);
+    gs_inflight++;
+    g = gs_open;
+    if (g == NULL && gs_inflight == 1) {
+        // Nobody else is syncing: waiting for a group would only add latency
+        pthread_mutex_unlock(&gsmutex);
+        res = sync_fd(fd, datasync);
+        pthread_mutex_lock(&gsmutex);
+        gs_inflight--;
+        pthread_mutex_unlock(&gsmutex);
+        return res;
+    }
+    if (g == NULL) {
+        g = calloc(1, sizeof(sync_group_t));
+        pthread_cond_init(&g->cond, NULL);
+        g->dev = dev;
+        gs_open = g;
+        leader = 1;
+    }
+    g->count++;
+    g->refs++;
+
+    if (leader) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)gs_window_us*1000;
+        deadline.tv_sec += deadline.tv_nsec/1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (gs_threshold <= 0 || g->count < gs_threshold) {
+            if (pthread_cond_timedwait(&g->cond, &gsmutex, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        gs_open = NULL;
+        g->closed = 1;
+        g->use_syncfs = gs_threshold > 0 && g->count >= gs_threshold;
+        pthread_cond_broadcast(&g->cond);
+
+        if (g->use_syncfs) {
+            pthread_mutex_unlock(&gsmutex);
+            res = syncfs(fd) == -1 ? -errno : 0;
+            pthread_mutex_lock(&gsmutex);
+            g->result = res;
+            g->done = 1;
+            pthread_cond_broadcast(&g->cond);
+        }
+    }
+    else {
+        if (gs_threshold > 0 && g->count >= gs_threshold) {
+            pthread_cond_broadcast(&g->cond);      // wake the leader early
+        }
+        while (!g->closed || (g->use_syncfs && !g->done)) {
+            pthread_cond_wait(&g->cond, &gsmutex);
+        }
+    }
+
+    // syncfs() only flushed the leader's filesystem; members on another one
+    // mounted inside the backing tree sync their own descriptor
+    if (g->use_syncfs && dev == g->dev && dev != (dev_t)-1) {
+        res = g->result;
+    }
+    else {
+        pthread_mutex_unlock(&gsmutex);
+        res = sync_fd(fd, datasync);
+        pthread_mutex_lock(&gsmutex);
+    }
+
+    if (--g->refs == 0) {
+        pthread_cond_destroy(&g->cond);
+        free(g);
+    }
+    gs_inflight--;
+    pthread_mutex_unlock(&gsmutex);
+    return res;
+}
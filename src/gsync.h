@@ -0,0 +1,20 @@
+#ifndef gsync_h
+#define gsync_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Group commit for fsync(): calls arriving within window_us of each other
+// form a group. Groups of at least syncfs_threshold members are flushed
+// with a single syncfs() of the leader's filesystem; members on another
+// filesystem, and everyone in smaller groups, fsync their own descriptors
+// in parallel. A call made while no other one is in flight never waits.
+void GroupSync_Init(int window_us, int syncfs_threshold);
+int  GroupSync_Fsync(int fd, int datasync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
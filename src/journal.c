@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include "evq.h"
+#include "sink.h"
+#include "journal.h"
+
+#define JOURNAL_BUF  (1 << 20)         // one sequential write per MB
+#define JOURNAL_SYNC_NS  1000000000ULL // compressed: flush the stream every second
+
+static evq_t   *jq = NULL;
+static int      jring_kb = 0;
+static sink_t  *jsink = NULL;
+static uint64_t jsynced = 0;
+static int      jdirty = 0;            // written since the last Sink_Flush()
+static char    *jbuf = NULL;
+static size_t   jlen = 0;
+static uint64_t jstart = 0;
+static int      jerror = 0;            // first write error, -errno
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// Only the first failure is reported; later writes are still attempted
+static void journal_failed(int rc) {
+    if (rc != 0 && __atomic_load_n(&jerror, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&jerror, rc, __ATOMIC_RELAXED);
+        fprintf(stderr, "Journal write failed, events are being lost: %s\n", strerror(-rc));
+    }
+}
+
+static void journal_flush(void *ctx) {
+    uint64_t now;
+
+    if (jlen > 0) {
+        journal_failed(Sink_Write(jsink, jbuf, jlen));
+        jlen = 0;
+        jdirty = 1;
+    }
+    // Bounds what a crash can lose inside the compressor; no-op when plain
+    if (jdirty) {
+        now = clock_ns(CLOCK_MONOTONIC);
+        if (now - jsynced >= JOURNAL_SYNC_NS) {
+            journal_failed(Sink_Flush(jsink));
+            jsynced = now;
+            jdirty = 0;
+        }
+    }
+}
+
+static void journal_consume(void *ctx, const void *rec, uint32_t len) {
+    if (jlen + len > JOURNAL_BUF) {
+        journal_flush(ctx);
+    }
+    memcpy(jbuf + jlen, rec, len);
+    jlen += len;
+}
+
+int Journal_Open(const char *file, const int *op_flags, int qn_ops,
+                 const char *mount_point, int ring_kb) {
+    journal_header_t hdr;
+
+    // "journal.gz" / "journal.zst" are compressed by the writer thread
+    jsink = Sink_Open(file, Sink_Kind(file), 0, 1);
+    if (jsink == NULL) {
+        return -errno;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, JOURNAL_MAGIC, sizeof(hdr.magic));
+    hdr.version = JOURNAL_VERSION;
+    hdr.qn_ops = qn_ops;
+    for (int i = 0; i < qn_ops && i < JOURNAL_MAX_OPS; i++) {
+        hdr.op_flags[i] = (uint8_t)op_flags[i];
+    }
+    jstart = clock_ns(CLOCK_MONOTONIC);
+    hdr.start_realtime_ns = clock_ns(CLOCK_REALTIME);
+    hdr.mount_len = mount_point ? strlen(mount_point) : 0;
+    if (Sink_Write(jsink, &hdr, sizeof(hdr)) != 0 ||
+        Sink_Write(jsink, mount_point, hdr.mount_len) != 0) {
+        int rc = Sink_Close(jsink, 0);
+        jsink = NULL;
+        return rc != 0 ? rc : -EIO;
+    }
+
+    jbuf = malloc(JOURNAL_BUF);
+    jring_kb = ring_kb;
+    return 0;
+}
+
+// Starts the writer thread; must run in the process that serves FUSE
+// requests, i.e. after fuse_main() has daemonized.
+int Journal_Start(void) {
+    if (jsink == NULL) {
+        return 0;
+    }
+    jq = Evq_New((size_t)jring_kb*1024, EVQ_BLOCK, 10, journal_consume, journal_flush, NULL);
+    if (jq == NULL) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+int Journal_Enabled(void) {
+    return jq != NULL;
+}
+
+void Journal_Path(uint32_t id, const char *path) {
+    char rec[sizeof(jrec_path_t) + PATH_MAX];
+    jrec_path_t *p = (jrec_path_t *)rec;
+    size_t len = strlen(path);
+
+    if (jq == NULL) {
+        return;
+    }
+    if (len > PATH_MAX) {
+        len = PATH_MAX;
+    }
+    memset(p, 0, sizeof(jrec_path_t));
+    p->type = JREC_PATH;
+    p->id = id;
+    p->len = (uint32_t)len;
+    memcpy(rec + sizeof(jrec_path_t), path, len);
+    Evq_Push(jq, rec, sizeof(jrec_path_t) + len);
+}
+
+void Journal_Event(uint32_t id, int op, int result) {
+    jrec_event_t e;
+
+    if (jq == NULL) {
+        return;
+    }
+    e.type = JREC_EVENT;
+    e.op = (uint8_t)op;
+    e.result = (uint8_t)result;
+    e.pad = 0;
+    e.id = id;
+    e.ts = clock_ns(CLOCK_MONOTONIC) - jstart;
+    Evq_Push(jq, &e, sizeof(e));
+}
+
+void Journal_Close(void) {
+    Evq_Stop(jq);
+    jq = NULL;
+    if (jsink != NULL) {
+        journal_flush(NULL);
+        journal_failed(Sink_Close(jsink, 1));
+        jsink = NULL;
+    }
+    free(jbuf);
+    jbuf = NULL;
+}
+
+int Journal_Error(void) {
+    return __atomic_load_n(&jerror, __ATOMIC_RELAXED);
+}
+
+// Rings and write buffer; the compressor's state is not included
+size_t Journal_Bytes(void) {
+    return Evq_Bytes(jq) + (jbuf != NULL ? JOURNAL_BUF : 0);
+}
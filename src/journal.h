@@ -0,0 +1,67 @@
+#ifndef journal_h
+#define journal_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Append-only event journal. The file starts with a journal_header_t
+// followed by records in native byte order:
+//   JREC_PATH   jrec_path_t + len bytes of path (no NUL), once per path id
+//   JREC_EVENT  jrec_event_t, one per recorded operation
+// Records written by different FUSE threads are not ordered, so a path
+// definition may follow the first event that uses its id.
+// A ".gz" or ".zst" file name compresses the whole stream (see sink.h).
+
+#define JOURNAL_MAGIC    "DFSJRN01"
+#define JOURNAL_VERSION  1
+#define JOURNAL_MAX_OPS  32
+
+#define JREC_PATH        1
+#define JREC_EVENT       2
+
+typedef struct journal_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t qn_ops;
+    uint8_t  op_flags[JOURNAL_MAX_OPS];    // [filter] setting per op
+    uint64_t start_realtime_ns;            // wall clock at ts == 0
+    uint32_t mount_len;                    // followed by the mount point
+    uint32_t reserved;
+} journal_header_t;
+
+typedef struct jrec_path {
+    uint8_t  type;
+    uint8_t  pad[3];
+    uint32_t id;
+    uint32_t len;
+} jrec_path_t;
+
+typedef struct jrec_event {
+    uint8_t  type;
+    uint8_t  op;
+    uint8_t  result;                       // LOG_SUCCESS or LOG_UNSUCCESS
+    uint8_t  pad;
+    uint32_t id;
+    uint64_t ts;                           // ns since journal start
+} jrec_event_t;
+
+int    Journal_Open(const char *file, const int *op_flags, int qn_ops,
+                    const char *mount_point, int ring_kb);
+int    Journal_Start(void);
+int    Journal_Enabled(void);
+void   Journal_Path(uint32_t id, const char *path);
+void   Journal_Event(uint32_t id, int op, int result);
+void   Journal_Close(void);
+// First write error of the journal (reported on stderr), 0 if none
+int    Journal_Error(void);
+size_t Journal_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "utils.h"
+#include "proc.h"
+
+#define PROC_MAX_PIDS  65536           // the cache is dropped when full
+
+typedef struct proc_slot {
+    uint64_t value;
+    uint64_t checked_ns;               // 0: never worked out
+    uint64_t tag;
+    uint32_t sig;                      // name and parent it was worked out for
+} proc_slot_t;
+
+typedef struct proc_entry {
+    proc_slot_t slot[PROC_SLOTS];
+} proc_entry_t;
+
+KHASH_MAP_INIT_INT(procs, proc_entry_t)
+
+static khash_t(procs)  *pr_cache = NULL;       // under prlock
+static pthread_rwlock_t prlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static ssize_t read_file(pid_t pid, const char *name, char *buf, size_t size) {
+    char file[48];
+    ssize_t len;
+    int fd;
+
+    snprintf(file, sizeof(file), "/proc/%d/%s", (int)pid, name);
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+// The first lines are enough
+int Proc_Status(pid_t pid, proc_info_t *pi) {
+    char buf[512];
+    char *line, *next;
+
+    if (read_file(pid, "status", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    memset(pi, 0, sizeof(proc_info_t));
+    pi->tgid = pid;
+    for (line = buf; line != NULL && *line != '\0'; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        if (strncmp(line, "Name:\t", 6) == 0) {
+            strncpy(pi->name, line + 6, PROC_NAME - 1);
+        }
+        else if (strncmp(line, "Tgid:\t", 6) == 0) {
+            pi->tgid = atoi(line + 6);
+        }
+        else if (strncmp(line, "PPid:\t", 6) == 0) {
+            pi->ppid = atoi(line + 6);
+            break;                     // after Name and Tgid
+        }
+    }
+    return pi->name[0] != '\0' ? 0 : -1;
+}
+
+int Proc_Cgroups(pid_t pid, char *buf, size_t size) {
+    return read_file(pid, "cgroup", buf, size) == -1 ? -1 : 0;
+}
+
+int Proc_Cgroup_Match(const char *cgroups, const char *prefix) {
+    size_t n = strlen(prefix);
+
+    for (const char *line = cgroups; line != NULL && *line != '\0'; ) {
+        const char *path = strchr(line, ':');
+        const char *eol = strchr(line, '\n');
+        size_t len;
+
+        path = path != NULL ? strchr(path + 1, ':') : NULL;
+        if (path == NULL) {
+            break;
+        }
+        path++;
+        len = eol != NULL ? (size_t)(eol - path) : strlen(path);
+        if (n <= len && strncmp(path, prefix, n) == 0 &&
+            (n == len || path[n] == '/' || (n > 0 && prefix[n - 1] == '/'))) {
+            return 1;
+        }
+        line = eol != NULL ? eol + 1 : NULL;
+    }
+    return 0;
+}
+
+uint64_t Proc_Now_Ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// FNV-1a of the name and the parent; 0 for a process that is gone
+static uint32_t proc_sig(const proc_info_t *pi) {
+    uint32_t h = 2166136261u;
+
+    if (pi == NULL) {
+        return 0;
+    }
+    for (const char *c = pi->name; *c != '\0'; c++) {
+        h = (h ^ (uint8_t)*c)*16777619u;
+    }
+    h = (h ^ (uint32_t)pi->ppid)*16777619u;
+    return h != 0 ? h : 1;
+}
+
+void Proc_Query(pid_t pid, proc_query_t *q, int n) {
+    proc_slot_t old[PROC_SLOTS];
+    proc_entry_t *e;
+    proc_info_t pi, *pp;
+    uint64_t now;
+    uint32_t sig;
+    unsigned missing = 0;
+    khint_t k;
+    int absent;
+
+    if (n == 0) {
+        return;
+    }
+    now = Proc_Now_Ns();
+    pthread_rwlock_rdlock(&prlock);
+    k = pr_cache != NULL ? kh_get(procs, pr_cache, pid) : 0;
+    for (int i = 0; i < n; i++) {
+        proc_slot_t *s;
+        if (pr_cache == NULL || k == kh_end(pr_cache)) {
+            memset(&old[i], 0, sizeof(proc_slot_t));
+            missing |= 1u << i;
+            continue;
+        }
+        s = &kh_value(pr_cache, k).slot[q[i].slot];
+        if (s->checked_ns != 0 && s->tag == q[i].tag && now - s->checked_ns < q[i].ttl_ns) {
+            q[i].value = s->value;
+        }
+        else {
+            old[i] = *s;
+            missing |= 1u << i;
+        }
+    }
+    pthread_rwlock_unlock(&prlock);
+    if (missing == 0) {
+        return;
+    }
+
+    pp = pid > 0 && Proc_Status(pid, &pi) == 0 ? &pi : NULL;
+    sig = proc_sig(pp);
+    for (int i = 0; i < n; i++) {
+        if (!(missing & (1u << i))) {
+            continue;
+        }
+        // Same name and parent: no exec(), or a reused pid that works out
+        // the same anyway
+        if (q[i].stable && old[i].checked_ns != 0 && old[i].tag == q[i].tag &&
+            sig != 0 && old[i].sig == sig) {
+            q[i].value = old[i].value;
+        }
+        else {
+            q[i].value = q[i].derive(pid, pp, q[i].ctx);
+        }
+    }
+
+    pthread_rwlock_wrlock(&prlock);
+    if (pr_cache == NULL) {
+        pr_cache = kh_init(procs);
+    }
+    if (kh_size(pr_cache) >= PROC_MAX_PIDS) {
+        kh_clear(procs, pr_cache);
+    }
+    k = kh_put(procs, pr_cache, pid, &absent);
+    e = &kh_value(pr_cache, k);
+    if (absent) {
+        memset(e, 0, sizeof(proc_entry_t));
+    }
+    for (int i = 0; i < n; i++) {
+        if (missing & (1u << i)) {
+            proc_slot_t *s = &e->slot[q[i].slot];
+            s->value = q[i].value;
+            s->checked_ns = now;
+            s->tag = q[i].tag;
+            s->sig = sig;
+        }
+    }
+    pthread_rwlock_unlock(&prlock);
+}
+
+void Proc_Cache_Free(void) {
+    pthread_rwlock_wrlock(&prlock);
+    if (pr_cache != NULL) {
+        kh_destroy(procs, pr_cache);
+        pr_cache = NULL;
+    }
+    pthread_rwlock_unlock(&prlock);
+}
+
+size_t Proc_Bytes(void) {
+    size_t bytes;
+
+    pthread_rwlock_rdlock(&prlock);
+    bytes = pr_cache != NULL ? HASH_ARRAY_BYTES(pr_cache, sizeof(khint32_t) + sizeof(proc_entry_t)) : 0;
+    pthread_rwlock_unlock(&prlock);
+    return bytes;
+}
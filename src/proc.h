@@ -0,0 +1,69 @@
+#ifndef proc_h
+#define proc_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// What the caller attribution and filters need to know about a process,
+// read from /proc. A pid from FUSE may be any thread's.
+
+#define PROC_NAME  16                  // TASK_COMM_LEN
+
+typedef struct proc_info {
+    pid_t tgid;                        // the process of the thread
+    pid_t ppid;
+    char  name[PROC_NAME];
+} proc_info_t;
+
+// Name, process and parent from /proc/<pid>/status; -1 if it is gone
+int Proc_Status(pid_t pid, proc_info_t *pi);
+// /proc/<pid>/cgroup, one "hierarchy:controllers:path" line per hierarchy
+// (a single "0::path" with cgroup v2); -1 if it is gone
+int Proc_Cgroups(pid_t pid, char *buf, size_t size);
+// True when a path in cgroups is prefix or below it: "/a/b" matches
+// "/a/b" and "/a/b/c", not "/a/bc"
+int Proc_Cgroup_Match(const char *cgroups, const char *prefix);
+
+// Coarse monotonic clock, enough to age cache entries
+uint64_t Proc_Now_Ns(void);
+
+// Per-pid cache shared by attribution, caller filters and sessions. Each
+// keeps a value per pid in its own slot, worked out from /proc again when
+// it is older than the slot's ttl or was worked out under another tag (a
+// generation of the user's settings). One lookup serves all the slots an
+// operation needs, and /proc/<pid>/status is read once for all of them.
+// The cache is dropped when full.
+
+#define PROC_SLOT_COMMAND   0          // attribution, see attrib.h
+#define PROC_SLOT_CALLER    1          // caller filter verdict
+#define PROC_SLOT_SESSIONS  2          // recording sessions of the pid
+#define PROC_SLOTS          3
+
+// pi is NULL when the process is gone
+typedef uint64_t (*proc_derive_t)(pid_t pid, const proc_info_t *pi, void *ctx);
+
+typedef struct proc_query {
+    int           slot;
+    uint64_t      ttl_ns;
+    uint64_t      tag;
+    int           stable;              // the value only depends on name and parent:
+                                       // kept past the ttl while they are the same
+    proc_derive_t derive;
+    void         *ctx;
+    uint64_t      value;               // result
+} proc_query_t;
+
+void   Proc_Query(pid_t pid, proc_query_t *q, int n);
+void   Proc_Cache_Free(void);
+size_t Proc_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+#include <string.h>
+#include "utils.h"
+#include "proc.h"
+#include "session.h"
+
+#define SESSION_MAX_DEPTH  64          // ancestors checked for a root
+
+typedef struct session {
+    char   name[SESSION_NAME_MAX];
+    pid_t  root;                       // 0 for a cgroup session
+    char  *cgroup;
+} session_t;
+
+static int              ss_enabled = 0;
+static uint64_t         ss_ttl_ns = 0;
+static session_clear_t  ss_clear = NULL;
+static session_t        ss[SESSION_MAX];       // under sslock
+static uint64_t         ss_running = 0;        // slot bits, written under sslock
+static uint32_t         ss_gen = 0;            // bumped when a session starts or ends,
+                                               // tags masks in the /proc cache
+static int              ss_last = SESSION_MAX - 1;
+static pthread_rwlock_t sslock = PTHREAD_RWLOCK_INITIALIZER;
+static char             ph_names[PHASE_MAX][SESSION_NAME_MAX]; // under phlock, never renamed
+static int              ph_count = 0;
+static uint64_t         ph_active = 0;         // written under phlock
+static pthread_mutex_t  phlock = PTHREAD_MUTEX_INITIALIZER;
+
+void Session_Init(int ttl_ms, session_clear_t clear) {
+    ss_ttl_ns = ttl_ms > 0 ? (uint64_t)ttl_ms*1000000ULL : 0;
+    ss_clear = clear;
+    ss_enabled = 1;
+}
+
+int Session_Enabled(void) {
+    return ss_enabled;
+}
+
+// Names end up in file names, "<log>.session.<name>": not one that looks
+// like another session's temporary file
+static int valid_name(const char *name) {
+    size_t len = strlen(name);
+
+    if (len == 0 || len >= SESSION_NAME_MAX || name[0] == '.' ||
+        (len >= 4 && strcmp(name + len - 4, ".tmp") == 0)) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+              c == '_' || c == '-' || c == '.')) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int Session_Start(const char *name, pid_t root, const char *cgroup) {
+    uint64_t running;
+    int slot = -1;
+
+    if (!ss_enabled || !valid_name(name) || (root <= 0 && cgroup == NULL)) {
+        return -EINVAL;
+    }
+    pthread_rwlock_wrlock(&sslock);
+    running = ss_running;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if ((running & (1ULL << i)) && strcmp(ss[i].name, name) == 0) {
+            pthread_rwlock_unlock(&sslock);
+            return -EEXIST;
+        }
+    }
+    // Round robin, so an ended session's slot and log stay around longest
+    for (int i = 1; i <= SESSION_MAX; i++) {
+        int s = (ss_last + i) % SESSION_MAX;
+        if (!(running & (1ULL << s))) {
+            slot = s;
+            break;
+        }
+    }
+    if (slot < 0) {
+        pthread_rwlock_unlock(&sslock);
+        return -ENOSPC;
+    }
+    ss_last = slot;
+    free(ss[slot].cgroup);
+    strcpy(ss[slot].name, name);
+    ss[slot].root = cgroup == NULL ? root : 0;
+    ss[slot].cgroup = cgroup != NULL ? strdup(cgroup) : NULL;
+    if (ss_clear != NULL) {
+        ss_clear(slot);
+    }
+    __atomic_store_n(&ss_running, running | 1ULL << slot, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&ss_gen, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&sslock);
+    return slot;
+}
+
+int Session_End(const char *name) {
+    uint64_t running;
+
+    if (!ss_enabled) {
+        return -ENOENT;
+    }
+    pthread_rwlock_wrlock(&sslock);
+    running = ss_running;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if ((running & (1ULL << i)) && strcmp(ss[i].name, name) == 0) {
+            __atomic_store_n(&ss_running, running & ~(1ULL << i), __ATOMIC_RELEASE);
+            __atomic_add_fetch(&ss_gen, 1, __ATOMIC_RELEASE);
+            pthread_rwlock_unlock(&sslock);
+            return i;
+        }
+    }
+    pthread_rwlock_unlock(&sslock);
+    return -ENOENT;
+}
+
+uint64_t Session_Running(void) {
+    return __atomic_load_n(&ss_running, __ATOMIC_ACQUIRE);
+}
+
+// Under sslock
+static uint64_t compute_mask(const proc_info_t *pi, uint64_t running) {
+    uint64_t roots = 0, mask = 0;
+    proc_info_t anc;
+    char cgroups[4096];
+    pid_t p;
+
+    if (pi == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < SESSION_MAX; i++) {
+        if ((running & (1ULL << i)) && ss[i].root > 0) {
+            roots |= 1ULL << i;
+        }
+    }
+
+    p = pi->tgid;
+    anc = *pi;
+    for (int d = 0; roots != 0 && d < SESSION_MAX_DEPTH && p > 0; d++) {
+        for (uint64_t rest = roots; rest != 0; rest &= rest - 1) {
+            int i = __builtin_ctzll(rest);
+            if (ss[i].root == p) {
+                mask |= 1ULL << i;
+            }
+        }
+        if (p == 1 || (d > 0 && Proc_Status(p, &anc) != 0)) {
+            break;
+        }
+        p = anc.ppid;
+    }
+
+    if ((running & ~roots) != 0 && Proc_Cgroups(pi->tgid, cgroups, sizeof(cgroups)) == 0) {
+        for (uint64_t rest = running & ~roots; rest != 0; rest &= rest - 1) {
+            int i = __builtin_ctzll(rest);
+            if (Proc_Cgroup_Match(cgroups, ss[i].cgroup)) {
+                mask |= 1ULL << i;
+            }
+        }
+    }
+    return mask;
+}
+
+static uint64_t derive_mask(pid_t pid, const proc_info_t *pi, void *ctx) {
+    uint64_t mask;
+
+    pthread_rwlock_rdlock(&sslock);
+    mask = compute_mask(pi, ss_running);
+    pthread_rwlock_unlock(&sslock);
+    return mask;
+}
+
+int Session_Query(proc_query_t *q) {
+    if (!ss_enabled || Session_Running() == 0) {
+        return 0;
+    }
+    q->slot = PROC_SLOT_SESSIONS;
+    q->ttl_ns = ss_ttl_ns;
+    // A mask worked out after a later start or end is only stored under
+    // the older tag, and worked out again on the next lookup
+    q->tag = __atomic_load_n(&ss_gen, __ATOMIC_ACQUIRE);
+    q->stable = 0;
+    q->derive = derive_mask;
+    q->ctx = NULL;
+    q->value = 0;
+    return 1;
+}
+
+// Without a lock: a slot's name only changes when Session_Start() reuses it
+const char *Session_Name(int slot) {
+    if (slot < 0 || slot >= SESSION_MAX || ss[slot].name[0] == '\0') {
+        return NULL;
+    }
+    return ss[slot].name;
+}
+
+int Session_Describe(int slot, char *buf, size_t size) {
+    int len;
+
+    pthread_rwlock_rdlock(&sslock);
+    if (ss[slot].cgroup != NULL) {
+        len = snprintf(buf, size, "%s cgroup %s", ss[slot].name, ss[slot].cgroup);
+    }
+    else {
+        len = snprintf(buf, size, "%s pid %d", ss[slot].name, (int)ss[slot].root);
+    }
+    pthread_rwlock_unlock(&sslock);
+    return len;
+}
+
+void Session_Free(void) {
+    if (!ss_enabled) {
+        return;
+    }
+    ss_enabled = 0;
+    for (int i = 0; i < SESSION_MAX; i++) {
+        free(ss[i].cgroup);
+        ss[i].cgroup = NULL;
+    }
+}
+
+size_t Session_Bytes(void) {
+    size_t bytes = 0;
+
+    if (!ss_enabled) {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&sslock);
+    for (int i = 0; i < SESSION_MAX; i++) {
+        bytes += ss[i].cgroup != NULL ? malloc_usable_size(ss[i].cgroup) : 0;
+    }
+    pthread_rwlock_unlock(&sslock);
+    return bytes;
+}
+
+// Under phlock
+static int phase_id(const char *name, int create) {
+    for (int i = 0; i < ph_count; i++) {
+        if (strcmp(ph_names[i], name) == 0) {
+            return i;
+        }
+    }
+    if (!create) {
+        return -ENOENT;
+    }
+    if (ph_count == PHASE_MAX) {
+        return -ENOSPC;
+    }
+    strcpy(ph_names[ph_count], name);
+    __atomic_store_n(&ph_count, ph_count + 1, __ATOMIC_RELEASE);
+    return ph_count - 1;
+}
+
+static int phase_set(const char *name, int only) {
+    int id;
+
+    if (!valid_name(name)) {
+        return -EINVAL;
+    }
+    pthread_mutex_lock(&phlock);
+    id = phase_id(name, 1);
+    if (id >= 0) {
+        __atomic_store_n(&ph_active, (only ? 0 : ph_active) | 1ULL << id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&phlock);
+    return id;
+}
+
+int Phase_Start(const char *name) {
+    return phase_set(name, 0);
+}
+
+int Phase_Switch(const char *name) {
+    return phase_set(name, 1);
+}
+
+int Phase_Stop(const char *name) {
+    int id;
+
+    pthread_mutex_lock(&phlock);
+    id = phase_id(name, 0);
+    if (id >= 0 && !(ph_active & (1ULL << id))) {
+        id = -ENOENT;
+    }
+    if (id >= 0) {
+        __atomic_store_n(&ph_active, ph_active & ~(1ULL << id), __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&phlock);
+    return id;
+}
+
+uint64_t Phase_Active(void) {
+    return __atomic_load_n(&ph_active, __ATOMIC_ACQUIRE);
+}
+
+int Phase_Count(void) {
+    return __atomic_load_n(&ph_count, __ATOMIC_ACQUIRE);
+}
+
+// Without a lock: names below Phase_Count() never change
+const char *Phase_Name(int id) {
+    if (id < 0 || id >= Phase_Count()) {
+        return NULL;
+    }
+    return ph_names[id];
+}
@@ -0,0 +1,66 @@
+#ifndef session_h
+#define session_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recording sessions: separate access sets for several builds sharing one
+// mount. A session is the process tree under a root pid (by default the
+// process that starts it through the control interface) or the processes
+// of a cgroup. Every entry has a bit per session slot, set when a process
+// of that session accessed it. The sessions of a caller are kept in the
+// shared /proc cache (proc.h), checked again after the ttl and whenever
+// sessions start or end.
+//
+// Phases tag time instead of processes: while a phase is active, every
+// recorded access sets its bit. They are started, stopped and switched
+// through the control interface; a phase's id is kept for the whole mount.
+
+#define SESSION_MAX       64
+#define SESSION_NAME_MAX  64
+#define PHASE_MAX         64
+
+// Clears the slot's bit in every entry before the slot is reused
+typedef void (*session_clear_t)(int slot);
+
+void        Session_Init(int ttl_ms, session_clear_t clear);
+int         Session_Enabled(void);
+// Slot of the new session; -EINVAL for a bad name, -EEXIST, -ENOSPC
+int         Session_Start(const char *name, pid_t root, const char *cgroup);
+// Slot of the ended session, or -ENOENT. The slot keeps its name until
+// it is reused, so the session's entries can still be written.
+int         Session_End(const char *name);
+// Bits of the running sessions
+uint64_t    Session_Running(void);
+// Sets up q for Proc_Query() on the calling pid, whose session bits are
+// then q->value; 0 when no session is running
+int         Session_Query(proc_query_t *q);
+const char *Session_Name(int slot);
+// "name pid 1234" or "name cgroup /path"
+int         Session_Describe(int slot, char *buf, size_t size);
+void        Session_Free(void);
+size_t      Session_Bytes(void);
+
+// Id of the phase; -EINVAL for a bad name, -ENOSPC once PHASE_MAX
+// names were used
+int         Phase_Start(const char *name);
+// -ENOENT when the phase is not active
+int         Phase_Stop(const char *name);
+// Stops every other phase
+int         Phase_Switch(const char *name);
+// Bits of the active phases, one atomic load
+uint64_t    Phase_Active(void);
+int         Phase_Count(void);
+const char *Phase_Name(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmstat.h"
+
+void Shmstat_Name(const char *mount_point, char *name, size_t size) {
+    size_t n = snprintf(name, size, "%s%s", SHMSTAT_PREFIX, mount_point);
+
+    for (size_t i = 1; i < n && i < size; i++) {
+        if (name[i] == '/') {
+            name[i] = '_';
+        }
+    }
+}
+
+shmstat_t *Shmstat_Create(const char *name) {
+    shmstat_t *s;
+    int fd;
+
+    fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(shmstat_t)) == -1) {
+        int err = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = err;
+        return NULL;
+    }
+    s = mmap(NULL, sizeof(shmstat_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    // Readers accept the segment only once the magic is there
+    s->version = SHMSTAT_VERSION;
+    s->size = sizeof(shmstat_t);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(s->magic, SHMSTAT_MAGIC, sizeof(s->magic));
+    return s;
+}
+
+void Shmstat_Destroy(shmstat_t *s, const char *name) {
+    if (s != NULL) {
+        munmap(s, sizeof(shmstat_t));
+        shm_unlink(name);
+    }
+}
+
+int Shmstat_Map(const char *name, const shmstat_t **s) {
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return -errno;
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(shmstat_t)) {
+        close(fd);
+        return -EINVAL;
+    }
+    map = mmap(NULL, sizeof(shmstat_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -errno;
+    }
+    *s = map;
+    if (memcmp((*s)->magic, SHMSTAT_MAGIC, sizeof((*s)->magic)) != 0 ||
+        (*s)->version != SHMSTAT_VERSION || (*s)->size != sizeof(shmstat_t)) {
+        munmap(map, sizeof(shmstat_t));
+        *s = NULL;
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int Shmstat_Read(const shmstat_t *s, shmstat_t *copy) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0) {
+            memcpy(copy, s, sizeof(shmstat_t));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) {
+                return 0;
+            }
+        }
+        sched_yield();
+    }
+    return -EAGAIN;
+}
@@ -0,0 +1,94 @@
+#ifndef shmstat_h
+#define shmstat_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Live statistics in a POSIX shared memory segment. The daemon rewrites
+// it from its service thread once per interval; readers (distillerfs-stat)
+// map it read-only and never talk to the mount.
+//
+// Updates are published with a sequence lock: seq is odd while the
+// writer is busy, and a reader retries until it copied the segment with
+// the same even seq before and after. Readers must check magic, version
+// and size; fields are only ever appended, with a version bump.
+
+#define SHMSTAT_MAGIC     "DFSSTAT"
+#define SHMSTAT_VERSION   1
+#define SHMSTAT_OPS       32
+#define SHMSTAT_MEM       8
+#define SHMSTAT_BUCKETS   192          // 4 per power of two of ns, see stats.h
+#define SHMSTAT_PREFIX    "/distillerfs"
+
+typedef struct shmstat_lat {
+    uint64_t count;
+    uint64_t p50;                      // nanoseconds
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} shmstat_lat_t;
+
+typedef struct shmstat {
+    char          magic[8];
+    uint32_t      version;
+    uint32_t      size;                // sizeof(shmstat_t) of the writer
+    uint64_t      seq;
+    int32_t       pid;
+    uint32_t      qn_ops;
+    uint32_t      n_mem;
+    uint32_t      interval_ms;
+    uint64_t      start_realtime_ns;
+    uint64_t      update_realtime_ns;
+    char          mount[256];
+    char          op_names[SHMSTAT_OPS][16];
+    char          mem_names[SHMSTAT_MEM][16];
+
+    uint32_t      recording;           // 0 while paused
+    uint32_t      latency;             // lat[] and hist[] are filled
+    uint64_t      entries;
+    uint64_t      paths_seen;
+    uint64_t      ok[SHMSTAT_OPS];
+    uint64_t      fail[SHMSTAT_OPS];
+    uint64_t      lock_acquired;
+    uint64_t      lock_contended;
+    uint64_t      lock_wait_ns;
+    uint64_t      hash_buckets;
+    uint64_t      hash_resizes;
+    uint64_t      hash_resize_ns;
+    uint64_t      mem[SHMSTAT_MEM];    // bytes
+    uint64_t      mem_limit;
+    shmstat_lat_t lat[SHMSTAT_OPS][3]; // total, backing, recording
+    uint64_t      hist[SHMSTAT_OPS][SHMSTAT_BUCKETS];  // total time
+} shmstat_t;
+
+// "/distillerfs" followed by the mount point with '/' turned into '_'
+void       Shmstat_Name(const char *mount_point, char *name, size_t size);
+
+// Writer side
+shmstat_t *Shmstat_Create(const char *name);
+void       Shmstat_Destroy(shmstat_t *s, const char *name);
+
+static inline void Shmstat_Write_Begin(shmstat_t *s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void Shmstat_Write_End(shmstat_t *s) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Reader side: maps name read-only; -errno on failure, -EINVAL on a
+// segment of another layout
+int        Shmstat_Map(const char *name, const shmstat_t **s);
+// Consistent copy; -EAGAIN if the writer kept it busy
+int        Shmstat_Read(const shmstat_t *s, shmstat_t *copy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
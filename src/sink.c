@@ -0,0 +1,463 @@
+#define _GNU_SOURCE                    // fopencookie()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "sink.h"
+
+#define SINK_BUF  (256*1024)           // compressed bytes per write()
+
+#ifndef IOV_MAX
+#define IOV_MAX   1024
+#endif
+
+struct sink {
+    int       kind;
+    int       fd;
+    int       own_fd;
+    int       failed;                  // first error, reported by Sink_Close
+    char     *out;
+    size_t    out_len;
+    z_stream  z;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zc;
+#endif
+};
+
+enum { SINK_CONTINUE, SINK_SYNC, SINK_END };
+
+int Sink_Kind(const char *file) {
+    size_t len = file ? strlen(file) : 0;
+
+    if (len > 3 && strcmp(file + len - 3, ".gz") == 0) {
+        return SINK_GZIP;
+    }
+    if (len > 4 && strcmp(file + len - 4, ".zst") == 0) {
+        return SINK_ZSTD;
+    }
+    return SINK_PLAIN;
+}
+
+const char *Sink_Suffix(int kind) {
+    switch (kind) {
+    case SINK_GZIP: return ".gz";
+    case SINK_ZSTD: return ".zst";
+    default:        return "";
+    }
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t res = write(fd, p, n);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        p += res;
+        n -= res;
+    }
+    return 0;
+}
+
+static int writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        int batch = cnt > IOV_MAX ? IOV_MAX : cnt;
+        ssize_t res = writev(fd, iov, batch);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        // skip fully written vectors, trim a partially written one
+        while (res > 0 && cnt > 0) {
+            if ((size_t)res >= iov->iov_len) {
+                res -= iov->iov_len;
+                iov++;
+                cnt--;
+            }
+            else {
+                iov->iov_base = (char *)iov->iov_base + res;
+                iov->iov_len -= res;
+                res = 0;
+            }
+        }
+        while (cnt > 0 && iov->iov_len == 0) {
+            iov++;
+            cnt--;
+        }
+    }
+    return 0;
+}
+
+static int drain_out(sink_t *s) {
+    int rc = write_all(s->fd, s->out, s->out_len);
+    s->out_len = 0;
+    return rc;
+}
+
+static int gzip_stream(sink_t *s, const void *buf, size_t len, int op) {
+    int flush = op == SINK_END ? Z_FINISH : (op == SINK_SYNC ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+    int rc;
+
+    s->z.next_in = (Bytef *)buf;
+    s->z.avail_in = len;
+    for (;;) {
+        s->z.next_out = (Bytef *)s->out + s->out_len;
+        s->z.avail_out = SINK_BUF - s->out_len;
+        rc = deflate(&s->z, flush);
+        s->out_len = SINK_BUF - s->z.avail_out;
+        if (rc == Z_STREAM_ERROR) {
+            return -EIO;
+        }
+        if (s->out_len == SINK_BUF && (rc = drain_out(s)) != 0) {
+            return rc;
+        }
+        if (flush == Z_FINISH ? rc == Z_STREAM_END : (s->z.avail_in == 0 && s->z.avail_out != 0)) {
+            break;
+        }
+    }
+    return 0;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_stream(sink_t *s, const void *buf, size_t len, int op) {
+    ZSTD_EndDirective mode = op == SINK_END ? ZSTD_e_end : (op == SINK_SYNC ? ZSTD_e_flush : ZSTD_e_continue);
+    ZSTD_inBuffer in = { buf, len, 0 };
+    int rc;
+
+    for (;;) {
+        ZSTD_outBuffer out = { s->out, SINK_BUF, s->out_len };
+        size_t remaining = ZSTD_compressStream2(s->zc, &out, &in, mode);
+        s->out_len = out.pos;
+        if (ZSTD_isError(remaining)) {
+            return -EIO;
+        }
+        if (s->out_len == SINK_BUF && (rc = drain_out(s)) != 0) {
+            return rc;
+        }
+        if (mode == ZSTD_e_continue ? in.pos == in.size : remaining == 0) {
+            break;
+        }
+    }
+    return 0;
+}
+#endif
+
+static int sink_stream(sink_t *s, const void *buf, size_t len, int op) {
+    int rc;
+
+    if (s->failed) {
+        return s->failed;
+    }
+    if (s->kind == SINK_GZIP) {
+        rc = gzip_stream(s, buf, len, op);
+    }
+#ifdef HAVE_ZSTD
+    else if (s->kind == SINK_ZSTD) {
+        rc = zstd_stream(s, buf, len, op);
+    }
+#endif
+    else {
+        rc = write_all(s->fd, buf, len);
+    }
+    if (rc == 0 && op != SINK_CONTINUE && s->out_len > 0) {
+        rc = drain_out(s);
+    }
+    s->failed = rc;
+    return rc;
+}
+
+sink_t *Sink_Open(const char *file, int kind, int level, int threads) {
+    sink_t *s;
+    int fd;
+
+#ifndef HAVE_ZSTD
+    if (kind == SINK_ZSTD) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+    fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+    s = Sink_Fd(fd);
+    s->own_fd = 1;
+    s->kind = kind;
+    if (kind == SINK_PLAIN) {
+        return s;
+    }
+
+    s->out = malloc(SINK_BUF);
+    if (kind == SINK_GZIP) {
+        // windowBits 15 + 16: gzip wrapper instead of zlib
+        if (deflateInit2(&s->z, level > 0 ? level : Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            errno = ENOMEM;
+            goto fail;
+        }
+    }
+#ifdef HAVE_ZSTD
+    else {
+        s->zc = ZSTD_createCCtx();
+        if (s->zc == NULL) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        ZSTD_CCtx_setParameter(s->zc, ZSTD_c_compressionLevel, level > 0 ? level : ZSTD_CLEVEL_DEFAULT);
+        if (threads > 1) {
+            // fails harmlessly on a single-threaded libzstd
+            ZSTD_CCtx_setParameter(s->zc, ZSTD_c_nbWorkers, threads);
+        }
+    }
+#endif
+    return s;
+
+fail:
+    close(fd);
+    free(s->out);
+    free(s);
+    return NULL;
+}
+
+sink_t *Sink_Fd(int fd) {
+    sink_t *s = calloc(1, sizeof(sink_t));
+    s->kind = SINK_PLAIN;
+    s->fd = fd;
+    return s;
+}
+
+int Sink_Write(sink_t *s, const void *buf, size_t len) {
+    return sink_stream(s, buf, len, SINK_CONTINUE);
+}
+
+int Sink_Writev(sink_t *s, const struct iovec *iov, int cnt) {
+    int rc = 0;
+
+    if (s->kind == SINK_PLAIN) {
+        struct iovec *copy;
+        if (s->failed) {
+            return s->failed;
+        }
+        // writev_all() trims partially written vectors in place
+        copy = malloc(cnt*sizeof(struct iovec));
+        memcpy(copy, iov, cnt*sizeof(struct iovec));
+        rc = writev_all(s->fd, copy, cnt);
+        free(copy);
+        s->failed = rc;
+        return rc;
+    }
+    for (int i = 0; i < cnt && rc == 0; i++) {
+        rc = sink_stream(s, iov[i].iov_base, iov[i].iov_len, SINK_CONTINUE);
+    }
+    return rc;
+}
+
+int Sink_Printf(sink_t *s, const char *fmt, ...) {
+    char line[1024];
+    char *p = line;
+    va_list ap;
+    int len, rc;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return -EINVAL;
+    }
+    if ((size_t)len >= sizeof(line)) {
+        p = malloc(len + 1);
+        va_start(ap, fmt);
+        vsnprintf(p, len + 1, fmt, ap);
+        va_end(ap);
+    }
+    rc = Sink_Write(s, p, len);
+    if (p != line) {
+        free(p);
+    }
+    return rc;
+}
+
+int Sink_Flush(sink_t *s) {
+    if (s->kind == SINK_PLAIN) {
+        return s->failed;
+    }
+    return sink_stream(s, NULL, 0, SINK_SYNC);
+}
+
+int Sink_Close(sink_t *s, int sync) {
+    int rc;
+
+    if (s == NULL) {
+        return 0;
+    }
+    rc = s->kind == SINK_PLAIN ? s->failed : sink_stream(s, NULL, 0, SINK_END);
+    if (s->kind == SINK_GZIP) {
+        deflateEnd(&s->z);
+    }
+#ifdef HAVE_ZSTD
+    if (s->zc != NULL) {
+        ZSTD_freeCCtx(s->zc);
+    }
+#endif
+    if (sync && fsync(s->fd) == -1 && rc == 0) {
+        rc = -errno;
+    }
+    if (s->own_fd && close(s->fd) == -1 && rc == 0) {
+        rc = -errno;
+    }
+    free(s->out);
+    free(s);
+    return rc;
+}
+
+// stdio wrappers
+
+typedef struct source {
+    int       kind;
+    int       fd;
+    gzFile    gz;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx     *zd;
+    ZSTD_inBuffer  in;
+    char          *in_buf;
+    int            eof;
+#endif
+} source_t;
+
+static ssize_t cookie_write(void *cookie, const char *buf, size_t len) {
+    return Sink_Write(cookie, buf, len) == 0 ? (ssize_t)len : -1;
+}
+
+static int cookie_close_sink(void *cookie) {
+    return Sink_Close(cookie, 0) == 0 ? 0 : EOF;
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t zstd_read(source_t *src, char *buf, size_t len) {
+    ZSTD_outBuffer out = { buf, len, 0 };
+
+    while (out.pos == 0) {
+        if (src->in.pos == src->in.size && !src->eof) {
+            ssize_t res = read(src->fd, src->in_buf, ZSTD_DStreamInSize());
+            if (res == -1) {
+                return -1;
+            }
+            if (res == 0) {
+                src->eof = 1;
+            }
+            src->in.src = src->in_buf;
+            src->in.size = res;
+            src->in.pos = 0;
+        }
+        // at end of file keep draining what the decoder holds; a frame
+        // truncated by a crash then just ends
+        if (ZSTD_isError(ZSTD_decompressStream(src->zd, &out, &src->in))) {
+            return -1;
+        }
+        if (src->eof && src->in.pos == src->in.size && out.pos == 0) {
+            break;
+        }
+    }
+    return out.pos;
+}
+#endif
+
+static ssize_t cookie_read(void *cookie, char *buf, size_t len) {
+    source_t *src = cookie;
+
+    if (src->kind == SINK_GZIP) {
+        int res = gzread(src->gz, buf, len > INT_MAX ? INT_MAX : (unsigned)len);
+        if (res < 0) {
+            // a truncated stream (crashed writer) reads as end of file
+            return gzeof(src->gz) ? 0 : -1;
+        }
+        return res;
+    }
+#ifdef HAVE_ZSTD
+    if (src->kind == SINK_ZSTD) {
+        return zstd_read(src, buf, len);
+    }
+#endif
+    return read(src->fd, buf, len);
+}
+
+static int cookie_close_source(void *cookie) {
+    source_t *src = cookie;
+
+    if (src->kind == SINK_GZIP) {
+        gzclose(src->gz);                   // closes fd
+    }
+    else {
+#ifdef HAVE_ZSTD
+        ZSTD_freeDCtx(src->zd);
+        free(src->in_buf);
+#endif
+        close(src->fd);
+    }
+    free(src);
+    return 0;
+}
+
+static FILE *open_source(const char *file) {
+    static const unsigned char gz_magic[2] = { 0x1f, 0x8b };
+    static const unsigned char zstd_magic[4] = { 0x28, 0xb5, 0x2f, 0xfd };
+    cookie_io_functions_t io = { cookie_read, NULL, NULL, cookie_close_source };
+    unsigned char magic[4] = { 0 };
+    source_t *src;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    if (pread(fd, magic, sizeof(magic), 0) < 0) {
+        close(fd);
+        return NULL;
+    }
+    src = calloc(1, sizeof(source_t));
+    src->fd = fd;
+    if (memcmp(magic, gz_magic, sizeof(gz_magic)) == 0) {
+        src->kind = SINK_GZIP;
+        src->gz = gzdopen(fd, "r");
+        gzbuffer(src->gz, SINK_BUF);
+    }
+    else if (memcmp(magic, zstd_magic, sizeof(zstd_magic)) == 0) {
+#ifdef HAVE_ZSTD
+        src->kind = SINK_ZSTD;
+        src->zd = ZSTD_createDCtx();
+        src->in_buf = malloc(ZSTD_DStreamInSize());
+#else
+        close(fd);
+        free(src);
+        errno = ENOTSUP;
+        return NULL;
+#endif
+    }
+    return fopencookie(src, "r", io);
+}
+
+FILE *Sink_Fopen(const char *file, const char *mode) {
+    cookie_io_functions_t io = { NULL, cookie_write, NULL, cookie_close_sink };
+    sink_t *s;
+
+    if (mode[0] == 'r') {
+        return open_source(file);
+    }
+    s = Sink_Open(file, Sink_Kind(file), 0, 1);
+    if (s == NULL) {
+        return NULL;
+    }
+    return fopencookie(s, mode, io);
+}
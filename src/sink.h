@@ -0,0 +1,49 @@
+#ifndef sink_h
+#define sink_h
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Output sink: a file written sequentially, optionally through a streaming
+// compressor. gzip (zlib) is always available; zstd when built with
+// HAVE_ZSTD, using libzstd worker threads for block compression.
+
+#define SINK_PLAIN  0
+#define SINK_GZIP   1
+#define SINK_ZSTD   2
+
+typedef struct sink sink_t;
+
+// Compression implied by the file name suffix (".gz", ".zst")
+int         Sink_Kind(const char *file);
+const char *Sink_Suffix(int kind);
+
+// level 0 selects the library default. Returns NULL and sets errno on
+// failure (ENOTSUP for zstd without HAVE_ZSTD).
+sink_t     *Sink_Open(const char *file, int kind, int level, int threads);
+// Plain sink over an open descriptor, which Sink_Close() leaves open
+sink_t     *Sink_Fd(int fd);
+
+int         Sink_Write(sink_t *s, const void *buf, size_t len);
+int         Sink_Writev(sink_t *s, const struct iovec *iov, int cnt);
+int         Sink_Printf(sink_t *s, const char *fmt, ...)
+                __attribute__((format(printf, 2, 3)));
+// Makes everything written so far decodable from the file
+int         Sink_Flush(sink_t *s);
+// Ends the stream; fsync()s the file first if sync is set
+int         Sink_Close(sink_t *s, int sync);
+
+// stdio wrappers for tools: "w" compresses by suffix, "r" decompresses
+// gzip/zstd input detected by magic bytes and passes other files through
+FILE       *Sink_Fopen(const char *file, const char *mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
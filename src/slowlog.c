@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fuse.h>
+#include "evq.h"
+#include "slowlog.h"
+
+#define SLOWLOG_RING  (64*1024)        // per thread; slow ops are rare
+
+typedef struct slow_rec {
+    uint64_t ts;                       // CLOCK_REALTIME, ns
+    uint64_t total_ns;
+    uint64_t backing_ns;
+    int32_t  pid;
+    int16_t  op;
+    int16_t  err;
+    uint32_t len;                      // path bytes that follow
+} slow_rec_t;
+
+uint64_t slowlog_threshold_ns = UINT64_MAX;
+
+static evq_t       *sq = NULL;
+static FILE        *sfp = NULL;
+static char        *sfile = NULL;
+static size_t       smax = 0;
+static size_t       swritten = 0;
+static const char **snames = NULL;
+
+static void slowlog_rotate(void) {
+    char old[PATH_MAX + 3];
+
+    fclose(sfp);
+    snprintf(old, sizeof(old), "%s.1", sfile);
+    rename(sfile, old);
+    sfp = fopen(sfile, "w");
+    swritten = 0;
+}
+
+static void slowlog_consume(void *ctx, const void *data, uint32_t len) {
+    const slow_rec_t *r = data;
+    const char *path = (const char *)(r + 1);
+    time_t sec = r->ts/1000000000ULL;
+    struct tm tm;
+    char stamp[32];
+    int n;
+
+    if (sfp == NULL) {
+        return;
+    }
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    n = fprintf(sfp, "%s.%06u %s pid=%d errno=%d total_us=%" PRIu64 " backing_us=%" PRIu64 " %.*s\n",
+                stamp, (unsigned)(r->ts%1000000000ULL/1000), snames[r->op], r->pid, r->err,
+                r->total_ns/1000, r->backing_ns/1000, (int)r->len, path);
+    if (n > 0) {
+        swritten += n;
+    }
+    if (smax > 0 && swritten >= smax) {
+        slowlog_rotate();
+    }
+}
+
+static void slowlog_flush(void *ctx) {
+    if (sfp != NULL) {
+        fflush(sfp);
+    }
+}
+
+int Slowlog_Open(const char *file, int threshold_ms, int max_kb, const char **op_names) {
+    sfp = fopen(file, "a");
+    if (sfp == NULL) {
+        return -errno;
+    }
+    fseek(sfp, 0, SEEK_END);
+    swritten = ftell(sfp);
+    sfile = strdup(file);
+    smax = (size_t)max_kb*1024;
+    snames = op_names;
+    slowlog_threshold_ns = (uint64_t)threshold_ms*1000000ULL;
+    return 0;
+}
+
+int Slowlog_Start(void) {
+    if (sfp == NULL) {
+        return 0;
+    }
+    sq = Evq_New(SLOWLOG_RING, EVQ_DROP, 100, slowlog_consume, slowlog_flush, NULL);
+    if (sq == NULL) {
+        slowlog_threshold_ns = UINT64_MAX;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+void Slowlog_Add(int op, const char *path, int res, uint64_t total_ns, uint64_t backing_ns) {
+    char rec[sizeof(slow_rec_t) + PATH_MAX];
+    slow_rec_t *r = (slow_rec_t *)rec;
+    struct timespec ts;
+    size_t len = path != NULL ? strlen(path) : 0;
+
+    if (sq == NULL) {
+        return;
+    }
+    if (len > PATH_MAX) {
+        len = PATH_MAX;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->ts = (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+    r->total_ns = total_ns;
+    r->backing_ns = backing_ns;
+    r->pid = fuse_get_context()->pid;
+    r->op = (int16_t)op;
+    r->err = res < 0 ? (int16_t)-res : 0;
+    r->len = (uint32_t)len;
+    memcpy(rec + sizeof(slow_rec_t), path, len);
+    Evq_Push(sq, rec, sizeof(slow_rec_t) + len);
+}
+
+void Slowlog_Close(void) {
+    uint64_t dropped = Evq_Dropped(sq);
+
+    slowlog_threshold_ns = UINT64_MAX;
+    Evq_Stop(sq);
+    sq = NULL;
+    if (sfp != NULL) {
+        if (dropped > 0) {
+            fprintf(sfp, "# %" PRIu64 " slow operations dropped, queue full\n", dropped);
+        }
+        fclose(sfp);
+        sfp = NULL;
+    }
+    free(sfile);
+    sfile = NULL;
+}
+
+size_t Slowlog_Bytes(void) {
+    return Evq_Bytes(sq);
+}
@@ -0,0 +1,36 @@
+#ifndef slowlog_h
+#define slowlog_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Slow operation log: operations that took longer than a threshold are
+// queued by the FUSE thread on its own ring (EVQ_DROP, so a burst never
+// stalls it) and written as text lines by a background thread:
+//
+//   2026-10-18T09:15:02.123456 read pid=4711 errno=0 total_us=2450123 backing_us=2450101 /src/big.o
+//
+// The file is rotated to "<file>.1" when it grows beyond max_kb.
+
+extern uint64_t slowlog_threshold_ns;  // UINT64_MAX while disabled
+
+int  Slowlog_Open(const char *file, int threshold_ms, int max_kb, const char **op_names);
+// Starts the writer thread; call after fuse_main() has daemonized
+int  Slowlog_Start(void);
+void Slowlog_Add(int op, const char *path, int res, uint64_t total_ns, uint64_t backing_ns);
+void Slowlog_Close(void);
+size_t Slowlog_Bytes(void);
+
+static inline int Slowlog_Is_Slow(uint64_t total_ns) {
+    return __builtin_expect(total_ns >= slowlog_threshold_ns, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stats.h"
+
+typedef struct stats_block {
+    struct stats_block *next;
+    int                 in_use;
+    uint64_t            ok[STATS_MAX_OPS];
+    uint64_t            fail[STATS_MAX_OPS];
+    uint64_t            max[STATS_MAX_OPS][STATS_KINDS];
+    uint64_t            sum[STATS_MAX_OPS][STATS_KINDS];
+    uint64_t            hist[STATS_MAX_OPS][STATS_KINDS][STATS_BUCKETS];
+    uint64_t            tl_bucket[STATS_TL_SLOTS];     // time bucket held by each slot
+    uint32_t            tl[STATS_TL_SLOTS][STATS_MAX_OPS];
+} stats_block_t;
+
+static stats_block_t   *blocks = NULL;
+static pthread_mutex_t  blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t    blocks_key;
+static pthread_once_t   blocks_once = PTHREAD_ONCE_INIT;
+static __thread stats_block_t *mine = NULL;
+__thread uint64_t stats_record_ns = 0;
+static uint64_t tl_interval_ns = 0;    // 0: no timeline
+static uint64_t tl_start_ns = 0;
+
+#define TL_SWITCHING  UINT64_MAX
+
+// The timeline needs bucket numbers, not precision: the coarse clock
+// is a plain vDSO read
+static inline uint64_t coarse_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void block_release(void *arg) {
+    stats_block_t *b = arg;
+    __atomic_store_n(&b->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_key(void) {
+    pthread_key_create(&blocks_key, block_release);
+}
+
+static stats_block_t *block_get(void) {
+    stats_block_t *b;
+
+    pthread_once(&blocks_once, make_key);
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b != NULL; b = b->next) {
+        if (__atomic_load_n(&b->in_use, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        }
+    }
+    if (b == NULL) {
+        b = calloc(1, sizeof(stats_block_t));
+        b->next = blocks;
+        blocks = b;
+    }
+    b->in_use = 1;
+    pthread_mutex_unlock(&blocks_lock);
+
+    pthread_setspecific(blocks_key, b);
+    return b;
+}
+
+// single writer: a relaxed store keeps readers from seeing torn values
+static inline void bump(uint64_t *c) {
+    __atomic_store_n(c, *c + 1, __ATOMIC_RELAXED);
+}
+
+void Stats_Op(int op, int success) {
+    stats_block_t *b = mine;
+
+    if (op < 0 || op >= STATS_MAX_OPS) {
+        return;
+    }
+    if (b == NULL) {
+        b = mine = block_get();
+    }
+    bump(success ? &b->ok[op] : &b->fail[op]);
+
+    if (tl_interval_ns > 0) {
+        uint64_t bucket = (coarse_now() - tl_start_ns)/tl_interval_ns;
+        int slot = bucket % STATS_TL_SLOTS;
+
+        if (b->tl_bucket[slot] != bucket) {
+            // Readers skip a slot that changes bucket while they read it
+            __atomic_store_n(&b->tl_bucket[slot], TL_SWITCHING, __ATOMIC_RELEASE);
+            for (int i = 0; i < STATS_MAX_OPS; i++) {
+                __atomic_store_n(&b->tl[slot][i], 0, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&b->tl_bucket[slot], bucket, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&b->tl[slot][op], b->tl[slot][op] + 1, __ATOMIC_RELAXED);
+    }
+}
+
+void Stats_Timeline_Init(int interval_ms) {
+    tl_start_ns = coarse_now();
+    __atomic_store_n(&tl_interval_ns, (uint64_t)interval_ms*1000000ULL, __ATOMIC_RELEASE);
+}
+
+uint64_t Stats_Timeline_Now(void) {
+    if (tl_interval_ns == 0) {
+        return 0;
+    }
+    return (coarse_now() - tl_start_ns)/tl_interval_ns;
+}
+
+int Stats_Timeline_Sum(uint64_t bucket, uint64_t *counts, int n_ops) {
+    int slot = bucket % STATS_TL_SLOTS;
+    int complete = 1;
+
+    memset(counts, 0, n_ops*sizeof(uint64_t));
+    pthread_mutex_lock(&blocks_lock);
+    for (stats_block_t *b = blocks; b != NULL; b = b->next) {
+        uint32_t c[STATS_MAX_OPS];
+        uint64_t held = __atomic_load_n(&b->tl_bucket[slot], __ATOMIC_ACQUIRE);
+
+        if (held == bucket) {
+            for (int i = 0; i < n_ops && i < STATS_MAX_OPS; i++) {
+                c[i] = __atomic_load_n(&b->tl[slot][i], __ATOMIC_RELAXED);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&b->tl_bucket[slot], __ATOMIC_RELAXED) == bucket) {
+                for (int i = 0; i < n_ops && i < STATS_MAX_OPS; i++) {
+                    counts[i] += c[i];
+                }
+                continue;
+            }
+            held = TL_SWITCHING;
+        }
+        // a slot already reused for a later bucket lost this one
+        if (held != TL_SWITCHING && held > bucket) {
+            complete = 0;
+        }
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    return complete ? 0 : -1;
+}
+
+// 0..3 exact, then 4 buckets per power of two
+static inline int bucket_of(uint64_t ns) {
+    int msb;
+
+    if (ns < 4) {
+        return (int)ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    if (msb > STATS_BUCKETS/4) {
+        return STATS_BUCKETS - 1;
+    }
+    return msb*4 + (int)((ns >> (msb - 2)) & 3) - 4;
+}
+
+uint64_t Stats_Bucket_Floor(int idx) {
+    if (idx < 4) {
+        return idx;
+    }
+    return (uint64_t)(4 + idx%4) << (idx/4 - 1);
+}
+
+// Middle of the bucket's range
+static uint64_t bucket_value(int idx) {
+    int msb, sub;
+
+    if (idx < 4) {
+        return idx;
+    }
+    msb = idx/4 + 1;
+    sub = idx%4;
+    return ((uint64_t)(4 + sub) << (msb - 2)) + ((1ULL << (msb - 2)) >> 1);
+}
+
+static inline void add_time(stats_block_t *b, int op, int kind, uint64_t ns) {
+    bump(&b->hist[op][kind][bucket_of(ns)]);
+    __atomic_store_n(&b->sum[op][kind], b->sum[op][kind] + ns, __ATOMIC_RELAXED);
+    if (ns > b->max[op][kind]) {
+        __atomic_store_n(&b->max[op][kind], ns, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t Stats_Time(int op, uint64_t total_ns) {
+    stats_block_t *b = mine;
+    uint64_t record_ns = stats_record_ns;
+
+    stats_record_ns = 0;
+    if (op < 0 || op >= STATS_MAX_OPS) {
+        return 0;
+    }
+    if (b == NULL) {
+        b = mine = block_get();
+    }
+    if (record_ns > total_ns) {
+        record_ns = total_ns;
+    }
+    add_time(b, op, STATS_TOTAL, total_ns);
+    add_time(b, op, STATS_BACKING, total_ns - record_ns);
+    add_time(b, op, STATS_RECORD, record_ns);
+    return record_ns;
+}
+
+void Stats_Sum(uint64_t *ok, uint64_t *fail, int n_ops) {
+    stats_block_t *b;
+
+    memset(ok, 0, n_ops*sizeof(uint64_t));
+    memset(fail, 0, n_ops*sizeof(uint64_t));
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b != NULL; b = b->next) {
+        for (int i = 0; i < n_ops && i < STATS_MAX_OPS; i++) {
+            ok[i] += __atomic_load_n(&b->ok[i], __ATOMIC_RELAXED);
+            fail[i] += __atomic_load_n(&b->fail[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+uint64_t Stats_Histogram(int op, int kind, uint64_t hist[STATS_BUCKETS]) {
+    uint64_t max = 0;
+
+    memset(hist, 0, STATS_BUCKETS*sizeof(uint64_t));
+    if (op < 0 || op >= STATS_MAX_OPS || kind < 0 || kind >= STATS_KINDS) {
+        return 0;
+    }
+    pthread_mutex_lock(&blocks_lock);
+    for (stats_block_t *b = blocks; b != NULL; b = b->next) {
+        uint64_t m = __atomic_load_n(&b->max[op][kind], __ATOMIC_RELAXED);
+        for (int i = 0; i < STATS_BUCKETS; i++) {
+            hist[i] += __atomic_load_n(&b->hist[op][kind][i], __ATOMIC_RELAXED);
+        }
+        if (m > max) {
+            max = m;
+        }
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    return max;
+}
+
+uint64_t Stats_Time_Sum(int op, int kind) {
+    uint64_t sum = 0;
+
+    if (op < 0 || op >= STATS_MAX_OPS || kind < 0 || kind >= STATS_KINDS) {
+        return 0;
+    }
+    pthread_mutex_lock(&blocks_lock);
+    for (stats_block_t *b = blocks; b != NULL; b = b->next) {
+        sum += __atomic_load_n(&b->sum[op][kind], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    return sum;
+}
+
+void Stats_Percentiles(const uint64_t hist[STATS_BUCKETS], uint64_t max, stats_lat_t *lat) {
+    const double q[3] = { 0.50, 0.99, 0.999 };
+    uint64_t *out[3] = { &lat->p50, &lat->p99, &lat->p999 };
+    uint64_t seen = 0;
+    int next = 0;
+
+    memset(lat, 0, sizeof(stats_lat_t));
+    lat->max = max;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        lat->count += hist[i];
+    }
+    for (int i = 0; i < STATS_BUCKETS && next < 3; i++) {
+        seen += hist[i];
+        while (next < 3 && hist[i] > 0 && seen >= (uint64_t)(q[next]*lat->count + 0.5)) {
+            uint64_t v = bucket_value(i);
+            *out[next++] = v < max ? v : max;
+        }
+    }
+}
+
+void Stats_Latency(int op, stats_lat_t lat[STATS_KINDS]) {
+    uint64_t hist[STATS_BUCKETS];
+
+    for (int k = 0; k < STATS_KINDS; k++) {
+        uint64_t max = Stats_Histogram(op, k, hist);
+        Stats_Percentiles(hist, max, &lat[k]);
+    }
+}
+
+size_t Stats_Bytes(void) {
+    size_t bytes = 0;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (stats_block_t *b = blocks; b != NULL; b = b->next) {
+        bytes += sizeof(stats_block_t);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    return bytes;
+}
@@ -0,0 +1,109 @@
+#ifndef stats_h
+#define stats_h
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per-thread operation counters and latency histograms. Each FUSE thread
+// updates its own block without atomics or locks; readers sum all blocks,
+// so totals are exact once writers are quiet and never off by more than
+// in-flight ops. Blocks of exited threads are handed to new threads,
+// keeping their counts.
+//
+// Histograms are log-bucketed: 4 buckets per power of two of
+// nanoseconds, i.e. at most ~19% error, plus an exact maximum.
+
+#define STATS_MAX_OPS   32
+#define STATS_BUCKETS   192
+#define STATS_TL_SLOTS  64             // timeline buckets kept per thread
+
+#define STATS_TOTAL     0              // whole handler
+#define STATS_BACKING   1              // total minus recording
+#define STATS_RECORD    2              // Store_In_Hash(), filters included
+#define STATS_KINDS     3
+
+typedef struct stats_lat {
+    uint64_t count;
+    uint64_t p50;                      // nanoseconds
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} stats_lat_t;
+
+// A mutex that counts how often it was taken, how often a thread had to
+// wait for it and for how long. The uncontended path costs one trylock;
+// counters are only written by the holder.
+typedef struct stats_mutex {
+    pthread_mutex_t lock;
+    uint64_t        acquired;
+    uint64_t        contended;
+    uint64_t        wait_ns;
+} stats_mutex_t;
+
+#define STATS_MUTEX_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0 }
+
+extern __thread uint64_t stats_record_ns;
+
+// CLOCK_MONOTONIC is served from the vDSO, no system call
+static inline uint64_t Stats_Clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// Recording code adds its own duration for the current operation
+static inline void Stats_Record(uint64_t ns) {
+    stats_record_ns += ns;
+}
+
+static inline void Stats_Lock(stats_mutex_t *m) {
+    if (pthread_mutex_trylock(&m->lock) != 0) {
+        uint64_t t0 = Stats_Clock();
+        pthread_mutex_lock(&m->lock);
+        __atomic_store_n(&m->contended, m->contended + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&m->wait_ns, m->wait_ns + Stats_Clock() - t0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&m->acquired, m->acquired + 1, __ATOMIC_RELAXED);
+}
+
+static inline void Stats_Unlock(stats_mutex_t *m) {
+    pthread_mutex_unlock(&m->lock);
+}
+
+void Stats_Op(int op, int success);
+// Ends an operation that took total_ns, of which stats_record_ns recording;
+// returns the recording time
+uint64_t Stats_Time(int op, uint64_t total_ns);
+
+// Sums all threads into ok[n_ops] / fail[n_ops]
+void Stats_Sum(uint64_t *ok, uint64_t *fail, int n_ops);
+// Percentiles of op over all threads, one per STATS_* kind
+void Stats_Latency(int op, stats_lat_t lat[STATS_KINDS]);
+// Merged histogram of one op and kind; returns the maximum
+uint64_t Stats_Histogram(int op, int kind, uint64_t hist[STATS_BUCKETS]);
+void Stats_Percentiles(const uint64_t hist[STATS_BUCKETS], uint64_t max, stats_lat_t *lat);
+// Nanoseconds spent in op, summed over all threads
+uint64_t Stats_Time_Sum(int op, int kind);
+// Smallest duration counted in histogram bucket idx; a power of two
+// starts every 4th bucket
+uint64_t Stats_Bucket_Floor(int idx);
+// Timeline: operations are also counted per fixed time bucket, in a ring
+// of STATS_TL_SLOTS buckets per thread. A bucket has to be read before
+// its slot comes round again.
+void     Stats_Timeline_Init(int interval_ms);
+uint64_t Stats_Timeline_Now(void);     // current bucket number
+// Sums bucket over all threads; -1 if some thread already reused its slot
+int      Stats_Timeline_Sum(uint64_t bucket, uint64_t *counts, int n_ops);
+// Memory held by the per-thread blocks
+size_t Stats_Bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <fuse.h>
+#include "evq.h"
+#include "trace.h"
+
+#define TRACE_RING  (256*1024)         // per thread
+
+typedef struct trace_rec {
+    uint64_t begin_ns;                 // since the trace started
+    uint64_t dur_ns;
+    int32_t  tid;
+    int32_t  pid;                      // caller
+    int32_t  res;
+    int16_t  op;
+    uint16_t len;                      // path bytes that follow
+} trace_rec_t;
+
+int      trace_enabled = 0;
+uint32_t trace_sample = 1000;
+uint64_t trace_slow_ns = UINT64_MAX;
+__thread uint32_t trace_rng = 0;
+
+static __thread int32_t my_tid = 0;
+static evq_t       *tq = NULL;
+static FILE        *tfp = NULL;
+static uint64_t     tstart = 0;
+static int          tpid = 0;
+static int          tfirst = 1;
+static const char **tnames = NULL;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void put_json_string(FILE *fp, const char *s, size_t len) {
+    putc('"', fp);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            putc('\\', fp);
+            putc(c, fp);
+        }
+        else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        }
+        else {
+            putc(c, fp);
+        }
+    }
+    putc('"', fp);
+}
+
+static void trace_consume(void *ctx, const void *data, uint32_t len) {
+    const trace_rec_t *r = data;
+
+    fprintf(tfp, "%s{\"name\":\"%s\",\"cat\":\"fuse\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"path\":",
+            tfirst ? "" : ",\n", tnames[r->op], r->begin_ns/1e3, r->dur_ns/1e3, tpid, r->tid);
+    put_json_string(tfp, (const char *)(r + 1), r->len);
+    fprintf(tfp, ",\"caller\":%d,\"result\":%d}}", r->pid, r->res);
+    tfirst = 0;
+}
+
+static void trace_flush(void *ctx) {
+    fflush(tfp);
+}
+
+int Trace_Open(const char *file, int sample, int slow_ms, const char **op_names) {
+    tfp = fopen(file, "w");
+    if (tfp == NULL) {
+        return -errno;
+    }
+    fprintf(tfp, "[\n");
+    trace_sample = sample > 0 ? sample : 1;
+    trace_slow_ns = slow_ms > 0 ? (uint64_t)slow_ms*1000000ULL : UINT64_MAX;
+    tnames = op_names;
+    return 0;
+}
+
+int Trace_Start(void) {
+    if (tfp == NULL) {
+        return 0;
+    }
+    tq = Evq_New(TRACE_RING, EVQ_DROP, 100, trace_consume, trace_flush, NULL);
+    if (tq == NULL) {
+        return -ENOMEM;
+    }
+    tpid = getpid();
+    tstart = mono_ns();
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void Trace_Add(int op, const char *path, int res, uint64_t begin_ns, uint64_t dur_ns) {
+    char rec[sizeof(trace_rec_t) + PATH_MAX];
+    trace_rec_t *r = (trace_rec_t *)rec;
+    size_t len = path != NULL ? strlen(path) : 0;
+
+    if (tq == NULL) {
+        return;
+    }
+    if (my_tid == 0) {
+        my_tid = (int32_t)syscall(SYS_gettid);
+    }
+    if (len > PATH_MAX) {
+        len = PATH_MAX;
+    }
+    r->begin_ns = begin_ns > tstart ? begin_ns - tstart : 0;
+    r->dur_ns = dur_ns;
+    r->tid = my_tid;
+    r->pid = fuse_get_context()->pid;
+    r->res = res;
+    r->op = (int16_t)op;
+    r->len = (uint16_t)len;
+    memcpy(rec + sizeof(trace_rec_t), path, len);
+    Evq_Push(tq, rec, sizeof(trace_rec_t) + len);
+}
+
+void Trace_Close(void) {
+    uint64_t dropped = Evq_Dropped(tq);
+
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+    Evq_Stop(tq);
+    tq = NULL;
+    if (tfp != NULL) {
+        if (dropped > 0) {
+            fprintf(tfp, "%s{\"name\":\"dropped events\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":%d,\"tid\":0,"
+                    "\"args\":{\"count\":%" PRIu64 "}}", tfirst ? "" : ",\n", (mono_ns() - tstart)/1e3, tpid, dropped);
+        }
+        fprintf(tfp, "\n]\n");
+        fclose(tfp);
+        tfp = NULL;
+    }
+}
+
+size_t Trace_Bytes(void) {
+    return Evq_Bytes(tq);
+}
@@ -0,0 +1,52 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Chrome trace-event export: one in `sample` operations at random (a
+// counter would lock onto a single op in repetitive patterns), and every
+// operation slower than slow_ns, becomes a complete ("X") event in a JSON
+// array that Perfetto and chrome://tracing open directly. Events are
+// queued on the calling thread's ring (EVQ_DROP) and formatted by a
+// background thread. The array is closed at unmount; the viewers also
+// accept a file cut short.
+
+extern int      trace_enabled;
+extern uint32_t trace_sample;
+extern uint64_t trace_slow_ns;
+extern __thread uint32_t trace_rng;
+
+int  Trace_Open(const char *file, int sample, int slow_ms, const char **op_names);
+// Starts the writer thread; call after fuse_main() has daemonized
+int  Trace_Start(void);
+// begin_ns on the CLOCK_MONOTONIC scale of Stats_Clock()
+void Trace_Add(int op, const char *path, int res, uint64_t begin_ns, uint64_t dur_ns);
+void Trace_Close(void);
+size_t Trace_Bytes(void);
+
+static inline int Trace_Wants(uint64_t dur_ns) {
+    if (__builtin_expect(!trace_enabled, 1)) {
+        return 0;
+    }
+    if (dur_ns >= trace_slow_ns) {
+        return 1;
+    }
+    if (trace_rng == 0) {
+        trace_rng = (uint32_t)(uintptr_t)&trace_rng | 1;     // per-thread seed
+    }
+    trace_rng ^= trace_rng << 13;                            // xorshift32
+    trace_rng ^= trace_rng >> 17;
+    trace_rng ^= trace_rng << 5;
+    return trace_rng % trace_sample == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdarg.h>
+#include <string.h>
 #include "utils.h"
 
 kh_text_t *Hash_New(int initial_size) {
@@ -57,3 +58,39 @@ void Hash_Delete(khash_t(text) *h, const char *key) {
         kh_del(text, h, k);
     }
 }
+
+size_t Hash_Bytes(const khash_t(text) *h) {
+    return sizeof(*h) + HASH_ARRAY_BYTES(h, sizeof(kh_cstr_t) + sizeof(void *));
+}
+
+// Replays the probe sequence of up to max_keys keys (0: all), spread
+// evenly over the table, and counts the slots each lookup visits
+void Hash_Probes(const khash_t(text) *h, uint32_t max_keys, hash_probes_t *out) {
+
+    khint_t stride = 1, mask;
+    uint64_t total = 0;
+
+    memset(out, 0, sizeof(hash_probes_t));
+    if (h->n_buckets == 0 || h->size == 0) {
+        return;
+    }
+    if (max_keys > 0 && h->size > max_keys) {
+        stride = h->size/max_keys;
+    }
+    mask = h->n_buckets - 1;
+    for (khint_t k = 0, seen = 0; k < kh_end(h); ++k) {
+        if (!kh_exist(h, k) || seen++ % stride != 0) {
+            continue;
+        }
+        khint_t i = kh_str_hash_func(kh_key(h, k)) & mask, step = 0;
+        while (i != k && step < h->n_buckets) {
+            i = (i + (++step)) & mask;
+        }
+        total += step + 1;
+        if (step + 1 > out->max) {
+            out->max = step + 1;
+        }
+        out->keys++;
+    }
+    out->mean = (double)total/out->keys;
+}
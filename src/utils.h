@@ -36,12 +36,24 @@ KHASH_MAP_INIT_STR(text, void*)
 
 #define Hash kh_text_t
 
+// Bytes held by a khash table's arrays, not counting what keys point to
+#define HASH_ARRAY_BYTES(h, slot_size) \
+    ((size_t)kh_n_buckets(h)*(slot_size) + __ac_fsize(kh_n_buckets(h))*sizeof(khint32_t))
+
+typedef struct hash_probes {
+    uint32_t keys;                     // keys examined
+    double   mean;                     // slots visited per lookup
+    uint32_t max;
+} hash_probes_t;
+
 kh_text_t *Hash_New(int initial_size);
 int        Hash_Add(khash_t(text) *h, const char *key, void *value);
 void       Hash_Free(khash_t(text) *h);
 int        Hash_SoftAdd(khash_t(text) *h, const char *key, void *value);
 void      *Hash_Find(khash_t(text) *h, const char *key);
 void       Hash_Delete(khash_t(text) *h, const char *key);
+size_t     Hash_Bytes(const khash_t(text) *h);
+void       Hash_Probes(const khash_t(text) *h, uint32_t max_keys, hash_probes_t *out);
 
 #ifdef __cplusplus
 }